@@ -0,0 +1,150 @@
+/*
+ * file:        bench-alloc.c
+ * description: block allocation latency microbenchmark for
+ *              CS 5600 / 7600 file system.
+ *
+ * Measures the average latency of get_free_blk() on a volume whose
+ * blocks are allocated up to 10%, 50% and 99% of capacity, and
+ * compares it with the original first-fit scan that tests one
+ * bit at a time from block 0. Blocks are allocated from the start
+ * of the volume, as left by a first-fit allocator.
+ *
+ * Usage: bench-alloc [-size #]
+ *   -size  volume size in blocks (K and M suffixes allowed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include "fs_util_meta.h"
+#include "fs_util_vol.h"
+
+/** Instance of ex2 fs structure */
+struct ext2_fs fs;
+
+/** Disk block device -- not used */
+struct blkdev *disk;
+
+/** number of allocations to time at each fullness */
+static const int n_allocs = 1000;
+
+/**
+ * Parse integer and return parsed value.
+ * Can include 'k' and 'm' suffix
+ */
+static int parseint(char *s)
+{
+    int n = strtol(s, &s, 0);
+    if (tolower(*s) == 'k')
+        return n * 1024;
+    if (tolower(*s) == 'm')
+        return n * 1024 * 1024;
+    return n;
+}
+
+/**
+ * Original first-fit allocator: tests one bit
+ * at a time starting from block 0.
+ *
+ * @return free block number or 0 if none available
+ */
+static int linear_get_free_blk(void)
+{
+    for (int i = 0; i < fs.n_blocks; i++) {
+        if (!FD_ISSET(i, fs.block_map)) {
+            FD_SET(i, fs.block_map);
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns the current time in nanoseconds.
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Allocate the first n_used blocks of the volume and reset
+ * the allocation cursor.
+ *
+ * @param n_used number of allocated blocks
+ */
+static void fill(int n_used)
+{
+    memset(fs.block_map, 0, fs.n_meta * FS_BLOCK_SIZE);
+    for (int i = 0; i < n_used; i++) {
+        FD_SET(i, fs.block_map);
+    }
+    fs.blk_cursor = 0;
+}
+
+/**
+ * Time allocation of a block followed by its return, so
+ * that the volume stays at the same fullness.
+ *
+ * @param get_blk the allocation function
+ * @return average allocation latency in nanoseconds
+ */
+static double time_allocs(int (*get_blk)(void))
+{
+    double total = 0;
+    for (int i = 0; i < n_allocs; i++) {
+        double t0 = now_ns();
+        int blkno = get_blk();
+        total += now_ns() - t0;
+        return_blk(blkno);
+    }
+    return total / n_allocs;
+}
+
+/**
+ * Run allocation benchmark.
+ *
+ * @param argc number of args including program name
+ * @param argv argv[1]: -size argv[2]: volume size in blocks
+ */
+int main(int argc, char **argv)
+{
+    int n_blocks = 1024 * 1024;
+    if (argc == 3 && strcmp(argv[1], "-size") == 0) {
+        n_blocks = parseint(argv[2]);
+    } else if (argc != 1) {
+        printf("usage: bench-alloc [-size #]\n");
+        exit(1);
+    }
+
+    // volume consisting only of a block map
+    set_block_size(FS_MIN_BLOCK_SIZE);
+    fs.n_blocks = n_blocks;
+    fs.n_meta = (n_blocks + BITS_PER_BLK - 1) / BITS_PER_BLK;
+    fs.block_map_base = 0;
+    fs.block_map = malloc(fs.n_meta * FS_BLOCK_SIZE);
+    fs.dirty_map = calloc((fs.n_meta + 63) / 64, sizeof(uint64_t));
+
+    printf("blocks: %d\n", n_blocks);
+    printf("%8s %16s %16s\n", "full", "first-fit (ns)", "next-fit (ns)");
+    int pcts[] = {10, 50, 99};
+    for (int i = 0; i < sizeof(pcts)/sizeof(pcts[0]); i++) {
+        int n_used = (int)((long long)n_blocks * pcts[i] / 100);
+
+        fill(n_used);
+        double linear = time_allocs(linear_get_free_blk);
+
+        fill(n_used);
+        double nextfit = time_allocs(get_free_blk);
+
+        printf("%7d%% %16.0f %16.0f\n", pcts[i], linear, nextfit);
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * file:        bench-blksize.c
+ * description: block size throughput benchmark for
+ *              CS 5600 / 7600 file system.
+ *
+ * Measures the throughput of writing a file sequentially with
+ * do_write() and reading it back with do_read(), on volumes with
+ * block sizes from 1K to 64K. Each volume is made in a temporary
+ * image file accessed through the image block device, layered by
+ * blkscale_create() as it is when mounted, so larger blocks mean
+ * fewer block requests and fewer indirect blocks per byte. Each
+ * block size is measured in its own process, as the file system
+ * caches are sized for one block size.
+ *
+ * Usage: bench-blksize [-size #] [-xfer #]
+ *   -size  file size in bytes (K and M suffixes allowed)
+ *   -xfer  bytes per write and read call (K and M suffixes allowed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_vol.h"
+#include "blkdev.h"
+#include "blkscale.h"
+#include "image.h"
+
+/** Instance of ex2 fs structure */
+struct ext2_fs fs;
+
+/** Disk block device */
+struct blkdev *disk;
+
+/**
+ * Parse integer and return parsed value.
+ * Can include 'k' and 'm' suffix
+ */
+static int parseint(char *s)
+{
+    int n = strtol(s, &s, 0);
+    if (tolower(*s) == 'k')
+        return n * 1024;
+    if (tolower(*s) == 'm')
+        return n * 1024 * 1024;
+    return n;
+}
+
+/**
+ * Returns the current time in nanoseconds.
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Make an empty file system with a block size in an image file,
+ * laid out as: superblock, inode map, block map, inodes, and root
+ * directory block, and mount it.
+ *
+ * @param path the image file
+ * @param blk_size the block size
+ * @param vol_size the volume size in bytes
+ */
+static void make_volume(char *path, int blk_size, off_t vol_size)
+{
+    set_block_size(blk_size);
+
+    fs.n_blocks = vol_size / blk_size;
+    fs.n_inodes = INODES_PER_BLK;
+    fs.inode_map_base = 1;
+    fs.inode_map = calloc(1, FS_BLOCK_SIZE);
+    fs.block_map_base = 2;
+    int n_map_blks = (fs.n_blocks + BITS_PER_BLK - 1) / BITS_PER_BLK;
+    fs.block_map = calloc(n_map_blks, FS_BLOCK_SIZE);
+    fs.inode_base = fs.block_map_base + n_map_blks;
+    fs.inodes = calloc(1, FS_BLOCK_SIZE);
+    fs.n_meta = fs.inode_base + 1;
+    fs.dirty_map = calloc((fs.n_meta + 63) / 64, sizeof(uint64_t));
+    init_inode_locks();
+
+    // root directory in first block after metadata
+    fs.root_inode = 1;
+    fs.inodes[1].mode = S_IFDIR | 0777;
+    fs.inodes[1].direct[0] = fs.n_meta;
+    for (int i = 0; i <= fs.n_meta; i++) {
+        FD_SET(i, fs.block_map);
+    }
+    FD_SET(0, fs.inode_map);
+    FD_SET(1, fs.inode_map);
+    fs.n_blocks_free = fs.n_blocks - (fs.n_meta + 1);
+    fs.n_inodes_free = fs.n_inodes - 2;
+
+    // empty image file of volume size, accessed in volume blocks
+    if (truncate(path, 0) < 0 || truncate(path, vol_size) < 0) {
+        perror("cannot make image");
+        exit(1);
+    }
+    disk = image_create(path);
+    if (disk != NULL && blk_size != BLOCK_SIZE) {
+        disk = blkscale_create(disk, blk_size);
+    }
+    if (disk == NULL) {
+        printf("cannot open image %s\n", path);
+        exit(1);
+    }
+}
+
+/**
+ * Time writing or reading a file in transfers of a fixed size.
+ *
+ * @param inum the file inode
+ * @param buf the transfer buffer
+ * @param xfer bytes per transfer
+ * @param size the file size
+ * @param write 1 to write the file, 0 to read it
+ * @return throughput in MB per second
+ */
+static double time_xfers(int inum, char *buf, int xfer, int size, int write)
+{
+    double t0 = now_ns();
+    for (int off = 0; off < size; off += xfer) {
+        int len = (size - off < xfer) ? size - off : xfer;
+        int n = write ? do_write(inum, buf, len, off) : do_read(inum, buf, len, off);
+        if (n != len) {
+            printf("%s at %d failed: %d\n", write ? "write" : "read", off, n);
+            exit(1);
+        }
+    }
+    return (size / 1048576.0) / ((now_ns() - t0) / 1e9);
+}
+
+/**
+ * Run block size benchmark.
+ *
+ * @param argc number of args including program name
+ * @param argv -size file size, -xfer transfer size
+ */
+int main(int argc, char **argv)
+{
+    int size = 32 * 1024 * 1024, xfer = 128 * 1024;
+    while (argc >= 3 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-size") == 0) {
+            size = parseint(argv[2]);
+        } else if (strcmp(argv[1], "-xfer") == 0) {
+            xfer = parseint(argv[2]);
+        } else {
+            break;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 1 || size <= 0 || xfer <= 0) {
+        printf("usage: bench-blksize [-size #] [-xfer #]\n");
+        exit(1);
+    }
+
+    char path[] = "/tmp/bench-blksize-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("cannot make image");
+        exit(1);
+    }
+    close(fd);
+
+    char *buf = malloc(xfer);
+    memset(buf, 'x', xfer);
+    printf("file: %d bytes, transfer: %d bytes\n", size, xfer);
+    printf("%8s %16s %16s\n", "block", "write (MB/s)", "read (MB/s)");
+    fflush(stdout);
+    for (int blk_size = FS_MIN_BLOCK_SIZE; blk_size <= FS_MAX_BLOCK_SIZE; blk_size *= 2) {
+        if (fork() != 0) {
+            wait(NULL);
+            continue;
+        }
+
+        // volume twice the file size, for metadata and indirect blocks
+        make_volume(path, blk_size, 2 * (off_t)size + 64 * (off_t)blk_size);
+        int inum = init_new_inode(0777, S_IFREG);
+        double write_rate = time_xfers(inum, buf, xfer, size, 1);
+        double read_rate = time_xfers(inum, buf, xfer, size, 0);
+        printf("%8d %16.0f %16.0f\n", blk_size, write_rate, read_rate);
+        disk->ops->close(disk);
+        exit(0);
+    }
+
+    unlink(path);
+    free(buf);
+    return 0;
+}
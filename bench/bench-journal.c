@@ -0,0 +1,267 @@
+/*
+ * file:        bench-journal.c
+ * description: metadata journal benchmark for
+ *              CS 5600 / 7600 file system.
+ *
+ * Measures the throughput of an fsync-heavy workload, in which
+ * concurrent threads each create files and write a block to each,
+ * and every operation makes its metadata durable before it returns.
+ * It compares a volume that writes its metadata in place, followed
+ * by a flush of the device, with a volume whose metadata is group
+ * committed to a journal, each commit with one sequential write and
+ * one flush, and with a volume whose journal commits are deferred to
+ * the background writeback thread, which is timed until a final
+ * writeback makes all of the operations durable. Each volume is made
+ * in a temporary image file accessed through the image block device,
+ * and each measurement runs in its own process, as the file system
+ * state is global.
+ *
+ * Usage: bench-journal [-ops #] [-journal #]
+ *   -ops      number of files created by each thread
+ *   -journal  journal size in blocks
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "fs_util_file.h"
+#include "fs_util_journal.h"
+#include "fs_util_meta.h"
+#include "fs_util_vol.h"
+#include "fs_util_writeback.h"
+#include "blkdev.h"
+#include "image.h"
+
+/** Instance of ex2 fs structure */
+struct ext2_fs fs;
+
+/** Disk block device */
+struct blkdev *disk;
+
+/** number of files created by each thread */
+static int n_ops = 200;
+
+/**
+ * Parse integer and return parsed value.
+ * Can include 'k' and 'm' suffix
+ */
+static int parseint(char *s)
+{
+    int n = strtol(s, &s, 0);
+    if (tolower(*s) == 'k')
+        return n * 1024;
+    if (tolower(*s) == 'm')
+        return n * 1024 * 1024;
+    return n;
+}
+
+/**
+ * Returns the current time in nanoseconds.
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Make an empty file system in an image file, laid out as:
+ * superblock, inode map, block map, inodes, journal, and root
+ * directory block, and mount it.
+ *
+ * @param path the image file
+ * @param n_blocks the volume size in blocks
+ * @param n_inodes the number of inodes
+ * @param journal_sz the journal size in blocks, or 0 for none
+ */
+static void make_volume(char *path, int n_blocks, int n_inodes, int journal_sz)
+{
+    set_block_size(FS_MIN_BLOCK_SIZE);
+
+    fs.n_blocks = n_blocks;
+    fs.inode_map_base = 1;
+    int n_imap_blks = (n_inodes + BITS_PER_BLK - 1) / BITS_PER_BLK;
+    fs.inode_map = calloc(n_imap_blks, FS_BLOCK_SIZE);
+    fs.block_map_base = fs.inode_map_base + n_imap_blks;
+    int n_map_blks = (fs.n_blocks + BITS_PER_BLK - 1) / BITS_PER_BLK;
+    fs.block_map = calloc(n_map_blks, FS_BLOCK_SIZE);
+    fs.inode_base = fs.block_map_base + n_map_blks;
+    int n_inode_blks = (n_inodes + INODES_PER_BLK - 1) / INODES_PER_BLK;
+    fs.n_inodes = n_inode_blks * INODES_PER_BLK;
+    fs.inodes = calloc(n_inode_blks, FS_BLOCK_SIZE);
+    fs.n_meta = fs.inode_base + n_inode_blks;
+    fs.journal_base = fs.n_meta;
+    fs.journal_sz = journal_sz;
+    fs.dirty_map = calloc((fs.n_meta + 63) / 64, sizeof(uint64_t));
+    init_inode_locks();
+
+    // root directory in first block after metadata and journal
+    int root_blkno = fs.journal_base + journal_sz;
+    fs.root_inode = 1;
+    fs.inodes[1].mode = S_IFDIR | 0777;
+    fs.inodes[1].direct[0] = root_blkno;
+    for (int i = 0; i <= root_blkno; i++) {
+        FD_SET(i, fs.block_map);
+    }
+    FD_SET(0, fs.inode_map);
+    FD_SET(1, fs.inode_map);
+    fs.n_blocks_free = fs.n_blocks - (root_blkno + 1);
+    fs.n_inodes_free = fs.n_inodes - 2;
+
+    // empty image file of volume size, with an empty journal
+    if (truncate(path, 0) < 0 || truncate(path, (off_t)n_blocks * FS_BLOCK_SIZE) < 0) {
+        perror("cannot make image");
+        exit(1);
+    }
+    disk = image_create(path);
+    if (disk == NULL) {
+        printf("cannot open image %s\n", path);
+        exit(1);
+    }
+    struct fs_journal_block *jsb = calloc(1, FS_BLOCK_SIZE);
+    *jsb = (struct fs_journal_block){.magic = FS_JOURNAL_MAGIC,
+            .type = FS_JOURNAL_SUPER, .seq = 1, .count = 1};
+    if (journal_sz > 0) {
+        disk->ops->write(disk, fs.journal_base, 1, jsb);
+    }
+    free(jsb);
+    if (open_journal(fs.n_meta) < 0) {
+        printf("cannot open journal\n");
+        exit(1);
+    }
+}
+
+/**
+ * Thread that creates files and writes a block to each. The write
+ * flushes the metadata, and a volume without a journal is then also
+ * flushed, so every operation is durable when it returns, unless the
+ * writeback thread defers the flush.
+ *
+ * @param arg the block to write
+ * @return NULL
+ */
+static void *create_files(void *arg)
+{
+    for (int i = 0; i < n_ops; i++) {
+        int inum = init_new_inode(0644, S_IFREG);
+        if (inum < 0) {
+            printf("create failed: %d\n", inum);
+            exit(1);
+        }
+        write_lock_inode(inum);
+        int n = do_write(inum, arg, FS_BLOCK_SIZE, 0);
+        unlock_inode(inum);
+        if (n != FS_BLOCK_SIZE) {
+            printf("write failed: %d\n", n);
+            exit(1);
+        }
+        if (fs.journal_sz == 0) {
+            disk->ops->flush(disk, 0, fs.n_blocks);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Time threads that create files concurrently, until the
+ * files are durable.
+ *
+ * @param n_threads the number of threads
+ * @return throughput in operations per second
+ */
+static double time_threads(int n_threads)
+{
+    pthread_t threads[n_threads];
+    char *block = malloc(FS_BLOCK_SIZE);
+    memset(block, 'x', FS_BLOCK_SIZE);
+    double t0 = now_ns();
+    for (int i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, create_files, block);
+    }
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    stop_writeback();
+    sync_writeback();
+    double rate = n_threads * n_ops / ((now_ns() - t0) / 1e9);
+    free(block);
+    return rate;
+}
+
+/**
+ * Run metadata journal benchmark.
+ *
+ * @param argc number of args including program name
+ * @param argv -ops files per thread, -journal journal size
+ */
+int main(int argc, char **argv)
+{
+    int journal_sz = 1024;
+    while (argc >= 3 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-ops") == 0) {
+            n_ops = parseint(argv[2]);
+        } else if (strcmp(argv[1], "-journal") == 0) {
+            journal_sz = parseint(argv[2]);
+        } else {
+            break;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 1 || n_ops <= 0 || journal_sz < 8) {
+        printf("usage: bench-journal [-ops #] [-journal #]\n");
+        exit(1);
+    }
+
+    char path[] = "/tmp/bench-journal-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("cannot make image");
+        exit(1);
+    }
+    close(fd);
+
+    static const int n_threads[] = {1, 4, 16};
+    int n_configs = sizeof(n_threads) / sizeof(n_threads[0]);
+    printf("files per thread: %d, journal: %d blocks\n", n_ops, journal_sz);
+    printf("%8s %16s %16s %16s\n", "threads", "in place (op/s)", "journal (op/s)",
+           "writeback (op/s)");
+    fflush(stdout);
+    for (int i = 0; i < n_configs; i++) {
+        printf("%8d", n_threads[i]);
+        fflush(stdout);
+        for (int mode = 0; mode <= 2; mode++) {
+            if (fork() != 0) {
+                wait(NULL);
+                continue;
+            }
+
+            // room for each file's inode and block
+            int n_files = n_threads[i] * n_ops;
+            make_volume(path, 2 * n_files + journal_sz + 1024, n_files + 2,
+                        (mode > 0) ? journal_sz : 0);
+            if (mode == 2) {
+                configure_writeback(WRITEBACK_AGE_MS, WRITEBACK_RATIO, NULL);
+                start_writeback();
+            }
+            printf(" %16.0f", time_threads(n_threads[i]));
+            fflush(stdout);
+            sync_metadata();
+            disk->ops->close(disk);
+            exit(0);
+        }
+        printf("\n");
+    }
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * file:        bench-path.c
+ * description: path resolution microbenchmark for
+ *              CS 5600 / 7600 file system.
+ *
+ * Measures the number of lookups per second of a 10-level path
+ * by get_inode_of_path(), which reads path elements in place, and
+ * compares it with the original resolver that splits the path into
+ * a token array of allocated strings before looking up each element.
+ * The file system is built in a memory block device, and the
+ * directory lookups of both resolvers are served from the dentry
+ * cache, so the difference is the cost of tokenizing the path.
+ *
+ * Usage: bench-path [-n #]
+ *   -n  number of lookups to time (K and M suffixes allowed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+
+#include "fs_util_dir.h"
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_path.h"
+#include "fs_util_vol.h"
+#include "blkdev.h"
+#include "split.h"
+
+/** Instance of ex2 fs structure */
+struct ext2_fs fs;
+
+/** Disk block device */
+struct blkdev *disk;
+
+enum {
+    /** number of blocks in memory volume */
+    N_BLOCKS = 1024,
+    /** number of inode blocks in memory volume */
+    N_INODE_BLKS = 8,
+    /** number of directory levels in path */
+    N_LEVELS = 10
+};
+
+/** memory volume blocks */
+static char *mem;
+
+/**
+ * Parse integer and return parsed value.
+ * Can include 'k' and 'm' suffix
+ */
+static int parseint(char *s)
+{
+    int n = strtol(s, &s, 0);
+    if (tolower(*s) == 'k')
+        return n * 1024;
+    if (tolower(*s) == 'm')
+        return n * 1024 * 1024;
+    return n;
+}
+
+/**
+ * Returns the current time in nanoseconds.
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Number of blocks in memory block device */
+static int mem_num_blocks(struct blkdev *dev)
+{
+    return N_BLOCKS;
+}
+
+/** Read blocks from memory block device */
+static int mem_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    memcpy(buf, mem + (size_t)offset * BLOCK_SIZE, (size_t)len * BLOCK_SIZE);
+    return SUCCESS;
+}
+
+/** Write blocks to memory block device */
+static int mem_write(struct blkdev *dev, int offset, int len, void *buf)
+{
+    memcpy(mem + (size_t)offset * BLOCK_SIZE, buf, (size_t)len * BLOCK_SIZE);
+    return SUCCESS;
+}
+
+/** Flush memory block device */
+static int mem_flush(struct blkdev *dev, int offset, int len)
+{
+    return SUCCESS;
+}
+
+/** Close memory block device */
+static void mem_close(struct blkdev *dev)
+{
+}
+
+/** Operations on memory block device */
+static struct blkdev_ops mem_ops = {
+    .num_blocks = mem_num_blocks,
+    .read = mem_read,
+    .write = mem_write,
+    .flush = mem_flush,
+    .close = mem_close
+};
+
+/**
+ * Make an empty file system in a memory block device, laid out
+ * as: inode map, block map, inodes, and root directory block.
+ */
+static void make_volume(void)
+{
+    static struct blkdev mem_dev = {.ops = &mem_ops};
+    mem = calloc(N_BLOCKS, BLOCK_SIZE);
+    disk = &mem_dev;
+
+    set_block_size(BLOCK_SIZE);
+    fs.inode_map_base = 1;
+    fs.inode_map = calloc(1, FS_BLOCK_SIZE);
+    fs.block_map_base = 2;
+    fs.block_map = calloc(1, FS_BLOCK_SIZE);
+    fs.inode_base = 3;
+    fs.n_inodes = N_INODE_BLKS * INODES_PER_BLK;
+    fs.inodes = calloc(N_INODE_BLKS, FS_BLOCK_SIZE);
+    fs.n_meta = fs.inode_base + N_INODE_BLKS;
+    fs.n_blocks = N_BLOCKS;
+    fs.dirty_map = calloc((fs.n_meta + 63) / 64, sizeof(uint64_t));
+    init_inode_locks();
+
+    // root directory in first block after metadata
+    fs.root_inode = 1;
+    fs.inodes[1].mode = S_IFDIR | 0777;
+    fs.inodes[1].direct[0] = fs.n_meta;
+    for (int i = 0; i <= fs.n_meta; i++) {
+        FD_SET(i, fs.block_map);
+    }
+    FD_SET(0, fs.inode_map);
+    FD_SET(1, fs.inode_map);
+    fs.n_blocks_free = fs.n_blocks - (fs.n_meta + 1);
+    fs.n_inodes_free = fs.n_inodes - 2;
+}
+
+/**
+ * Original path resolver: splits a copy of the path into
+ * an allocated array of allocated tokens, then looks up
+ * each token in turn.
+ *
+ * @param path the file path
+ * @return inode of path node or error
+ */
+static int split_get_inode_of_path(const char* path)
+{
+    // add '.' to end of path if ends with PATH_DELIM
+    char lpath[strlen(path)+2];
+    strcpy(lpath, path);
+    int idx = strlen(path) - strlen(PATH_DELIM);
+    if (idx >= 0 && strstr(path+idx, PATH_DELIM) != NULL) {
+        strcat(lpath, ".");
+    }
+
+    int pathlen = split(lpath, NULL, 0, PATH_DELIM);
+    char **pathtoks = malloc(pathlen*sizeof(char*));
+    split(lpath, pathtoks, pathlen, PATH_DELIM);
+
+    int inum = fs.root_inode;
+    for (int i = 0; i < pathlen && inum > 0; i++) {
+        inum = get_dir_entry_inode(inum, pathtoks[i]);
+    }
+
+    free_split_tokens(pathtoks, pathlen);
+    free(pathtoks);
+    return inum;
+}
+
+/**
+ * Time lookups of a path.
+ *
+ * @param get_inode the path resolver
+ * @param path the path
+ * @param n_lookups the number of lookups
+ * @return lookups per second
+ */
+static double time_lookups(int (*get_inode)(const char*), const char *path,
+                           int n_lookups)
+{
+    double t0 = now_ns();
+    for (int i = 0; i < n_lookups; i++) {
+        if (get_inode(path) <= 0) {
+            printf("lookup of %s failed\n", path);
+            exit(1);
+        }
+    }
+    return n_lookups / ((now_ns() - t0) / 1e9);
+}
+
+/**
+ * Run path resolution benchmark.
+ *
+ * @param argc number of args including program name
+ * @param argv argv[1]: -n argv[2]: number of lookups
+ */
+int main(int argc, char **argv)
+{
+    int n_lookups = 1000 * 1000;
+    if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+        n_lookups = parseint(argv[2]);
+    } else if (argc != 1) {
+        printf("usage: bench-path [-n #]\n");
+        exit(1);
+    }
+
+    // make directory for each level of path
+    make_volume();
+    char path[N_LEVELS * FS_FILENAME_SIZE] = "";
+    int inum = fs.root_inode;
+    for (int i = 0; i < N_LEVELS; i++) {
+        char leaf[FS_FILENAME_SIZE];
+        sprintf(leaf, "directory-%d", i);
+        inum = do_mkentry(inum, leaf, 0777, S_IFDIR);
+        if (inum < 0) {
+            printf("cannot make %s/%s\n", path, leaf);
+            exit(1);
+        }
+        strcat(path, "/");
+        strcat(path, leaf);
+    }
+
+    printf("path: %s\n", path);
+    printf("%16s %16s\n", "split (ops/s)", "in place (ops/s)");
+    double before = time_lookups(split_get_inode_of_path, path, n_lookups);
+    double after = time_lookups(get_inode_of_path, path, n_lookups);
+    printf("%16.0f %16.0f\n", before, after);
+
+    return 0;
+}
@@ -0,0 +1,742 @@
+/*
+ * file:        blkcache.c
+ * description: write-back block cache device for CS 7600 / CS 5600 file system
+ *
+ * The cache is a block device that is layered over another block
+ * device, such as the one returned by image_create(). Cached blocks
+ * are found through a hash table and are replaced using the CLOCK
+ * algorithm. Modified blocks are written back to the underlying
+ * device when they are evicted, or when the device is flushed or
+ * closed. A mutex serializes operations on the cache, so that it can
+ * be used by the threads of a multithreaded FUSE mount. The number of
+ * dirty blocks is kept current, so a writeback thread can flush the
+ * cache when too much of it is dirty.
+ *
+ * A batch of requests passed to blkdev_submit() is served from the
+ * cache, and the blocks it must transfer are forwarded to the
+ * underlying device as a batch, as are the dirty blocks written back
+ * when the cache is flushed, so a device such as the io_uring image
+ * device can keep them in flight together.
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blkcache.h"
+#include "blkdev.h"
+
+/** Entry in the block cache */
+struct cache_entry {
+    /** cached block number, or -1 if entry unused */
+    int blkno;
+    /** index of next entry in hash chain, or -1 if none */
+    int next;
+    /** 1 if block modified since written to device */
+    char dirty;
+    /** 1 if block referenced since last CLOCK sweep */
+    char ref;
+};
+
+/** Definition of cache block device */
+struct cache_dev {
+    /** the underlying block device */
+    struct blkdev *dev;
+    /** number of cache entries */
+    int nblks;
+    /** CLOCK hand: next entry to consider for replacement */
+    int hand;
+    /** number of entries with dirty blocks */
+    int ndirty;
+    /** number of hash buckets -- a power of 2 */
+    int nbuckets;
+    /** index of first entry in each hash chain, or -1 if none */
+    int *buckets;
+    /** cache entries */
+    struct cache_entry *entries;
+    /** cached block data, BLOCK_SIZE bytes per entry */
+    char *data;
+    /** lock for entries, hash chains, and CLOCK hand */
+    pthread_mutex_t lock;
+};
+
+/**
+ * Returns the hash bucket for a block number.
+ *
+ * @param cd the cache device
+ * @param blkno the block number
+ * @return the hash bucket index
+ */
+static inline int cache_hash(struct cache_dev *cd, int blkno)
+{
+    return ((unsigned)blkno * 2654435761u) & (cd->nbuckets - 1);
+}
+
+/**
+ * Returns pointer to the cached data of an entry.
+ *
+ * @param cd the cache device
+ * @param idx the entry index
+ * @return pointer to BLOCK_SIZE bytes of block data
+ */
+static inline char *cache_data(struct cache_dev *cd, int idx)
+{
+    return cd->data + (size_t)idx * BLOCK_SIZE;
+}
+
+/**
+ * Find the cache entry for a block number.
+ *
+ * @param cd the cache device
+ * @param blkno the block number
+ * @return the entry index, or -1 if block is not cached
+ */
+static int cache_lookup(struct cache_dev *cd, int blkno)
+{
+    for (int idx = cd->buckets[cache_hash(cd, blkno)];
+         idx != -1; idx = cd->entries[idx].next) {
+        if (cd->entries[idx].blkno == blkno) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Remove a cache entry from its hash chain.
+ *
+ * @param cd the cache device
+ * @param idx the entry index
+ */
+static void cache_unhash(struct cache_dev *cd, int idx)
+{
+    int *p = &cd->buckets[cache_hash(cd, cd->entries[idx].blkno)];
+    while (*p != idx) {
+        p = &cd->entries[*p].next;
+    }
+    *p = cd->entries[idx].next;
+    cd->entries[idx].next = -1;
+}
+
+/**
+ * Write a dirty cache entry back to the underlying device.
+ *
+ * @param cd the cache device
+ * @param idx the entry index
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_writeback(struct cache_dev *cd, int idx)
+{
+    struct cache_entry *e = &cd->entries[idx];
+    int status = cd->dev->ops->write(cd->dev, e->blkno, 1, cache_data(cd, idx));
+    if (status == SUCCESS) {
+        e->dirty = 0;
+        cd->ndirty--;
+    }
+    return status;
+}
+
+/**
+ * Write dirty cache entries back to the underlying device as
+ * one batch of requests. If the batch cannot be allocated, the
+ * entries are written back one at a time.
+ *
+ * @param cd the cache device
+ * @param idxs the entry indexes
+ * @param n the number of entries
+ * @return SUCCESS if successful, or status of first failed write
+ */
+static int cache_writeback_batch(struct cache_dev *cd, int *idxs, int n)
+{
+    if (n == 0) {
+        return SUCCESS;
+    }
+    struct blkdev_req *reqs = malloc(n * sizeof(struct blkdev_req));
+    if (reqs == NULL) {
+        int status = SUCCESS;
+        for (int i = 0; i < n; i++) {
+            int s = cache_writeback(cd, idxs[i]);
+            status = (status == SUCCESS) ? s : status;
+        }
+        return status;
+    }
+
+    for (int i = 0; i < n; i++) {
+        reqs[i] = (struct blkdev_req){.op = BLKDEV_WRITE,
+                .first_blk = cd->entries[idxs[i]].blkno, .num_blks = 1,
+                .buf = cache_data(cd, idxs[i])};
+    }
+    blkdev_submit(cd->dev, reqs, n);
+    int status = blkdev_complete(cd->dev, reqs, n);
+    for (int i = 0; i < n; i++) {
+        if (reqs[i].status == SUCCESS) {
+            cd->entries[idxs[i]].dirty = 0;
+            cd->ndirty--;
+        }
+    }
+    free(reqs);
+    return status;
+}
+
+/**
+ * Choose an entry for a block that is not in the cache, writing
+ * back the block it currently holds if it is dirty. The entry is
+ * chosen using the CLOCK algorithm: the hand skips past entries
+ * that were referenced since its last sweep, clearing their
+ * reference bit, and stops at the first one that was not.
+ *
+ * @param cd the cache device
+ * @param blkno the block number for the entry
+ * @return the entry index, or device error status
+ */
+static int cache_insert(struct cache_dev *cd, int blkno)
+{
+    int idx;
+    while (1) {
+        idx = cd->hand;
+        cd->hand = (cd->hand + 1) % cd->nblks;
+        if (cd->entries[idx].blkno == -1 || !cd->entries[idx].ref) {
+            break;
+        }
+        cd->entries[idx].ref = 0;  // second chance
+    }
+
+    // write back and remove previous block
+    struct cache_entry *e = &cd->entries[idx];
+    if (e->blkno != -1) {
+        if (e->dirty) {
+            int status = cache_writeback(cd, idx);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+        cache_unhash(cd, idx);
+    }
+
+    // add entry for new block to its hash chain
+    int h = cache_hash(cd, blkno);
+    e->blkno = blkno;
+    e->dirty = 0;
+    e->ref = 1;
+    e->next = cd->buckets[h];
+    cd->buckets[h] = idx;
+    return idx;
+}
+
+/**
+ * Write back, as one batch, the dirty blocks of the entries that
+ * the CLOCK hand reaches next without a reference, which are the
+ * entries that cache_insert() is about to replace. An entry that
+ * is still dirty when it is replaced is written back by itself.
+ *
+ * @param cd the cache device
+ * @param n the number of entries about to be replaced
+ */
+static void cache_clean_ahead(struct cache_dev *cd, int n)
+{
+    if (n == 0) {
+        return;
+    }
+    int *idxs = malloc(((n < cd->nblks) ? n : cd->nblks) * sizeof(int));
+    if (idxs == NULL) {
+        return;
+    }
+    int ndirty = 0;
+    for (int i = 0, k = 0; i < cd->nblks && k < n; i++) {
+        int idx = (cd->hand + i) % cd->nblks;
+        struct cache_entry *e = &cd->entries[idx];
+        if (e->blkno == -1 || !e->ref) {
+            k++;
+            if (e->dirty) {
+                idxs[ndirty++] = idx;
+            }
+        }
+    }
+    cache_writeback_batch(cd, idxs, ndirty);
+    free(idxs);
+}
+
+/**
+ * Determines whether a transfer is too large to be kept in the cache.
+ * Large sequential transfers would otherwise evict the hot metadata
+ * and directory blocks that the cache is meant to hold.
+ *
+ * @param cd the cache device
+ * @param len number of blocks in the transfer
+ * @return 1 (true) if transfer bypasses the cache, 0 (false) otherwise
+ */
+static inline int cache_bypass(struct cache_dev *cd, int len)
+{
+    return len > cd->nblks / 4;
+}
+
+/**
+ * The number of blocks in the block device.
+ *
+ * @param dev the block device
+ */
+static int cache_num_blocks(struct blkdev *dev)
+{
+    struct cache_dev *cd = dev->private;
+    return cd->dev->ops->num_blocks(cd->dev);
+}
+
+/**
+ * Add blocks read from the underlying device to the cache, with
+ * the cache locked. Blocks already in the cache are kept.
+ *
+ * @param cd the cache device
+ * @param offset starting block offset
+ * @param len number of blocks read
+ * @param buf the blocks read
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_fill(struct cache_dev *cd, int offset, int len, void *buf)
+{
+    for (int i = 0; i < len; i++) {
+        if (cache_lookup(cd, offset + i) != -1) {
+            continue;
+        }
+        int idx = cache_insert(cd, offset + i);
+        if (idx < 0) {
+            return idx;
+        }
+        memcpy(cache_data(cd, idx), (char*)buf + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Read blocks from the cache with the cache locked. Blocks not
+ * in the cache are read from the underlying device in runs of
+ * consecutive missing blocks.
+ *
+ * @param cd the cache device
+ * @param offset starting block offset
+ * @param len number of blocks to read
+ * @param buf the input buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_read_locked(struct cache_dev *cd, int offset, int len, void *buf)
+{
+    int bypass = cache_bypass(cd, len);
+
+    for (int i = 0; i < len; ) {
+        int idx = cache_lookup(cd, offset + i);
+        if (idx != -1) {
+            // copy cached block
+            memcpy((char*)buf + (size_t)i * BLOCK_SIZE, cache_data(cd, idx), BLOCK_SIZE);
+            cd->entries[idx].ref = 1;
+            i++;
+            continue;
+        }
+
+        // read run of missing blocks directly into buffer
+        int n = 1;
+        while (i + n < len && cache_lookup(cd, offset + i + n) == -1) {
+            n++;
+        }
+        char *p = (char*)buf + (size_t)i * BLOCK_SIZE;
+        int status = cd->dev->ops->read(cd->dev, offset + i, n, p);
+        if (status != SUCCESS) {
+            return status;
+        }
+
+        // add blocks read to the cache
+        if (!bypass && (status = cache_fill(cd, offset + i, n, p)) != SUCCESS) {
+            return status;
+        }
+        i += n;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Read blocks from block device starting at give block offset.
+ * Blocks not in the cache are read from the underlying device in
+ * runs of consecutive missing blocks.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to read
+ * @param buf the input buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct cache_dev *cd = dev->private;
+    pthread_mutex_lock(&cd->lock);
+    int status = cache_read_locked(cd, offset, len, buf);
+    pthread_mutex_unlock(&cd->lock);
+    return status;
+}
+
+/**
+ * Store blocks written in the cache, with the cache locked. Blocks
+ * are stored in the cache and marked dirty, unless the transfer is
+ * too large to cache and was written through to the underlying
+ * device, in which case only copies already in the cache are
+ * updated, and are clean.
+ *
+ * @param cd the cache device
+ * @param offset starting block offset
+ * @param len number of blocks written
+ * @param buf the output buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_store(struct cache_dev *cd, int offset, int len, void *buf)
+{
+    int bypass = cache_bypass(cd, len);
+
+    for (int i = 0; i < len; i++) {
+        int idx = cache_lookup(cd, offset + i);
+        if (idx == -1) {
+            if (bypass) {
+                continue;
+            }
+            idx = cache_insert(cd, offset + i);
+            if (idx < 0) {
+                return idx;
+            }
+        }
+        memcpy(cache_data(cd, idx), (char*)buf + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        cd->ndirty += !bypass - cd->entries[idx].dirty;
+        cd->entries[idx].dirty = !bypass;
+        cd->entries[idx].ref = 1;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Write blocks to the cache with the cache locked. Blocks are
+ * written to the cache and marked dirty. Transfers too large to
+ * cache are written through to the underlying device, and any
+ * copies already in the cache are updated.
+ *
+ * @param cd the cache device
+ * @param offset starting block offset
+ * @param len number of blocks to write
+ * @param buf the output buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_write_locked(struct cache_dev *cd, int offset, int len, void *buf)
+{
+    if (cache_bypass(cd, len)) {
+        int status = cd->dev->ops->write(cd->dev, offset, len, buf);
+        if (status != SUCCESS) {
+            return status;
+        }
+    }
+    return cache_store(cd, offset, len, buf);
+}
+
+/**
+ * Write blocks to block device starting at give block offset.
+ * Blocks are written to the cache and marked dirty. Transfers too
+ * large to cache are written through to the underlying device, and
+ * any copies already in the cache are updated.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to write
+ * @param buf the output buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_write(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct cache_dev *cd = dev->private;
+    pthread_mutex_lock(&cd->lock);
+    int status = cache_write_locked(cd, offset, len, buf);
+    pthread_mutex_unlock(&cd->lock);
+    return status;
+}
+
+/**
+ * Submit a batch of requests. Blocks in the cache are copied to
+ * and from the request buffers, and the runs of blocks missing from
+ * the cache that are read, and the transfers too large to cache
+ * that are written through, are forwarded to the underlying device
+ * as one batch, after the dirty blocks that the blocks added to the
+ * cache will replace are written back as another. The requests
+ * are complete when this function returns. If the batch cannot
+ * be allocated, the requests are performed one at a time.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if submitted, or error status
+ */
+static int cache_submit(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    struct cache_dev *cd = dev->private;
+
+    // a read has at most one run of missing blocks per two blocks
+    int maxsub = 0;
+    for (int i = 0; i < nreqs; i++) {
+        maxsub += (reqs[i].op == BLKDEV_READ) ? (reqs[i].num_blks + 1) / 2 : 1;
+    }
+    struct blkdev_req *sub = malloc(maxsub * sizeof(struct blkdev_req));
+    int *owner = malloc(maxsub * sizeof(int));
+    if (sub == NULL || owner == NULL) {
+        free(sub);
+        free(owner);
+        for (int i = 0; i < nreqs; i++) {
+            struct blkdev_req *r = &reqs[i];
+            r->status = (r->op == BLKDEV_READ)
+                      ? cache_read(dev, r->first_blk, r->num_blks, r->buf)
+                      : cache_write(dev, r->first_blk, r->num_blks, r->buf);
+        }
+        return SUCCESS;
+    }
+
+    // copy cached blocks, and find transfers and blocks to add
+    pthread_mutex_lock(&cd->lock);
+    int nsub = 0, nadd = 0;
+    for (int i = 0; i < nreqs; i++) {
+        struct blkdev_req *r = &reqs[i];
+        int bypass = cache_bypass(cd, r->num_blks);
+        r->status = SUCCESS;
+        if (r->op == BLKDEV_WRITE) {
+            if (bypass) {
+                owner[nsub] = i;
+                sub[nsub++] = *r;
+            }
+            for (int j = 0; !bypass && j < r->num_blks; j++) {
+                nadd += (cache_lookup(cd, r->first_blk + j) == -1);
+            }
+            continue;
+        }
+        for (int j = 0; j < r->num_blks; ) {
+            char *p = (char*)r->buf + (size_t)j * BLOCK_SIZE;
+            int idx = cache_lookup(cd, r->first_blk + j);
+            if (idx != -1) {
+                memcpy(p, cache_data(cd, idx), BLOCK_SIZE);
+                cd->entries[idx].ref = 1;
+                j++;
+                continue;
+            }
+            int n = 1;
+            while (j + n < r->num_blks && cache_lookup(cd, r->first_blk + j + n) == -1) {
+                n++;
+            }
+            owner[nsub] = i;
+            sub[nsub++] = (struct blkdev_req){.op = BLKDEV_READ,
+                    .first_blk = r->first_blk + j, .num_blks = n, .buf = p};
+            nadd += bypass ? 0 : n;
+            j += n;
+        }
+    }
+
+    // write back blocks about to be replaced, then transfer blocks
+    cache_clean_ahead(cd, nadd);
+    blkdev_submit(cd->dev, sub, nsub);
+    blkdev_complete(cd->dev, sub, nsub);
+
+    for (int s = 0; s < nsub; s++) {
+        struct blkdev_req *r = &reqs[owner[s]];
+        if (r->status == SUCCESS) {
+            r->status = sub[s].status;
+        }
+    }
+
+    // update cached copies of blocks written through before blocks
+    // are replaced, as replacing a stale dirty copy writes it back
+    for (int i = 0; i < nreqs; i++) {
+        struct blkdev_req *r = &reqs[i];
+        if (r->op == BLKDEV_WRITE && r->status == SUCCESS && cache_bypass(cd, r->num_blks)) {
+            r->status = cache_store(cd, r->first_blk, r->num_blks, r->buf);
+        }
+    }
+
+    // add blocks read, then blocks written, to the cache
+    for (int s = 0; s < nsub; s++) {
+        struct blkdev_req *r = &reqs[owner[s]];
+        if (r->op == BLKDEV_READ && r->status == SUCCESS && !cache_bypass(cd, r->num_blks)) {
+            r->status = cache_fill(cd, sub[s].first_blk, sub[s].num_blks, sub[s].buf);
+        }
+    }
+    for (int i = 0; i < nreqs; i++) {
+        struct blkdev_req *r = &reqs[i];
+        if (r->op == BLKDEV_WRITE && r->status == SUCCESS && !cache_bypass(cd, r->num_blks)) {
+            r->status = cache_store(cd, r->first_blk, r->num_blks, r->buf);
+        }
+    }
+    pthread_mutex_unlock(&cd->lock);
+
+    free(sub);
+    free(owner);
+    return SUCCESS;
+}
+
+/**
+ * Wait for a batch of submitted requests to complete. The
+ * requests were completed when they were submitted.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if all requests succeeded, or status of first failed request
+ */
+static int cache_complete(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    for (int i = 0; i < nreqs; i++) {
+        if (reqs[i].status != SUCCESS) {
+            return reqs[i].status;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Flush the block device. Writes back dirty cached blocks
+ * in the range as one batch, and then flushes the underlying
+ * device.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to flush
+ * @return SUCCESS if successful, or device error status
+ */
+static int cache_flush(struct blkdev *dev, int offset, int len)
+{
+    struct cache_dev *cd = dev->private;
+
+    pthread_mutex_lock(&cd->lock);
+    int *idxs = malloc(cd->ndirty * sizeof(int));
+    int n = 0, status = SUCCESS;
+    for (int idx = 0; idx < cd->nblks && status == SUCCESS; idx++) {
+        struct cache_entry *e = &cd->entries[idx];
+        if (e->dirty && e->blkno >= offset && e->blkno < offset + len) {
+            if (idxs != NULL) {
+                idxs[n++] = idx;
+            } else {
+                status = cache_writeback(cd, idx);
+            }
+        }
+    }
+    if (idxs != NULL) {
+        status = cache_writeback_batch(cd, idxs, n);
+        free(idxs);
+    }
+    pthread_mutex_unlock(&cd->lock);
+
+    if (status != SUCCESS) {
+        return status;
+    }
+    return cd->dev->ops->flush(cd->dev, offset, len);
+}
+
+/**
+ * Close the block device. Writes back all dirty cached
+ * blocks and closes the underlying device.
+ *
+ * @param dev the block device
+ */
+static void cache_close(struct blkdev *dev)
+{
+    struct cache_dev *cd = dev->private;
+
+    cache_flush(dev, 0, cache_num_blocks(dev));
+    cd->dev->ops->close(cd->dev);
+
+    free(cd->buckets);
+    free(cd->entries);
+    free(cd->data);
+    pthread_mutex_destroy(&cd->lock);
+    free(cd);
+    dev->private = NULL;        /* crash any attempts to access */
+    free(dev);
+}
+
+/**
+ * Returns the percentage of the cache that holds dirty blocks.
+ *
+ * @param dev the cache device
+ * @return the percentage of cache entries with dirty blocks
+ */
+int blkcache_dirty_ratio(struct blkdev *dev)
+{
+    struct cache_dev *cd = dev->private;
+    pthread_mutex_lock(&cd->lock);
+    int ratio = (int)((long long)cd->ndirty * 100 / cd->nblks);
+    pthread_mutex_unlock(&cd->lock);
+    return ratio;
+}
+
+/** Operations on this block device */
+static struct blkdev_ops cache_ops = {
+    .num_blocks = cache_num_blocks,
+    .read = cache_read,
+    .write = cache_write,
+    .flush = cache_flush,
+    .close = cache_close,
+    .submit = cache_submit,
+    .complete = cache_complete
+};
+
+/**
+ * Create a caching block device layered over another block device.
+ * Blocks are cached in a hash-indexed buffer pool of nblks entries
+ * that is replaced using the CLOCK algorithm. Writes are held in the
+ * cache until the block is evicted, or the device is flushed or closed.
+ * Closing the cache device also closes the underlying device.
+ *
+ * @param dev the underlying block device
+ * @param nblks the number of blocks to cache
+ * @return the block device or NULL if cannot allocate cache
+ */
+struct blkdev *blkcache_create(struct blkdev *dev, int nblks)
+{
+    if (dev == NULL || nblks <= 0) {
+        return NULL;
+    }
+
+    struct blkdev *cdev = malloc(sizeof(*cdev));
+    struct cache_dev *cd = malloc(sizeof(*cd));
+    if (cdev == NULL || cd == NULL) {
+        free(cdev);
+        free(cd);
+        return NULL;
+    }
+
+    // use about two hash buckets per entry
+    cd->nbuckets = 1;
+    while (cd->nbuckets < 2 * nblks) {
+        cd->nbuckets <<= 1;
+    }
+
+    cd->dev = dev;
+    cd->nblks = nblks;
+    cd->hand = 0;
+    cd->ndirty = 0;
+    pthread_mutex_init(&cd->lock, NULL);
+    cd->buckets = malloc(cd->nbuckets * sizeof(int));
+    cd->entries = malloc(nblks * sizeof(struct cache_entry));
+    cd->data = malloc((size_t)nblks * BLOCK_SIZE);
+    if (cd->buckets == NULL || cd->entries == NULL || cd->data == NULL) {
+        free(cd->buckets);
+        free(cd->entries);
+        free(cd->data);
+        free(cd);
+        free(cdev);
+        return NULL;
+    }
+
+    // all hash chains and entries are initially empty
+    for (int i = 0; i < cd->nbuckets; i++) {
+        cd->buckets[i] = -1;
+    }
+    for (int i = 0; i < nblks; i++) {
+        cd->entries[i] = (struct cache_entry){.blkno = -1, .next = -1,
+                                              .dirty = 0, .ref = 0};
+    }
+
+    cdev->private = cd;
+    cdev->ops = &cache_ops;
+
+    return cdev;
+}
@@ -0,0 +1,36 @@
+/*
+ * file:        blkcache.h
+ *
+ * description: write-back block cache device for CS 7600 / CS 5600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#ifndef BLKCACHE_H_
+#define BLKCACHE_H_
+
+#include "blkdev.h"
+
+/**
+ * Create a caching block device layered over another block device.
+ * Blocks are cached in a hash-indexed buffer pool of nblks entries
+ * that is replaced using the CLOCK algorithm. Writes are held in the
+ * cache until the block is evicted, or the device is flushed or closed.
+ * Closing the cache device also closes the underlying device.
+ *
+ * @param dev the underlying block device
+ * @param nblks the number of blocks to cache
+ * @return the block device or NULL if cannot allocate cache
+ */
+extern struct blkdev *blkcache_create(struct blkdev *dev, int nblks);
+
+/**
+ * Returns the percentage of the cache that holds dirty blocks,
+ * which have not been written back to the underlying device.
+ *
+ * @param dev the cache device
+ * @return the percentage of cache entries with dirty blocks
+ */
+extern int blkcache_dirty_ratio(struct blkdev *dev);
+
+#endif /* BLKCACHE_H_ */
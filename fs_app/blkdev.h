@@ -22,7 +22,31 @@ enum {
     /** block unavailable */
     E_UNAVAIL = -2,
     /** bad block size */
-    E_SIZE = -3
+    E_SIZE = -3,
+    /** block operation submitted but not yet complete */
+    PENDING = 1
+};
+
+/** block device request operation */
+enum {
+    /** read blocks into request buffer */
+    BLKDEV_READ = 0,
+    /** write blocks from request buffer */
+    BLKDEV_WRITE = 1
+};
+
+/** Block device request for submission as part of a batch */
+struct blkdev_req {
+    /** request operation: BLKDEV_READ or BLKDEV_WRITE */
+    int op;
+    /** first block of request */
+    int first_blk;
+    /** number of blocks in request */
+    int num_blks;
+    /** request buffer */
+    void *buf;
+    /** block operation status, PENDING until complete */
+    int status;
 };
 
 /** Definition of a block device */
@@ -45,6 +69,73 @@ struct blkdev_ops {
     int  (*flush)(struct blkdev *dev, int first_blk, int num_blks);
     /* close device function */
     void (*close)(struct blkdev *dev);
+    /** submit requests function, NULL if device is synchronous */
+    int  (*submit)(struct blkdev *dev, struct blkdev_req *reqs, int nreqs);
+    /** wait for submitted requests function, NULL if device is synchronous */
+    int  (*complete)(struct blkdev *dev, struct blkdev_req *reqs, int nreqs);
+    /** file descriptor function, NULL if blocks are not stored directly in a file */
+    int  (*fd)(struct blkdev *dev);
 };
 
+/**
+ * Submit a batch of requests to a block device. A device that
+ * does not support submission performs the requests before
+ * returning. Request buffers must remain valid until the requests
+ * are completed by blkdev_complete().
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if submitted, or error status
+ */
+static inline int blkdev_submit(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    if (dev->ops->submit != NULL) {
+        return dev->ops->submit(dev, reqs, nreqs);
+    }
+    for (int i = 0; i < nreqs; i++) {
+        struct blkdev_req *r = &reqs[i];
+        r->status = (r->op == BLKDEV_READ)
+                  ? dev->ops->read(dev, r->first_blk, r->num_blks, r->buf)
+                  : dev->ops->write(dev, r->first_blk, r->num_blks, r->buf);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Wait for a batch of submitted requests to complete.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if all requests succeeded, or status of first failed request
+ */
+static inline int blkdev_complete(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    if (dev->ops->complete != NULL) {
+        return dev->ops->complete(dev, reqs, nreqs);
+    }
+    for (int i = 0; i < nreqs; i++) {
+        if (reqs[i].status != SUCCESS) {
+            return reqs[i].status;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Returns a file descriptor of the file that stores the blocks of a
+ * block device, with block n at file offset n * BLOCK_SIZE, so that
+ * blocks can be transferred to and from the file without copying them
+ * through the device. Returns -1 if the device keeps block content
+ * that is not in the file, such as a write-back cache.
+ *
+ * @param dev the block device
+ * @return the file descriptor, or -1 if not available
+ */
+static inline int blkdev_fd(struct blkdev *dev)
+{
+    return (dev->ops->fd != NULL) ? dev->ops->fd(dev) : -1;
+}
+
 #endif
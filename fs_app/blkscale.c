@@ -0,0 +1,201 @@
+/*
+ * file:        blkscale.c
+ * description: large-block device for CS 7600 / CS 5600 file system
+ *
+ * The device is layered over another block device, such as the one
+ * returned by image_create(), to give a file system volume blocks
+ * that are larger than BLOCK_SIZE. Block numbers and counts are
+ * multiplied by the number of underlying blocks per block, so every
+ * operation, including a batch of submitted requests, maps to the
+ * same number of operations on the underlying device.
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <stdlib.h>
+
+#include "blkscale.h"
+#include "blkdev.h"
+
+/** Definition of large-block device */
+struct scale_dev {
+    /** the underlying block device */
+    struct blkdev *dev;
+    /** number of underlying blocks per block */
+    int scale;
+};
+
+/**
+ * The number of blocks in the block device.
+ *
+ * @param dev the block device
+ */
+static int scale_num_blocks(struct blkdev *dev)
+{
+    struct scale_dev *sd = dev->private;
+    return sd->dev->ops->num_blocks(sd->dev) / sd->scale;
+}
+
+/**
+ * Read blocks from block device starting at give block offset.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to read
+ * @param buf the input buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int scale_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct scale_dev *sd = dev->private;
+    if (offset < 0 || len < 0 || offset + len > scale_num_blocks(dev)) {
+        return E_BADADDR;
+    }
+    return sd->dev->ops->read(sd->dev, offset * sd->scale, len * sd->scale, buf);
+}
+
+/**
+ * Write blocks to block device starting at give block offset.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to write
+ * @param buf the output buffer
+ * @return SUCCESS if successful, or device error status
+ */
+static int scale_write(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct scale_dev *sd = dev->private;
+    if (offset < 0 || len < 0 || offset + len > scale_num_blocks(dev)) {
+        return E_BADADDR;
+    }
+    return sd->dev->ops->write(sd->dev, offset * sd->scale, len * sd->scale, buf);
+}
+
+/**
+ * Flush the block device.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to flush
+ * @return SUCCESS if successful, or device error status
+ */
+static int scale_flush(struct blkdev *dev, int offset, int len)
+{
+    struct scale_dev *sd = dev->private;
+    return sd->dev->ops->flush(sd->dev, offset * sd->scale, len * sd->scale);
+}
+
+/**
+ * Submit a batch of requests. The block numbers and counts of
+ * the requests are converted to underlying blocks in place, and
+ * are converted back when the requests are completed.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if submitted, or error status
+ */
+static int scale_submit(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    struct scale_dev *sd = dev->private;
+    for (int i = 0; i < nreqs; i++) {
+        reqs[i].first_blk *= sd->scale;
+        reqs[i].num_blks *= sd->scale;
+    }
+    return blkdev_submit(sd->dev, reqs, nreqs);
+}
+
+/**
+ * Wait for a batch of submitted requests to complete, and
+ * convert their block numbers and counts back to blocks.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if all requests succeeded, or status of first failed request
+ */
+static int scale_complete(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    struct scale_dev *sd = dev->private;
+    int status = blkdev_complete(sd->dev, reqs, nreqs);
+    for (int i = 0; i < nreqs; i++) {
+        reqs[i].first_blk /= sd->scale;
+        reqs[i].num_blks /= sd->scale;
+    }
+    return status;
+}
+
+/**
+ * Returns the file descriptor of the underlying device, in which
+ * block n is at file offset n * the block size.
+ *
+ * @param dev the block device
+ * @return the file descriptor, or -1 if not available
+ */
+static int scale_fd(struct blkdev *dev)
+{
+    struct scale_dev *sd = dev->private;
+    return blkdev_fd(sd->dev);
+}
+
+/**
+ * Close the block device and the underlying device.
+ *
+ * @param dev the block device
+ */
+static void scale_close(struct blkdev *dev)
+{
+    struct scale_dev *sd = dev->private;
+    sd->dev->ops->close(sd->dev);
+    free(sd);
+    dev->private = NULL;        /* crash any attempts to access */
+    free(dev);
+}
+
+/** Operations on this block device */
+static struct blkdev_ops scale_ops = {
+    .num_blocks = scale_num_blocks,
+    .read = scale_read,
+    .write = scale_write,
+    .flush = scale_flush,
+    .close = scale_close,
+    .submit = scale_submit,
+    .complete = scale_complete,
+    .fd = scale_fd
+};
+
+/**
+ * Create a block device with blocks of blk_size bytes layered over
+ * another block device with BLOCK_SIZE byte blocks. Block n of the
+ * device is the blk_size / BLOCK_SIZE underlying blocks starting at
+ * block n * (blk_size / BLOCK_SIZE), so each transfer is a single
+ * transfer of the underlying device. If the underlying device stores
+ * its blocks in a file, block n is at file offset n * blk_size.
+ * Closing the device also closes the underlying device.
+ *
+ * @param dev the underlying block device
+ * @param blk_size the block size, a multiple of BLOCK_SIZE
+ * @return the block device or NULL if cannot allocate device
+ */
+struct blkdev *blkscale_create(struct blkdev *dev, int blk_size)
+{
+    if (dev == NULL || blk_size < BLOCK_SIZE || blk_size % BLOCK_SIZE != 0) {
+        return NULL;
+    }
+
+    struct blkdev *sdev = malloc(sizeof(*sdev));
+    struct scale_dev *sd = malloc(sizeof(*sd));
+    if (sdev == NULL || sd == NULL) {
+        free(sdev);
+        free(sd);
+        return NULL;
+    }
+
+    sd->dev = dev;
+    sd->scale = blk_size / BLOCK_SIZE;
+    sdev->private = sd;
+    sdev->ops = &scale_ops;
+
+    return sdev;
+}
@@ -0,0 +1,29 @@
+/*
+ * file:        blkscale.h
+ *
+ * description: large-block device for CS 7600 / CS 5600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#ifndef BLKSCALE_H_
+#define BLKSCALE_H_
+
+#include "blkdev.h"
+
+/**
+ * Create a block device with blocks of blk_size bytes layered over
+ * another block device with BLOCK_SIZE byte blocks. Block n of the
+ * device is the blk_size / BLOCK_SIZE underlying blocks starting at
+ * block n * (blk_size / BLOCK_SIZE), so each transfer is a single
+ * transfer of the underlying device. If the underlying device stores
+ * its blocks in a file, block n is at file offset n * blk_size.
+ * Closing the device also closes the underlying device.
+ *
+ * @param dev the underlying block device
+ * @param blk_size the block size, a multiple of BLOCK_SIZE
+ * @return the block device or NULL if cannot allocate device
+ */
+extern struct blkdev *blkscale_create(struct blkdev *dev, int blk_size);
+
+#endif /* BLKSCALE_H_ */
@@ -13,8 +13,11 @@
 #include <stdint.h>
 
 enum {
-    /** file system block size in bytes */
-	FS_BLOCK_SIZE = 1024,
+    /** smallest file system block size in bytes, and the block
+     *  size of a volume whose superblock does not record one */
+	FS_MIN_BLOCK_SIZE = 1024,
+    /** largest file system block size in bytes */
+	FS_MAX_BLOCK_SIZE = 65536,
     /** magic number for superblock */
 	FS_MAGIC = 0x37363030
 };
@@ -39,6 +42,45 @@ struct fs_dirent {
     char name[FS_FILENAME_SIZE];
 };	/* total 32 bytes */
 
+enum {
+    /** magic number of a directory index block. The low bit is
+     *  clear, so the block holds no valid directory entries. */
+    FS_DX_MAGIC = 0x58444900
+};
+
+/**
+ * Entry in a directory index block
+ */
+struct fs_dx_entry {
+    /** lowest name hash of entries below this one (low bit clear) */
+    uint32_t hash;
+    /** 0-based index of directory block below this one */
+    uint32_t block;
+};	/* total 8 bytes */
+
+/**
+ * Directory index block. Block 0 of an indexed directory is the
+ * root of a tree of index blocks, whose entries are sorted by name
+ * hash. The entries of the lowest level point to ordinary blocks of
+ * directory entries, holding the entries in their range of hashes.
+ * The hash fields line up with the valid bits of fs_dirent slots,
+ * so an index block reads as a block of unused directory entries.
+ */
+struct fs_dx_node {
+    /** directory index magic number */
+    uint32_t magic;
+    /** number of index levels below this one */
+    uint16_t levels;
+    /** number of entries */
+    uint16_t count;
+    /** number of blocks in directory (root only) */
+    uint32_t nblocks;
+    /** unused */
+    uint32_t pad;
+    /** entries, sorted by hash, to the end of the block */
+    struct fs_dx_entry entries[];
+};	/* total one block */
+
 /**
  * Superblock - holds file system parameters.
  */
@@ -55,10 +97,16 @@ struct fs_super {
     uint32_t num_blocks;
     /** always inode 1 */
     uint32_t root_inode;
+    /** block size in bytes, a power of 2 from FS_MIN_BLOCK_SIZE
+     *  to FS_MAX_BLOCK_SIZE, or 0 for FS_MIN_BLOCK_SIZE */
+    uint32_t block_size;
+    /** metadata journal size in blocks, following the inode
+     *  region, or 0 for no journal */
+    uint32_t journal_sz;
 
-    /* pad out to an entire block */
-    char pad[FS_BLOCK_SIZE - 6 * sizeof(uint32_t)]; 
-};	/* total FS_BLOCK_SIZE bytes */
+    /* pad out to the smallest block */
+    char pad[FS_MIN_BLOCK_SIZE - 8 * sizeof(uint32_t)];
+};	/* total FS_MIN_BLOCK_SIZE bytes, at the start of block 0 */
 
 enum {
     /** number direct entries */
@@ -79,7 +127,7 @@ struct fs_inode {
     uint32_t ctime;
     /** last modification time */
     uint32_t mtime;
-    /** size in bytes */
+    /** size in bytes, low 32 bits (see size_hi) */
     uint32_t size;
     /** number of links */
     uint32_t nlink;
@@ -89,25 +137,131 @@ struct fs_inode {
     uint32_t indir_1;
     /** double indirect block pointer */
     uint32_t indir_2;
-    /** 64 bytes per inode */
-    uint32_t pad[2];
+    /** inode flags: FS_INLINE_DATA, FS_EXTENTS */
+    uint16_t flags;
+    /** size in bytes, high 16 bits of a 48-bit size */
+    uint16_t size_hi;
+    /** triple indirect block pointer */
+    uint32_t indir_3;
 
 };  /* total 64 bytes */
 
+enum {
+    /** inode flag: file data is stored inline in place of
+     *  the block pointers, from direct[0] through indir_2 */
+    FS_INLINE_DATA = 0x1,
+    /** max bytes of file data stored inline in an inode */
+    INLINE_DATA_SIZE = (N_DIRECT + 2) * sizeof(uint32_t),
+    /** inode flag: file blocks are mapped by an extent tree whose
+     *  root is stored in place of the block pointers, from direct[0]
+     *  through indir_2 */
+    FS_EXTENTS = 0x2
+};
+
 /**
- * Constants for blocks
+ * Header of an extent tree node. The root node is stored in the
+ * inode in place of its block pointers, and the other nodes each
+ * fill a block. The entries of a node follow its header, sorted by
+ * file block. The entries of a leaf node (depth 0) are extents of
+ * the file; the entries of an index node are its child nodes.
  */
+struct fs_extent_header {
+    /** FS_EXTENT_MAGIC */
+    uint16_t magic;
+    /** number of entries in use */
+    uint16_t count;
+    /** maximum number of entries */
+    uint16_t max;
+    /** levels of nodes below this one, 0 for a leaf */
+    uint16_t depth;
+};
+
+/**
+ * Extent tree entry: a run of contiguous blocks of a file in a leaf
+ * node, or a child node in an index node.
+ */
+struct fs_extent {
+    /** first file block of extent, or lowest file block of child */
+    uint32_t block;
+    /** first disk block of extent, or block number of child */
+    uint32_t start;
+    /** number of blocks in extent, 0 for child */
+    uint32_t len;
+};
+
 enum {
-    /** directory entries per block */
-    DIRENTS_PER_BLK = FS_BLOCK_SIZE / sizeof(struct fs_dirent),
-    /** inodes per block */
-	INODES_PER_BLK = FS_BLOCK_SIZE / sizeof(struct fs_inode),
-    /** inode pointers per block */
-    PTRS_PER_BLK = FS_BLOCK_SIZE / sizeof(uint32_t),
-    /** bits per block */
-	BITS_PER_BLK = FS_BLOCK_SIZE * 8
+    /** magic number of an extent tree node */
+    FS_EXTENT_MAGIC = 0xF30A,
+    /** entries in the extent tree root in an inode */
+    N_ROOT_EXTENTS = (INLINE_DATA_SIZE - sizeof(struct fs_extent_header))
+                        / sizeof(struct fs_extent)
+};
+
+/**
+ * Metadata journal block. The first block of the journal records
+ * where replay starts. It is followed by transactions, each of
+ * descriptor blocks that list the blocks of the transaction, copies
+ * of those blocks, and a commit block. The blocks are metadata blocks,
+ * and the directory, indirect, and extent tree blocks of files. An
+ * entry with FS_JOURNAL_REVOKE set records a block that was freed,
+ * has no copy, and cancels the copies in earlier transactions. A
+ * transaction is replayed only if its commit block is intact.
+ */
+struct fs_journal_block {
+    /** FS_JOURNAL_MAGIC */
+    uint32_t magic;
+    /** FS_JOURNAL_SUPER, FS_JOURNAL_DESC, or FS_JOURNAL_COMMIT */
+    uint32_t type;
+    /** transaction sequence number, or for the journal
+     *  superblock, that of the first transaction to replay */
+    uint32_t seq;
+    /** number of entries in the transaction, or for
+     *  the journal superblock, the journal block where the
+     *  first transaction to replay starts */
+    uint32_t count;
+    /** checksum of the descriptor blocks and block copies
+     *  of the transaction, in its commit block */
+    uint32_t checksum;
+    /** block numbers of the entries, in the descriptor blocks,
+     *  continuing to the blocks that follow the first; the copies
+     *  follow in the order of the entries without FS_JOURNAL_REVOKE */
+    uint32_t blknos[];
 };
 
+enum {
+    /** magic number of a journal block */
+    FS_JOURNAL_MAGIC = 0x6A726E6C,
+    /** journal superblock, the first block of the journal */
+    FS_JOURNAL_SUPER = 1,
+    /** descriptor block that starts a transaction */
+    FS_JOURNAL_DESC = 2,
+    /** commit block that ends a transaction */
+    FS_JOURNAL_COMMIT = 3
+};
+
+/** flag of a journal descriptor entry for a block that was freed */
+#define FS_JOURNAL_REVOKE 0x80000000u
+
+/**
+ * Entries per block of a block size. The file system derives
+ * these from the block size in the superblock when mounted
+ * (see struct ext2_fs in fs_util/fs_util_vol.h).
+ */
+/** directory entries per block of blk_size bytes */
+#define FS_DIRENTS_PER_BLK(blk_size) ((int)((blk_size) / sizeof(struct fs_dirent)))
+/** inodes per block of blk_size bytes */
+#define FS_INODES_PER_BLK(blk_size) ((int)((blk_size) / sizeof(struct fs_inode)))
+/** block pointers per block of blk_size bytes */
+#define FS_PTRS_PER_BLK(blk_size) ((int)((blk_size) / sizeof(uint32_t)))
+/** bits per bitmap block of blk_size bytes */
+#define FS_BITS_PER_BLK(blk_size) ((int)(blk_size) * 8)
+/** entries per directory index block of blk_size bytes */
+#define FS_DX_ENTRIES_PER_BLK(blk_size) \
+    ((int)(((blk_size) - sizeof(struct fs_dx_node)) / sizeof(struct fs_dx_entry)))
+/** entries per extent tree block of blk_size bytes */
+#define FS_EXTENTS_PER_BLK(blk_size) \
+    ((int)(((blk_size) - sizeof(struct fs_extent_header)) / sizeof(struct fs_extent)))
+
 #endif  /* __FSX600_H__ */
 
 
@@ -12,14 +12,17 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <time.h>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "blkdev.h"
+#include "image.h"
 
 // should be defined in "string.h" but is not on macos
 extern char* strdup(const char *);
@@ -32,6 +35,8 @@ struct image_dev {
     int   fd;
     /** number of blocks in device */
     int   nblks;
+    /** mapping of device file, or NULL if not mapped */
+    char *map;
 };
 
 
@@ -65,7 +70,7 @@ static int image_read(struct blkdev *dev, int offset, int len, void *buf)
     }
     assert(offset >= 0 && offset+len <= im->nblks);
 
-    ssize_t result = pread(im->fd, buf, len*BLOCK_SIZE, offset*BLOCK_SIZE);
+    ssize_t result = pread(im->fd, buf, (size_t)len*BLOCK_SIZE, (off_t)offset*BLOCK_SIZE);
 
     /* Since I'm not asking for the code that calls this to handle
      * errors other than E_BADADDR and E_UNAVAIL, we report errors and
@@ -77,7 +82,7 @@ static int image_read(struct blkdev *dev, int offset, int len, void *buf)
         assert(0);
     }
 
-    if (result != len*BLOCK_SIZE) {
+    if (result != (ssize_t)len*BLOCK_SIZE) {
         fprintf(stderr, "short read on %s: %s\n", im->path, strerror(errno));
         assert(0);
     }
@@ -107,11 +112,11 @@ static int image_write(struct blkdev * dev, int offset, int len, void *buf)
 
      assert(offset >= 0 && offset+len <= im->nblks);
     
-    ssize_t result = pwrite(im->fd, buf, len*BLOCK_SIZE, offset*BLOCK_SIZE);
+    ssize_t result = pwrite(im->fd, buf, (size_t)len*BLOCK_SIZE, (off_t)offset*BLOCK_SIZE);
 
     /* again, report the error and then exit with an assert
      */
-    if (result != len*BLOCK_SIZE) {
+    if (result != (ssize_t)len*BLOCK_SIZE) {
         fprintf(stderr, "write error on %s: %s\n", im->path, strerror(errno));
         assert(0);
     }
@@ -120,15 +125,25 @@ static int image_write(struct blkdev * dev, int offset, int len, void *buf)
 }
 
 /**
- * Flush the block device.
+ * Flush the block device. Blocks written to the image file are
+ * made durable with fdatasync(), which covers the whole file.
  *
  * @param dev the block device
- * @aparam offset starting byte offset
- * @param len number of bytes to flush
+ * @aparam offset starting block offset
+ * @param len number of blocks to flush
  * @return SUCCESS if successful, E_UNAVAIL if device unavailable
  */
 static int image_flush(struct blkdev * dev, int offset, int len)
 {
+    struct image_dev *im = dev->private;
+
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    if (fdatasync(im->fd) < 0) {
+        fprintf(stderr, "flush error on %s: %s\n", im->path, strerror(errno));
+        assert(0);
+    }
     return SUCCESS;
 }
 
@@ -145,6 +160,7 @@ static void image_close(struct blkdev *dev)
     if (im->fd != -1) {
         close(im->fd);
     }
+    free(im->path);
     free(im);
     dev->private = NULL;        /* crash any attempts to access */
     free(dev);
@@ -156,7 +172,110 @@ static struct blkdev_ops image_ops = {
     .read = image_read,
     .write = image_write,
     .flush = image_flush,
-    .close = image_close
+    .close = image_close,
+    .fd = image_fd
+};
+
+/**
+ * Read blocks from mapped block device starting at give block offset.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to read
+ * @param buf the input buffer
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_mmap_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct image_dev *im = dev->private;
+
+    /* to fail a disk we close its file descriptor and set it to -1 */
+    if (im->fd == -1) {
+        return E_UNAVAIL;
+    }
+    assert(offset >= 0 && offset+len <= im->nblks);
+
+    memcpy(buf, im->map + (size_t)offset*BLOCK_SIZE, (size_t)len*BLOCK_SIZE);
+    return SUCCESS;
+}
+
+/**
+ * Write blocks to mapped block device starting at give block offset.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to write
+ * @param buf the output buffer
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_mmap_write(struct blkdev * dev, int offset, int len, void *buf)
+{
+    struct image_dev *im = dev->private;
+
+    if (offset == 0)
+        printf("ERROR? write to sector 0\n");
+
+    /* to fail a disk we close its file descriptor and set it to -1 */
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    assert(offset >= 0 && offset+len <= im->nblks);
+
+    memcpy(im->map + (size_t)offset*BLOCK_SIZE, buf, (size_t)len*BLOCK_SIZE);
+    return SUCCESS;
+}
+
+/**
+ * Flush the mapped block device. Synchronously writes the
+ * modified pages that hold the blocks back to the image file.
+ *
+ * @param dev the block device
+ * @aparam offset starting block offset
+ * @param len number of blocks to flush
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int image_mmap_flush(struct blkdev * dev, int offset, int len)
+{
+    struct image_dev *im = dev->private;
+
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    /* msync requires a page-aligned start address */
+    size_t pgsz = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)offset*BLOCK_SIZE;
+    size_t end = (size_t)(offset+len)*BLOCK_SIZE;
+    start -= start % pgsz;
+
+    if (msync(im->map + start, end - start, MS_SYNC) < 0) {
+        fprintf(stderr, "flush error on %s: %s\n", im->path, strerror(errno));
+        assert(0);
+    }
+    return SUCCESS;
+}
+
+/**
+ * Close the mapped block device. After this any further
+ * access to that device will return E_UNAVAIL.
+ *
+ * @param dev the block device
+ */
+static void image_mmap_close(struct blkdev *dev)
+{
+    struct image_dev *im = dev->private;
+
+    munmap(im->map, (size_t)im->nblks*BLOCK_SIZE);
+    image_close(dev);
+}
+
+/** Operations on this block device */
+static struct blkdev_ops image_mmap_ops = {
+    .num_blocks = image_num_blocks,
+    .read = image_mmap_read,
+    .write = image_mmap_write,
+    .flush = image_mmap_flush,
+    .close = image_mmap_close,
+    .fd = image_fd
 };
 
 /**
@@ -197,13 +316,52 @@ struct blkdev *image_create(char *path)
         fprintf(stderr, "warning: file %s not a multiple of %d bytes\n",
                 path, BLOCK_SIZE);
     }
+
+    /* block numbers are ints, so the image can have at most
+     * INT_MAX blocks, or 2 TB of 1 KB blocks.
+     */
+    if (sb.st_size / BLOCK_SIZE > INT_MAX) {
+        fprintf(stderr, "image %s too large: more than %d blocks\n",
+                path, INT_MAX);
+        close(im->fd);
+        return NULL;
+    }
     im->nblks = sb.st_size / BLOCK_SIZE;
+    im->map = NULL;
     dev->private = im;
     dev->ops = &image_ops;
 
     return dev;
 }
 
+/**
+ * Create an image block device that maps a specified image
+ * file into memory. Blocks are read and written by copying
+ * to and from the mapping rather than by a system call, and
+ * are written back to the image file when flushed.
+ *
+ * @param path the path to the image file
+ * @return the block device or NULL if cannot open or map image file
+ */
+struct blkdev *image_create_mmap(char *path)
+{
+    struct blkdev *dev = image_create(path);
+    if (dev == NULL)
+        return NULL;
+
+    struct image_dev *im = dev->private;
+    im->map = mmap(NULL, (size_t)im->nblks*BLOCK_SIZE, PROT_READ|PROT_WRITE,
+                   MAP_SHARED, im->fd, 0);
+    if (im->map == MAP_FAILED) {
+        fprintf(stderr, "can't map image %s: %s\n", path, strerror(errno));
+        image_close(dev);
+        return NULL;
+    }
+    dev->ops = &image_mmap_ops;
+
+    return dev;
+}
+
 /**
  * Force an image blkdev into failure. After this any
  * further access to that device will return E_UNAVAIL.
@@ -217,3 +375,16 @@ void image_fail(struct blkdev *dev)
     }
     im->fd = -1;
 }
+
+/**
+ * Returns the file descriptor of the image file of an
+ * image blkdev, or -1 if the device has failed.
+ *
+ * @param dev the block device
+ * @return the image file descriptor
+ */
+int image_fd(struct blkdev *dev)
+{
+    struct image_dev *im = dev->private;
+    return im->fd;
+}
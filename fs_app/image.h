@@ -20,5 +20,36 @@
  */
 extern struct blkdev *image_create(char *path);
 
+/**
+ * Create an image block device that maps a specified image
+ * file into memory. Blocks are read and written by copying
+ * to and from the mapping rather than by a system call, and
+ * are written back to the image file when flushed.
+ *
+ * @param path the path to the image file
+ * @return the block device or NULL if cannot open or map image file
+ */
+extern struct blkdev *image_create_mmap(char *path);
+
+/**
+ * Create an image block device reading from a specified image file
+ * that also supports submitting batches of block requests through
+ * io_uring. If io_uring is not available, returns a device created
+ * by image_create() that performs requests with pread and pwrite.
+ *
+ * @param path the path to the image file
+ * @return the block device or NULL if cannot open or read image file
+ */
+extern struct blkdev *image_create_uring(char *path);
+
+/**
+ * Returns the file descriptor of the image file of an
+ * image blkdev, or -1 if the device has failed.
+ *
+ * @param dev the block device
+ * @return the image file descriptor
+ */
+extern int image_fd(struct blkdev *dev);
+
 
 #endif /* IMAGE_H_ */
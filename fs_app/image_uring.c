@@ -0,0 +1,457 @@
+/*
+ * file:        image_uring.c
+ * description: io_uring block device functions for CS 7600 / CS 5600 file system
+ *
+ * The io_uring device is layered over an image device created by
+ * image_create(). Synchronous reads and writes are passed to the
+ * image device, while batches of requests passed to blkdev_submit()
+ * are queued on an io_uring submission ring with one system call,
+ * and reaped from the completion ring by blkdev_complete(). A mutex
+ * serializes access to the rings, so threads may submit batches and
+ * wait for them concurrently. Only one thread at a time waits in the
+ * kernel for completions, as the reaper; while it waits, no other
+ * thread reaps, so the completion it waits for cannot be consumed by
+ * another thread. Other threads wait for the reaper to reap and wake
+ * them.
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include "blkdev.h"
+#include "image.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+enum {
+    /** number of submission ring entries */
+    URING_ENTRIES = 64
+};
+
+/** Definition of io_uring block device */
+struct uring_dev {
+    /** the underlying image block device */
+    struct blkdev *dev;
+    /** io_uring file descriptor */
+    int ring_fd;
+    /** number of requests submitted but not yet reaped */
+    unsigned inflight;
+    /** number of submission ring entries */
+    unsigned sq_entries;
+    /** 1 while a thread waits in the kernel for completions */
+    int reaping;
+    /** lock for rings, inflight count, and reaping flag */
+    pthread_mutex_t lock;
+    /** signaled when the reaper has reaped completions */
+    pthread_cond_t reaped;
+
+    /** submission ring head, tail, mask, and index array */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    /** submission queue entries */
+    struct io_uring_sqe *sqes;
+    /** completion ring head, tail, and mask */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    /** completion queue entries */
+    struct io_uring_cqe *cqes;
+
+    /** mapped submission ring, completion ring and entries */
+    void *sq_ptr, *cq_ptr;
+    /** sizes of mapped submission ring, completion ring and entries */
+    size_t sq_sz, cq_sz, sqes_sz;
+};
+
+/**
+ * Enter the io_uring to submit requests and wait for completions.
+ *
+ * @param ud the io_uring device
+ * @param to_submit number of requests to submit
+ * @param min_complete number of completions to wait for
+ * @return number of requests submitted, or -1 if error
+ */
+static int uring_enter(struct uring_dev *ud, unsigned to_submit, unsigned min_complete)
+{
+    unsigned flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    int result;
+    do {
+        result = syscall(__NR_io_uring_enter, ud->ring_fd, to_submit,
+                         min_complete, flags, NULL, 0);
+    } while (result < 0 && errno == EINTR);
+    return result;
+}
+
+/**
+ * Perform a request synchronously on the underlying image device.
+ * Used when the kernel rejects or shortens a queued request.
+ *
+ * @param ud the io_uring device
+ * @param r the request
+ */
+static void uring_sync(struct uring_dev *ud, struct blkdev_req *r)
+{
+    struct blkdev *dev = ud->dev;
+    r->status = (r->op == BLKDEV_READ)
+              ? dev->ops->read(dev, r->first_blk, r->num_blks, r->buf)
+              : dev->ops->write(dev, r->first_blk, r->num_blks, r->buf);
+}
+
+/**
+ * Reap available completions and record the status of their requests.
+ *
+ * @param ud the io_uring device
+ * @return number of completions reaped
+ */
+static int uring_reap(struct uring_dev *ud)
+{
+    unsigned head = *ud->cq_head;
+    unsigned tail = __atomic_load_n(ud->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    for (; head != tail; head++, n++) {
+        struct io_uring_cqe *cqe = &ud->cqes[head & *ud->cq_mask];
+        struct blkdev_req *r = (void*)(uintptr_t)cqe->user_data;
+        if (cqe->res == r->num_blks * BLOCK_SIZE) {
+            r->status = SUCCESS;
+        } else {
+            // retry failed or short transfer through image device
+            uring_sync(ud, r);
+        }
+    }
+    __atomic_store_n(ud->cq_head, head, __ATOMIC_RELEASE);
+    ud->inflight -= n;
+    return n;
+}
+
+/**
+ * Wait for completions and reap them. Called with the lock held. If
+ * another thread is the reaper, waits for it to reap; otherwise this
+ * thread becomes the reaper, and waits in the kernel without the lock.
+ *
+ * @param ud the io_uring device
+ */
+static void uring_wait(struct uring_dev *ud)
+{
+    if (ud->reaping) {
+        pthread_cond_wait(&ud->reaped, &ud->lock);
+        return;
+    }
+    ud->reaping = 1;
+    pthread_mutex_unlock(&ud->lock);
+    int result = uring_enter(ud, 0, 1);
+    pthread_mutex_lock(&ud->lock);
+    ud->reaping = 0;
+    if (result < 0) {
+        fprintf(stderr, "io_uring complete error: %s\n", strerror(errno));
+        assert(0);
+    }
+    uring_reap(ud);
+    pthread_cond_broadcast(&ud->reaped);
+}
+
+/**
+ * The number of blocks in the block device.
+ *
+ * @param dev the block device
+ */
+static int uring_num_blocks(struct blkdev *dev)
+{
+    struct uring_dev *ud = dev->private;
+    return ud->dev->ops->num_blocks(ud->dev);
+}
+
+/**
+ * Read blocks from block device starting at give block offset.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to read
+ * @param buf the input buffer
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int uring_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct uring_dev *ud = dev->private;
+    return ud->dev->ops->read(ud->dev, offset, len, buf);
+}
+
+/**
+ * Write blocks to block device starting at give block offset.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to write
+ * @param buf the output buffer
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int uring_write(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct uring_dev *ud = dev->private;
+    return ud->dev->ops->write(ud->dev, offset, len, buf);
+}
+
+/**
+ * Flush the block device.
+ *
+ * @param dev the block device
+ * @param offset starting block offset
+ * @param len number of blocks to flush
+ * @return SUCCESS if successful, E_UNAVAIL if device unavailable
+ */
+static int uring_flush(struct blkdev *dev, int offset, int len)
+{
+    struct uring_dev *ud = dev->private;
+    return ud->dev->ops->flush(ud->dev, offset, len);
+}
+
+/**
+ * Submit a batch of requests to the submission ring. If the
+ * ring fills, waits for earlier requests to complete.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if submitted, E_UNAVAIL if device unavailable
+ */
+static int uring_submit(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    struct uring_dev *ud = dev->private;
+    int fd = image_fd(ud->dev);
+    if (fd == -1) {
+        return E_UNAVAIL;
+    }
+
+    pthread_mutex_lock(&ud->lock);
+    for (int i = 0; i < nreqs; ) {
+        // queue requests while there is room in the ring
+        unsigned tail = *ud->sq_tail;
+        unsigned queued = 0;
+        for (; i < nreqs && ud->inflight + queued < ud->sq_entries; i++, queued++) {
+            struct blkdev_req *r = &reqs[i];
+            assert(r->first_blk >= 0 && r->first_blk+r->num_blks <= uring_num_blocks(dev));
+            unsigned idx = (tail + queued) & *ud->sq_mask;
+            struct io_uring_sqe *sqe = &ud->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = (r->op == BLKDEV_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->off = (uint64_t)r->first_blk * BLOCK_SIZE;
+            sqe->addr = (uintptr_t)r->buf;
+            sqe->len = r->num_blks * BLOCK_SIZE;
+            sqe->user_data = (uintptr_t)r;
+            ud->sq_array[idx] = idx;
+            r->status = PENDING;
+        }
+        __atomic_store_n(ud->sq_tail, tail + queued, __ATOMIC_RELEASE);
+
+        // submit queued requests, and reap unless the reaper is waiting
+        if (uring_enter(ud, queued, 0) < 0) {
+            fprintf(stderr, "io_uring submit error: %s\n", strerror(errno));
+            assert(0);
+        }
+        ud->inflight += queued;
+        if (!ud->reaping) {
+            uring_reap(ud);
+        }
+
+        // wait for requests to complete if the ring is full
+        while (i < nreqs && ud->inflight >= ud->sq_entries) {
+            uring_wait(ud);
+        }
+    }
+    pthread_mutex_unlock(&ud->lock);
+
+    return SUCCESS;
+}
+
+/**
+ * Wait for a batch of submitted requests to complete.
+ *
+ * @param dev the block device
+ * @param reqs the requests
+ * @param nreqs the number of requests
+ * @return SUCCESS if all requests succeeded, or status of first failed request
+ */
+static int uring_complete(struct blkdev *dev, struct blkdev_req *reqs, int nreqs)
+{
+    struct uring_dev *ud = dev->private;
+    int status = SUCCESS;
+
+    pthread_mutex_lock(&ud->lock);
+    for (int i = 0; i < nreqs; i++) {
+        // reap completions until this request is complete, waiting
+        // for the reaper if another thread is waiting in the kernel
+        while (reqs[i].status == PENDING) {
+            if (ud->reaping || uring_reap(ud) == 0) {
+                uring_wait(ud);
+            }
+        }
+        if (status == SUCCESS) {
+            status = reqs[i].status;
+        }
+    }
+    pthread_mutex_unlock(&ud->lock);
+
+    return status;
+}
+
+/**
+ * Returns the file descriptor of the underlying image file.
+ *
+ * @param dev the block device
+ * @return the image file descriptor, or -1 if device failed
+ */
+static int uring_fd(struct blkdev *dev)
+{
+    struct uring_dev *ud = dev->private;
+    return image_fd(ud->dev);
+}
+
+/**
+ * Close the block device. Closes the io_uring
+ * and the underlying image device.
+ *
+ * @param dev the block device
+ */
+static void uring_close(struct blkdev *dev)
+{
+    struct uring_dev *ud = dev->private;
+
+    munmap(ud->sqes, ud->sqes_sz);
+    munmap(ud->cq_ptr, ud->cq_sz);
+    munmap(ud->sq_ptr, ud->sq_sz);
+    close(ud->ring_fd);
+    ud->dev->ops->close(ud->dev);
+
+    pthread_mutex_destroy(&ud->lock);
+    pthread_cond_destroy(&ud->reaped);
+    free(ud);
+    dev->private = NULL;        /* crash any attempts to access */
+    free(dev);
+}
+
+/** Operations on this block device */
+static struct blkdev_ops uring_ops = {
+    .num_blocks = uring_num_blocks,
+    .read = uring_read,
+    .write = uring_write,
+    .flush = uring_flush,
+    .close = uring_close,
+    .submit = uring_submit,
+    .complete = uring_complete,
+    .fd = uring_fd
+};
+
+/**
+ * Set up an io_uring and map its rings.
+ *
+ * @param ud the io_uring device
+ * @return 0 if successful, -1 if io_uring not available
+ */
+static int uring_setup(struct uring_dev *ud)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ud->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ud->ring_fd < 0) {
+        return -1;
+    }
+
+    // map submission ring, completion ring, and submission entries
+    ud->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ud->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ud->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ud->sq_ptr = mmap(NULL, ud->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                      ud->ring_fd, IORING_OFF_SQ_RING);
+    ud->cq_ptr = mmap(NULL, ud->cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                      ud->ring_fd, IORING_OFF_CQ_RING);
+    ud->sqes = mmap(NULL, ud->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                    ud->ring_fd, IORING_OFF_SQES);
+    if (ud->sq_ptr == MAP_FAILED || ud->cq_ptr == MAP_FAILED || ud->sqes == MAP_FAILED) {
+        if (ud->sq_ptr != MAP_FAILED) munmap(ud->sq_ptr, ud->sq_sz);
+        if (ud->cq_ptr != MAP_FAILED) munmap(ud->cq_ptr, ud->cq_sz);
+        if (ud->sqes != MAP_FAILED) munmap(ud->sqes, ud->sqes_sz);
+        close(ud->ring_fd);
+        return -1;
+    }
+
+    char *sq = ud->sq_ptr, *cq = ud->cq_ptr;
+    ud->sq_head = (void*)(sq + p.sq_off.head);
+    ud->sq_tail = (void*)(sq + p.sq_off.tail);
+    ud->sq_mask = (void*)(sq + p.sq_off.ring_mask);
+    ud->sq_array = (void*)(sq + p.sq_off.array);
+    ud->cq_head = (void*)(cq + p.cq_off.head);
+    ud->cq_tail = (void*)(cq + p.cq_off.tail);
+    ud->cq_mask = (void*)(cq + p.cq_off.ring_mask);
+    ud->cqes = (void*)(cq + p.cq_off.cqes);
+    ud->sq_entries = p.sq_entries;
+    ud->inflight = 0;
+    pthread_mutex_init(&ud->lock, NULL);
+    pthread_cond_init(&ud->reaped, NULL);
+    ud->reaping = 0;
+    return 0;
+}
+
+/**
+ * Create an image block device reading from a specified image file
+ * that also supports submitting batches of block requests through
+ * io_uring. If io_uring is not available, returns a device created
+ * by image_create() that performs requests with pread and pwrite.
+ *
+ * @param path the path to the image file
+ * @return the block device or NULL if cannot open or read image file
+ */
+struct blkdev *image_create_uring(char *path)
+{
+    struct blkdev *imdev = image_create(path);
+    if (imdev == NULL) {
+        return NULL;
+    }
+
+    struct blkdev *dev = malloc(sizeof(*dev));
+    struct uring_dev *ud = malloc(sizeof(*ud));
+    if (dev == NULL || ud == NULL || uring_setup(ud) < 0) {
+        // fall back to pread/pwrite image device
+        free(dev);
+        free(ud);
+        return imdev;
+    }
+
+    ud->dev = imdev;
+    dev->private = ud;
+    dev->ops = &uring_ops;
+
+    return dev;
+}
+
+#else  /* HAVE_IO_URING */
+
+/**
+ * Create an image block device reading from a specified image file.
+ * io_uring is not available on this platform, so returns a device
+ * created by image_create() that performs requests with pread and pwrite.
+ *
+ * @param path the path to the image file
+ * @return the block device or NULL if cannot open or read image file
+ */
+struct blkdev *image_create_uring(char *path)
+{
+    return image_create(path);
+}
+
+#endif /* HAVE_IO_URING */
@@ -23,11 +23,14 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 
 #include "split.h"
 #include "max.h"
 #include "image.h"
+#include "blkcache.h"
 #include "fsx600.h"		/* only for certain constants */
+#include "fs_util_writeback.h"
 
 
 /** Declaration should be in stdio.h but is not on macos */
@@ -40,6 +43,9 @@ extern char *strdup(const char* str);
 /** All FUSE file system functions accessed through operations structure. */
 extern struct fuse_operations fs_ops;
 
+/** FUSE low-level file system functions, which take inode numbers. */
+extern struct fuse_lowlevel_ops fs_ll_ops;
+
 /**  Disk block device */
 struct blkdev *disk;
 
@@ -47,6 +53,13 @@ struct blkdev *disk;
 static struct fuse_parser_data {
     char *image_name;  /** fuse image name */
     int   cmd_mode;  /** command mode flag */
+    int   cache_blks;  /** number of blocks to cache, 0 = no cache */
+    int   mmap_mode;  /** memory-mapped image flag */
+    int   uring_mode;  /** io_uring image flag */
+    int   lowlevel_mode;  /** low-level FUSE operations flag */
+    int   writeback_mode;  /** background writeback flag */
+    int   dirty_age;  /** writeback dirty age threshold in ms, 0 = default */
+    int   dirty_ratio;  /** writeback dirty ratio threshold in percent, 0 = default */
 } parser_data;
 
 /**
@@ -56,6 +69,15 @@ static void help(){
     printf("Arguments:\n");
     printf(" -cmdline : Enter an interactive REPL that provides a filesystem view into the image\n");
     printf(" -image <name.img> : Use the provided image file that contains the filesystem\n");
+    printf(" -mmap : Access the image file through a memory mapping\n");
+    printf(" -uring : Submit batches of image block requests through io_uring if available\n");
+    printf(" -cache <nblocks> : Cache up to nblocks blocks of the image in memory\n");
+    printf(" -lowlevel : Mount with the inode-based FUSE low-level operations\n");
+    printf(" -writeback : Write back dirty metadata and cached data in a background thread\n");
+    printf(" -dirty-age <ms> : Write back when the oldest dirty block is ms old (default %d, implies -writeback)\n",
+           WRITEBACK_AGE_MS);
+    printf(" -dirty-ratio <percent> : Write back when percent of metadata or cache is dirty (default %d, implies -writeback)\n",
+           WRITEBACK_RATIO);
 }
 
 /**
@@ -69,6 +91,13 @@ static void help(){
 static struct fuse_opt opts[] = {
         {"-image %s", offsetof(struct fuse_parser_data, image_name), 0},
         {"-cmdline", offsetof(struct fuse_parser_data, cmd_mode), 1},
+        {"-mmap", offsetof(struct fuse_parser_data, mmap_mode), 1},
+        {"-uring", offsetof(struct fuse_parser_data, uring_mode), 1},
+        {"-cache %d", offsetof(struct fuse_parser_data, cache_blks), 0},
+        {"-lowlevel", offsetof(struct fuse_parser_data, lowlevel_mode), 1},
+        {"-writeback", offsetof(struct fuse_parser_data, writeback_mode), 1},
+        {"-dirty-age %d", offsetof(struct fuse_parser_data, dirty_age), 0},
+        {"-dirty-ratio %d", offsetof(struct fuse_parser_data, dirty_ratio), 0},
         FUSE_OPT_END
 };
 
@@ -677,6 +706,7 @@ static int do_get(char *argv[])
 
     struct fuse_file_info info;
     memset(&info, 0, sizeof(struct fuse_file_info));
+    info.flags = O_WRONLY;  // release writes back data written through the handle
     if ((val = fs_ops.open(path, &info)) != 0) {
         return val;
     }
@@ -881,6 +911,22 @@ static int do_blksiz(char *argv[])
     return 0;
 }
 
+/**
+ * Allocate blocks for a byte range of a file.
+ *
+ * @param argv argv[0] is file name relative
+ *   to current directory, argv[1] is offset
+ *   and argv[2] is length of range
+ */
+static int do_fallocate(char *argv[])
+{
+    char path[PATH_MAX];
+    full_path(argv[0], path);
+    off_t offset = atol(argv[1]);
+    off_t len = atol(argv[2]);
+    return fs_ops.fallocate(path, 0, offset, len, NULL);
+}
+
 /**
  * Truncate file to specified length
  *
@@ -967,6 +1013,7 @@ static struct fuse_cmds cmds[] = {
         {"cd", 0, do_cd0, "cd - change to root directory"},
         {"cd", 1, do_cd1, "cd <dir> - change to directory"},
         {"chmod", 2, do_chmod, "chmod <mode> <file> - change permissions"},
+        {"fallocate", 3, do_fallocate, "fallocate <file> <offset> <length> - allocate blocks for range"},
         {"get", 2, do_get, "get <outside> <inside> - get a file from local directory into file system"},
         {"get", 1, do_get1, "get <name> - ditto, but keep the same name"},
         {"link", 2, do_link, "link <name> <linkname> - create a link to a file"},
@@ -1126,6 +1173,45 @@ static void fixup(int argc, char *argv[]) {
     }
 }
 
+/**
+ * Mount the file system with the FUSE low-level operations and
+ * process requests until it is unmounted. Like fuse_main(), the
+ * arguments select the mount point, whether to run in the
+ * foreground, and whether to process requests on multiple threads.
+ *
+ * @param args the FUSE arguments
+ * @return 0 if successful, 1 if error occurred
+ */
+static int lowlevel_main(struct fuse_args *args)
+{
+    char *mountpoint;
+    int multithreaded, foreground;
+    if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+        return 1;
+    }
+
+    int status = 1;
+    struct fuse_chan *ch = fuse_mount(mountpoint, args);
+    if (ch != NULL) {
+        struct fuse_session *se =
+            fuse_lowlevel_new(args, &fs_ll_ops, sizeof(fs_ll_ops), NULL);
+        if (se != NULL) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                fuse_daemonize(foreground);
+                status = multithreaded ? fuse_session_loop_mt(se)
+                                       : fuse_session_loop(se);
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    free(mountpoint);
+    return (status == 0) ? 0 : 1;
+}
+
 /**
  * Main program for the Fuse file system utility
  * and interactive command interpreter.
@@ -1159,19 +1245,49 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if ((disk = image_create(file)) == NULL) {
+    if (parser_data.mmap_mode) {
+        disk = image_create_mmap(file);
+    } else if (parser_data.uring_mode) {
+        disk = image_create_uring(file);
+    } else {
+        disk = image_create(file);
+    }
+    if (disk == NULL) {
         fprintf(stderr, "cannot open image file '%s': %s\n", file, strerror(errno));
         help();
         return 1;
     }
 
+    if (parser_data.cache_blks > 0) {  /* layer block cache over image */
+        if ((disk = blkcache_create(disk, parser_data.cache_blks)) == NULL) {
+            fprintf(stderr, "cannot create %d block cache\n", parser_data.cache_blks);
+            help();
+            return 1;
+        }
+    }
+
+    if (parser_data.writeback_mode || parser_data.dirty_age > 0
+            || parser_data.dirty_ratio > 0) {  /* write back in background thread */
+        int age = (parser_data.dirty_age > 0) ? parser_data.dirty_age : WRITEBACK_AGE_MS;
+        int ratio = (parser_data.dirty_ratio > 0) ? parser_data.dirty_ratio : WRITEBACK_RATIO;
+        configure_writeback(age, ratio, (parser_data.cache_blks > 0) ? disk : NULL);
+    }
+
     if (parser_data.cmd_mode) {  /* process interactive commands */
         fs_ops.init(NULL);
-        _blksiz(FS_BLOCK_SIZE);
+        struct statvfs st;  /* read/write in blocks of the volume */
+        fs_ops.statfs("/", &st);
+        _blksiz(st.f_bsize);
         cmdloop();
+        fs_ops.destroy(NULL);
+        disk->ops->close(disk);  /* write back any cached blocks */
         return 0;
     }
 
     /** pass control to fuse */
-    return fuse_main(args.argc, args.argv, &fs_ops, NULL);
+    int status = parser_data.lowlevel_mode
+               ? lowlevel_main(&args)
+               : fuse_main(args.argc, args.argv, &fs_ops, NULL);
+    disk->ops->close(disk);  /* write back any cached blocks */
+    return status;
 }
@@ -0,0 +1,833 @@
+/*
+ * fs_ll_ops.c
+ *
+ * description: fuse low-level operations for CS 5600 / 7600 file system
+ *
+ * The low-level FUSE API identifies files by inode number rather than
+ * by path. The kernel looks up each name once and then passes the
+ * inode number to later operations, so these operations do not resolve
+ * a path on every call as the high-level operations in fs_ops do.
+ *
+ * FUSE reserves inode number 1 (FUSE_ROOT_ID) for the root directory.
+ * Inode numbers passed to the kernel are the file system inode numbers,
+ * except that the root inode and inode 1 are exchanged if the root is
+ * not inode 1.
+ *
+ * The kernel refers to an inode by number from the lookup that returns
+ * it until it forgets the lookup, and an open handle refers to it until
+ * it is released. An inode unlinked while it is referenced is kept as
+ * an orphan, with no directory entry, and is freed when the last lookup
+ * is forgotten and the last handle is released. Each reply with an entry
+ * carries the generation of the inode number, which changes when the
+ * number is reused. An orphan is not freed if the volume is not cleanly
+ * unmounted.
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <fuse_lowlevel.h>
+
+#include "fs_ll_ops.h"
+#include "fs_ops.h"
+#include "fs_util_dir.h"
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_vol.h"
+#include "blkdev.h"
+#include "max.h"
+#include "min.h"
+
+/** seconds the kernel may cache attributes and names */
+static const double ll_timeout = 1.0;
+
+/**
+ * Returns the inode number of a FUSE inode.
+ *
+ * Errors
+ *   -ESTALE  - inode is not allocated
+ *
+ * @param ino the FUSE inode
+ * @return the inode number or -error
+ */
+static int ll_inum(fuse_ino_t ino)
+{
+    int inum = (ino == FUSE_ROOT_ID) ? fs.root_inode
+             : (ino == (fuse_ino_t)fs.root_inode) ? FUSE_ROOT_ID : (int)ino;
+    if (inum <= 0 || inum >= fs.n_inodes || !FD_ISSET(inum, fs.inode_map)) {
+        return -ESTALE;
+    }
+    return inum;
+}
+
+/**
+ * Returns the FUSE inode of an inode number.
+ *
+ * @param inum the inode number
+ * @return the FUSE inode
+ */
+static fuse_ino_t ll_ino(int inum)
+{
+    return (inum == fs.root_inode) ? FUSE_ROOT_ID
+         : (inum == FUSE_ROOT_ID) ? (fuse_ino_t)fs.root_inode : (fuse_ino_t)inum;
+}
+
+/**
+ * Fill stat struct for an inode with its FUSE inode number.
+ *
+ * @param inum the inode number
+ * @param sb pointer to stat struct
+ */
+static void ll_stat(int inum, struct stat *sb)
+{
+    do_stat(inum, sb);
+    sb->st_ino = ll_ino(inum);
+}
+
+/**
+ * Reply to a request with the entry for an inode. The caller has
+ * added the lookup of the entry to the references of the inode.
+ *
+ * @param req the request
+ * @param inum the inode number of the entry, or -error
+ */
+static void ll_reply_entry(fuse_req_t req, int inum)
+{
+    if (inum < 0) {
+        fuse_reply_err(req, -inum);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.ino = ll_ino(inum);
+    e.generation = get_inode_generation(inum);
+    e.attr_timeout = ll_timeout;
+    e.entry_timeout = ll_timeout;
+    read_lock_inode(inum);
+    ll_stat(inum, &e.attr);
+    unlock_inode(inum);
+    fuse_reply_entry(req, &e);
+}
+
+/**
+ * Remove kernel references to an inode, and free the inode if it
+ * is an orphan with no references left.
+ *
+ * @param inum the inode number
+ * @param nlookup the number of lookups forgotten
+ * @param nopen the number of open handles released
+ */
+static void ll_unref(int inum, uint64_t nlookup, int nopen)
+{
+    if (unref_inode(inum, nlookup, nopen)) {
+        write_lock_inode(inum);
+        free_inode(inum);
+        unlock_inode(inum);
+        flush_metadata();
+    }
+}
+
+/**
+ * init - read the superblock and set up global variables.
+ *
+ * @param userdata the user data -- unused
+ * @param conn fuse connection information
+ */
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+#ifdef FUSE_CAP_SPLICE_WRITE
+    // let ll_read() splice replies from the image file to the kernel
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+#endif
+    fs_init(conn);
+}
+
+/**
+ * destroy - flush metadata when the file system is unmounted.
+ *
+ * @param userdata the user data -- unused
+ */
+static void ll_destroy(void *userdata)
+{
+    fs_destroy(userdata);
+}
+
+/**
+ * lookup - look up a directory entry by name.
+ *
+ * Errors
+ *   -ENOENT       - entry does not exist
+ *   -ENOTDIR      - parent is not a directory
+ *   -ENAMETOOLONG - name is too long
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the directory
+ * @param name the name of the entry
+ */
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int dir_inum = ll_inum(parent);
+    if (dir_inum < 0) {
+        fuse_reply_err(req, -dir_inum);
+        return;
+    }
+    if (strlen(name) >= FS_FILENAME_SIZE) {
+        fuse_reply_err(req, ENAMETOOLONG);
+        return;
+    }
+
+    // add lookup before an unlink of the entry can free its inode
+    read_lock_inode(dir_inum);
+    int inum = get_dir_entry_inode_locked(dir_inum, name);
+    if (inum > 0) {
+        ref_inode(inum, 1, 0);
+    }
+    unlock_inode(dir_inum);
+    ll_reply_entry(req, inum);
+}
+
+/**
+ * forget - the kernel forgets lookups of an inode, and frees
+ * the inode if it is an orphan with no references left.
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param nlookup the number of lookups to forget
+ */
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    int inum = ll_inum(ino);
+    if (inum > 0) {
+        ll_unref(inum, nlookup, 0);
+    }
+    fuse_reply_none(req);
+}
+
+/**
+ * getattr - get file or directory attributes.
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param fi fuse file info -- unused
+ */
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int inum = ll_inum(ino);
+    if (inum < 0) {
+        fuse_reply_err(req, -inum);
+        return;
+    }
+
+    struct stat sb;
+    read_lock_inode(inum);
+    ll_stat(inum, &sb);
+    unlock_inode(inum);
+    fuse_reply_attr(req, &sb, ll_timeout);
+}
+
+/**
+ * setattr - change file permissions, size, or modification time.
+ *
+ * Errors
+ *   -EISDIR  - cannot change size of a directory
+ *   -ENOSPC  - cannot allocate blocks to extend file
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param attr the new attributes
+ * @param to_set FUSE_SET_ATTR_* flags of attributes to set
+ * @param fi fuse file info -- unused
+ */
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                       int to_set, struct fuse_file_info *fi)
+{
+    int inum = ll_inum(ino);
+    if (inum < 0) {
+        fuse_reply_err(req, -inum);
+        return;
+    }
+
+    write_lock_inode(inum);
+    struct fs_inode *in = &fs.inodes[inum];
+    if ((to_set & FUSE_SET_ATTR_SIZE) && S_ISDIR(in->mode)) {
+        unlock_inode(inum);
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        int status = do_truncate(inum, attr->st_size);
+        if (status < 0) {
+            unlock_inode(inum);
+            fuse_reply_err(req, -status);
+            return;
+        }
+    }
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        // ensures only permissions modified
+        in->mode = (in->mode & S_IFMT) | (attr->st_mode & ~S_IFMT);
+    }
+    if (to_set & FUSE_SET_ATTR_MTIME) {
+        in->mtime = attr->st_mtime;  // OK thorough 2100
+    }
+
+    // mark inode dirty and flush metadata blocks
+    mark_inode(inum);
+    flush_metadata();
+
+    struct stat sb;
+    ll_stat(inum, &sb);
+    unlock_inode(inum);
+    fuse_reply_attr(req, &sb, ll_timeout);
+}
+
+/**
+ * Make an entry in a directory and reply with its entry.
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the directory
+ * @param name the name of the entry
+ * @param mode the mode of the new entry
+ * @param ftype the file type of the new entry
+ */
+static void ll_mkentry(fuse_req_t req, fuse_ino_t parent, const char *name,
+                       mode_t mode, unsigned ftype)
+{
+    int dir_inum = ll_inum(parent);
+    if (dir_inum < 0) {
+        fuse_reply_err(req, -dir_inum);
+        return;
+    }
+    if (strlen(name) >= FS_FILENAME_SIZE) {
+        fuse_reply_err(req, ENAMETOOLONG);
+        return;
+    }
+
+    // an orphan directory has no entry for new entries to be found by
+    write_lock_inode(dir_inum);
+    int inum = is_orphan_inode(dir_inum) ? -ENOENT
+             : do_mkentry(dir_inum, name, mode, ftype);
+    if (inum > 0) {
+        ref_inode(inum, 1, 0);
+    }
+    unlock_inode(dir_inum);
+    ll_reply_entry(req, inum);
+}
+
+/**
+ * mknod - create a new file.
+ *
+ * Errors
+ *   -ENOTDIR  - parent is not a directory
+ *   -EEXIST   - file already exists
+ *   -ENOSPC   - free inode not available
+ *   -ENOSPC   - directory full
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the directory
+ * @param name the name of the file
+ * @param mode the mode of the file
+ * @param rdev the device -- unused
+ */
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+                     mode_t mode, dev_t rdev)
+{
+    ll_mkentry(req, parent, name, mode, S_IFREG);
+}
+
+/**
+ * mkdir - create a directory.
+ *
+ * Errors
+ *   -ENOTDIR  - parent is not a directory
+ *   -EEXIST   - directory already exists
+ *   -ENOSPC   - free inode not available
+ *   -ENOSPC   - directory full
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the parent directory
+ * @param name the name of the directory
+ * @param mode the mode of the directory
+ */
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+                     mode_t mode)
+{
+    ll_mkentry(req, parent, name, mode, S_IFDIR);
+}
+
+/**
+ * unlink - remove a file.
+ *
+ * Errors
+ *   -ENOENT   - file does not exist
+ *   -ENOTDIR  - parent is not a directory
+ *   -EISDIR   - cannot unlink a directory
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the directory
+ * @param name the name of the file
+ */
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int dir_inum = ll_inum(parent);
+    if (dir_inum < 0) {
+        fuse_reply_err(req, -dir_inum);
+        return;
+    }
+
+    write_lock_inode(dir_inum);
+    int status = do_unlink(dir_inum, name);
+    unlock_inode(dir_inum);
+    fuse_reply_err(req, -status);
+}
+
+/**
+ * rmdir - remove an empty directory.
+ *
+ * Errors
+ *   -ENOENT   - directory does not exist
+ *   -ENOTDIR  - entry is not a directory
+ *   -ENOTEMPTY - directory not empty
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the parent directory
+ * @param name the name of the directory
+ */
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int dir_inum = ll_inum(parent);
+    if (dir_inum < 0) {
+        fuse_reply_err(req, -dir_inum);
+        return;
+    }
+
+    write_lock_inode(dir_inum);
+    int status = do_rmdir(dir_inum, name);
+    unlock_inode(dir_inum);
+    fuse_reply_err(req, -status);
+}
+
+/**
+ * rename - rename an entry within a directory.
+ *
+ * Errors
+ *   -ENOENT   - source does not exist
+ *   -EEXIST   - destination already exists
+ *   -EINVAL   - source and destination are not in same directory
+ *
+ * @param req the request
+ * @param parent the FUSE inode of the source directory
+ * @param name the source name
+ * @param newparent the FUSE inode of the destination directory
+ * @param newname the destination name
+ */
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                      fuse_ino_t newparent, const char *newname)
+{
+    int srcdir_inum = ll_inum(parent);
+    int dstdir_inum = ll_inum(newparent);
+    if (srcdir_inum < 0 || dstdir_inum < 0) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    if (srcdir_inum != dstdir_inum) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    write_lock_inode(srcdir_inum);
+    int status = do_rename(srcdir_inum, name, dstdir_inum, newname);
+    unlock_inode(srcdir_inum);
+    fuse_reply_err(req, -status);
+}
+
+/**
+ * open - open a file.
+ *
+ * Errors
+ *   -EISDIR  - file is a directory
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param fi fuse file info
+ */
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int inum = ll_inum(ino);
+    if (inum < 0) {
+        fuse_reply_err(req, -inum);
+        return;
+    }
+    if (S_ISDIR(fs.inodes[inum].mode)) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+
+    // set inode number to fi->fh for ll_read() operations
+    ref_inode(inum, 0, 1);
+    fi->fh = inum;
+    fuse_reply_open(req, fi);
+}
+
+/**
+ * Reply to a read with buffers that refer to the runs of contiguous
+ * image file blocks that hold the data, so FUSE can splice the data
+ * from the image file to the kernel without copying it through this
+ * process. Holes in the file are replied as memory buffers of 0s.
+ * The caller holds the read lock of the inode until the reply is
+ * sent, so blocks are not freed and reused before they are read.
+ *
+ * @param req the request
+ * @param inum the inode number
+ * @param fd the image file descriptor
+ * @param size the number of bytes to read
+ * @param off the offset to start reading at
+ * @return 0 if replied, or -error
+ */
+static int ll_reply_runs(fuse_req_t req, int inum, int fd, size_t size, off_t off)
+{
+    // adjust length to length of file from offset
+    off_t fsize = get_inode_size(&fs.inodes[inum]);
+    size = (off >= fsize) ? 0 : (fsize - off < (off_t)size) ? fsize - off : size;
+
+    // map blocks to runs of contiguous image file blocks
+    int blkindex = off / FS_BLOCK_SIZE;
+    int nblks = (size == 0) ? 0
+              : (off + size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE - blkindex;
+    struct file_run *runs = malloc(max(nblks, 1) * sizeof(struct file_run));
+    struct fuse_bufvec *bv =
+        malloc(sizeof(*bv) + (max(nblks, 1) - 1) * sizeof(struct fuse_buf));
+    if (runs == NULL || bv == NULL) {
+        free(runs);
+        free(bv);
+        return -ENOMEM;
+    }
+    int nruns = get_file_runs(inum, blkindex, nblks, 0, runs);
+
+    // one buffer for the part of each run that is read
+    *bv = FUSE_BUFVEC_INIT(0);
+    bv->count = 0;
+    off -= (off_t)blkindex * FS_BLOCK_SIZE;
+    int status = 0;
+    for (int i = 0; i < nruns && size > 0; i++) {
+        size_t l = min((size_t)runs[i].nblks * FS_BLOCK_SIZE - off, size);
+        struct fuse_buf *b = &bv->buf[bv->count++];
+        memset(b, 0, sizeof(*b));
+        b->size = l;
+        if (runs[i].blkno == 0) {
+            // hole reads as 0s
+            b->mem = calloc(1, l);
+            if (b->mem == NULL) {
+                status = -ENOMEM;
+                break;
+            }
+        } else {
+            b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+            b->fd = fd;
+            b->pos = (off_t)runs[i].blkno * FS_BLOCK_SIZE + off;
+        }
+        size -= l;
+        off = 0;
+    }
+    free(runs);
+
+    // report error if a block could not be mapped
+    if (status == 0 && size > 0) {
+        status = -EIO;
+    }
+    if (status == 0) {
+        if (bv->count == 0) {
+            *bv = FUSE_BUFVEC_INIT(0);  // nothing to read
+        }
+        fuse_reply_data(req, bv, FUSE_BUF_SPLICE_MOVE);
+    }
+    for (size_t i = 0; i < bv->count; i++) {
+        free(bv->buf[i].mem);
+    }
+    free(bv);
+    return status;
+}
+
+/**
+ * read - read data from an open file.
+ *
+ * If the block device stores blocks directly in the image file, the
+ * data is spliced from the image file to the kernel. Otherwise, or if
+ * the data is inline in the inode, it is read into a memory buffer.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate read buffer
+ *   -EIO     - error reading block
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param size the number of bytes to read
+ * @param off the offset to start reading at
+ * @param fi fuse file info
+ */
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                    struct fuse_file_info *fi)
+{
+    int inum = fi->fh;
+    read_lock_inode(inum);
+    int fd = blkdev_fd(disk);
+    if (fd >= 0 && !is_inline_file(inum)) {
+        int status = ll_reply_runs(req, inum, fd, size, off);
+        unlock_inode(inum);
+        if (status < 0) {
+            fuse_reply_err(req, -status);
+        }
+        return;
+    }
+
+    char *buf = malloc(max(size, 1));
+    int nread = (buf == NULL) ? -ENOMEM : do_read(inum, buf, size, off);
+    unlock_inode(inum);
+    if (nread < 0) {
+        fuse_reply_err(req, -nread);
+    } else {
+        fuse_reply_buf(req, buf, nread);
+    }
+    free(buf);
+}
+
+/**
+ * write - write data to an open file.
+ *
+ * Errors
+ *   -ENOSPC  - no space to write data
+ *   -EIO     - error writing block
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param buf the data to write
+ * @param size the number of bytes to write
+ * @param off the offset to start writing at
+ * @param fi fuse file info
+ */
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+                     size_t size, off_t off, struct fuse_file_info *fi)
+{
+    int inum = fi->fh;
+    write_lock_inode(inum);
+    int nwritten = do_write(inum, buf, size, off);
+    unlock_inode(inum);
+    if (nwritten < 0) {
+        fuse_reply_err(req, -nwritten);
+    } else {
+        fuse_reply_write(req, nwritten);
+    }
+}
+
+/**
+ * fallocate - allocate or deallocate space for a byte range
+ * of an open file.
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param mode 0, or the FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE flags
+ * @param offset the offset of the range
+ * @param length the length of the range
+ * @param fi fuse file info
+ */
+static void ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode,
+                         off_t offset, off_t length, struct fuse_file_info *fi)
+{
+    int inum = fi->fh;
+    write_lock_inode(inum);
+    int status = do_fallocate(inum, mode, offset, length);
+    mark_inode(inum);
+    flush_metadata();
+    unlock_inode(inum);
+    fuse_reply_err(req, -status);
+}
+
+/**
+ * release - release an open file, writing back deferred dirty
+ * data and metadata if it was opened for writing, and free the
+ * file if it is an orphan with no references left.
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param fi fuse file info
+ */
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int inum = fi->fh;
+    int status = fs_release(NULL, fi);
+    ll_unref(inum, 0, 1);
+    fuse_reply_err(req, -status);
+}
+
+/**
+ * fsync - make the data and metadata of an open file durable.
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param datasync nonzero to sync only the data
+ * @param fi fuse file info
+ */
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                     struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, -fs_fsync(NULL, datasync, fi));
+}
+
+/**
+ * releasedir - release an open directory, and free the directory
+ * if it is an orphan with no references left.
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param fi fuse file info
+ */
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    ll_unref(fi->fh, 0, 1);
+    fi->fh = 0;  // remove saved inode number
+    fuse_reply_err(req, 0);
+}
+
+/**
+ * opendir - open a directory.
+ *
+ * Errors
+ *   -ENOTDIR - inode is not a directory
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param fi fuse file info
+ */
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int inum = ll_inum(ino);
+    if (inum < 0) {
+        fuse_reply_err(req, -inum);
+        return;
+    }
+    if (!S_ISDIR(fs.inodes[inum].mode)) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    // save directory inum in fuse file info
+    ref_inode(inum, 0, 1);
+    fi->fh = inum;
+    fuse_reply_open(req, fi);
+}
+
+/**
+ * readdir - read directory entries. The offset of an entry is one
+ * more than its index among the entry slots of the directory, so a
+ * later call continues after the last entry returned.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate reply or block buffer
+ *   -EIO     - error reading block
+ *
+ * @param req the request
+ * @param ino the FUSE inode
+ * @param size the maximum number of bytes to reply
+ * @param off the offset of the last entry returned, or 0
+ * @param fi fuse file info
+ */
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       struct fuse_file_info *fi)
+{
+    int inum = fi->fh;
+    char *reply = malloc(size);
+    char *buf = malloc(FS_BLOCK_SIZE);
+    if (reply == NULL || buf == NULL) {
+        free(reply);
+        free(buf);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    // add entries after offset until reply buffer is full
+    size_t len = 0;
+    read_lock_inode(inum);
+    for (int blkindex = off / DIRENTS_PER_BLK; ; blkindex++) {
+        int blkno = get_file_blk(inum, blkindex, buf, 0);
+        if (blkno == 0) {
+            break;
+        } else if (blkno < 0) {
+            unlock_inode(inum);
+            free(reply);
+            free(buf);
+            fuse_reply_err(req, EIO);
+            return;
+        }
+
+        struct fs_dirent *de = (void*)buf;
+        int i = (blkindex == off / DIRENTS_PER_BLK) ? off % DIRENTS_PER_BLK : 0;
+        for (; i < DIRENTS_PER_BLK; i++) {
+            if (!de[i].valid) {
+                continue;
+            }
+            // only inode and type are used by fuse_add_direntry
+            struct stat sb;
+            memset(&sb, 0, sizeof(sb));
+            sb.st_ino = ll_ino(de[i].inode);
+            sb.st_mode = fs.inodes[de[i].inode].mode;
+            off_t next = (off_t)blkindex * DIRENTS_PER_BLK + i + 1;
+            size_t n = fuse_add_direntry(req, reply + len, size - len,
+                                         de[i].name, &sb, next);
+            if (n > size - len) {
+                goto full;
+            }
+            len += n;
+        }
+    }
+full:
+    unlock_inode(inum);
+    fuse_reply_buf(req, reply, len);
+    free(reply);
+    free(buf);
+}
+
+/**
+ * statfs - get file system statistics.
+ *
+ * @param req the request
+ * @param ino the FUSE inode -- unused
+ */
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs st;
+    fs_statfs("/", &st);
+    fuse_reply_statfs(req, &st);
+}
+
+/**
+ * Low-level operations vector, selected by the -lowlevel option
+ * in place of the high-level 'fs_ops' vector.
+ */
+struct fuse_lowlevel_ops fs_ll_ops = {
+    .init = ll_init,
+    .destroy = ll_destroy,
+    .lookup = ll_lookup,
+    .forget = ll_forget,
+    .getattr = ll_getattr,
+    .setattr = ll_setattr,
+    .mknod = ll_mknod,
+    .mkdir = ll_mkdir,
+    .unlink = ll_unlink,
+    .rmdir = ll_rmdir,
+    .rename = ll_rename,
+    .open = ll_open,
+    .read = ll_read,
+    .write = ll_write,
+    .fallocate = ll_fallocate,
+    .release = ll_release,
+    .fsync = ll_fsync,
+    .opendir = ll_opendir,
+    .readdir = ll_readdir,
+    .releasedir = ll_releasedir,
+    .statfs = ll_statfs,
+};
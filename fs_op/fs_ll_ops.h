@@ -0,0 +1,21 @@
+/*
+ * fs_ll_ops.h
+ *
+ * description: fuse low-level operations for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#ifndef FS_LL_OPS_H_
+#define FS_LL_OPS_H_
+
+#include <fuse_lowlevel.h>
+
+/**
+ * Low-level operations vector, which identifies files by inode
+ * number instead of path. Selected by the -lowlevel option in
+ * place of the high-level 'fs_ops' vector.
+ */
+extern struct fuse_lowlevel_ops fs_ll_ops;
+
+#endif /* FS_LL_OPS_H_ */
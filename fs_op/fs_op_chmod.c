@@ -39,12 +39,14 @@ int fs_chmod(const char* path, mode_t mode)
     }
 
     // set new permissions for inode
+    write_lock_inode(inum);
     fs.inodes[inum].mode =  // ensures only permissions modified
     	(fs.inodes[inum].mode & S_IFMT) | (mode & ~S_IFMT);
 
     // mark inode dirty and flush metadata blocks
     mark_inode(inum);
     flush_metadata();
+    unlock_inode(inum);
 
     return 0;
 }
@@ -0,0 +1,33 @@
+/*
+ * fs_op_destroy.c
+ *
+ * description: destroy function for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <stdio.h>
+#include <fuse.h>
+
+#include "fs_util_meta.h"
+#include "fs_util_writeback.h"
+
+/**
+ * destroy - this is called once by the FUSE framework when the
+ * file system is unmounted.
+ *
+ * Stops the writeback thread, writes back the dirty data and
+ * metadata, and checkpoints the metadata journal, so the volume
+ * needs no journal replay when it is next mounted. As destroy
+ * cannot return an error, a failed writeback is reported on stderr.
+ *
+ * @param private_data the private data returned by init -- unused
+ */
+void fs_destroy(void* private_data)
+{
+    stop_writeback();
+    int status = sync_writeback();
+    if (sync_metadata() < 0 || status < 0) {
+        fprintf(stderr, "cannot write back data and metadata\n");
+    }
+}
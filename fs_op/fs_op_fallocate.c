@@ -0,0 +1,75 @@
+/*
+ * fs_op_fallocate.c
+ *
+ * description: fs_fallocate function for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <fuse.h>
+
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_path.h"
+#include "fs_util_vol.h"
+
+/**
+ * fallocate - allocate or deallocate space for a byte range of a file.
+ *
+ * Mode 0 allocates the blocks of the range in as few contiguous runs
+ * as possible and extends the file to the end of the range, so later
+ * sequential writes to the range do not allocate blocks, and
+ * FALLOC_FL_KEEP_SIZE allocates them without changing the file size.
+ * FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE zeroes the range and
+ * frees its full blocks.
+ *
+ * Errors:
+ *   -ENOENT      - file does not exist
+ *   -ENOTDIR     - component of path not a directory
+ *   -EISDIR      - file is a directory
+ *   -EINVAL      - invalid offset or length
+ *   -EOPNOTSUPP  - mode not supported
+ *   -EFBIG       - range extends past the maximum file size
+ *   -ENOSPC      - no space in file system
+ *
+ * @param path the file path
+ * @param mode 0, or the FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE flags
+ * @param offset the offset of the range
+ * @param len the length of the range
+ * @param fi the fuse file info
+ * @return 0 if successful, or -error number
+ */
+int fs_fallocate(const char* path, int mode, off_t offset, off_t len,
+                 struct fuse_file_info* fi)
+{
+    int inum;
+    if (fi != NULL) {
+    	// get inode stored in fi->fh by fs_open
+        inum = fi->fh;
+    } else {
+    	// get inode for specified path
+        inum = get_inode_of_path(path);
+
+        // return error code if error
+        if (inum < 0) {
+            return inum;
+        }
+    }
+
+    /* cannot allocate if it is directory */
+    if (S_ISDIR(fs.inodes[inum].mode)) {
+        return -EISDIR;
+    }
+
+    write_lock_inode(inum);
+    int val = do_fallocate(inum, mode, offset, len);
+
+    // mark inode dirty and flush metadata blocks
+    mark_inode(inum);
+    flush_metadata();
+    unlock_inode(inum);
+
+    return val;
+}
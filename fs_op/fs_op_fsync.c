@@ -0,0 +1,32 @@
+/*
+ * fs_op_fsync.c
+ *
+ * description: fs_fsync function for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <fuse.h>
+
+#include "fs_util_writeback.h"
+
+/**
+ * fsync - make the data and metadata of a file durable.
+ *
+ * Dirty data and metadata are written back for the whole volume,
+ * rather than for the file alone: the cached data blocks are flushed
+ * before the metadata that refers to them is committed.
+ *
+ * Errors:
+ *   -EIO     - error writing back, including an earlier background
+ *              writeback that has not been reported
+ *
+ * @param path the file path -- unused
+ * @param datasync nonzero to sync only the data -- unused
+ * @param fi the fuse file info -- unused
+ * @return 0 if successful, or -error number
+ */
+int fs_fsync(const char* path, int datasync, struct fuse_file_info* fi)
+{
+    return sync_writeback();
+}
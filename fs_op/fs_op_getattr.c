@@ -10,6 +10,7 @@
 
 #include "fs_util_dir.h"
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 
 /**
@@ -46,7 +47,9 @@ int fs_getattr(const char* path, struct stat *sb)
     }
 
     // fill stat struct if value
+    read_lock_inode(inum);
     do_stat(inum, sb);
+    unlock_inode(inum);
 
     return 0;
 }
@@ -8,11 +8,16 @@
  * Philip Gust, March 2019, March 2020
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <fuse.h>
 
+#include "fs_util_journal.h"
+#include "fs_util_meta.h"
 #include "fs_util_vol.h"
+#include "fs_util_writeback.h"
 #include "blkdev.h"
+#include "blkscale.h"
 
 /** Instance of ex2 fs structure */
 struct ext2_fs fs;
@@ -35,6 +40,39 @@ void* fs_init(struct fuse_conn_info* conn)
         exit(1);
     }
 
+    // block size chosen by mkfs; older volumes do not record one
+    int blk_size = (sb.block_size == 0) ? FS_MIN_BLOCK_SIZE : sb.block_size;
+    if (blk_size < FS_MIN_BLOCK_SIZE || blk_size > FS_MAX_BLOCK_SIZE
+            || (blk_size & (blk_size - 1)) != 0 || blk_size % BLOCK_SIZE != 0) {
+        fprintf(stderr, "bad volume block size: %d\n", blk_size);
+        exit(1);
+    }
+    set_block_size(blk_size);
+
+    // access device in blocks of the volume
+    if (blk_size != BLOCK_SIZE && (disk = blkscale_create(disk, blk_size)) == NULL) {
+        exit(1);
+    }
+
+    // block numbers are ints, so volume must fit the block device
+    if (sb.num_blocks > (uint32_t)disk->ops->num_blocks(disk)) {
+        fprintf(stderr, "volume has %u blocks, device has %d\n",
+                sb.num_blocks, disk->ops->num_blocks(disk));
+        exit(1);
+    }
+
+    // number of blocks on device
+    fs.n_blocks = sb.num_blocks;
+
+    // replay metadata journal left by an unclean shutdown before reading metadata
+    int n_meta = 1 + sb.inode_map_sz + sb.block_map_sz + sb.inode_region_sz;
+    fs.journal_base = n_meta;
+    fs.journal_sz = sb.journal_sz;
+    if (open_journal(n_meta) < 0) {
+        fprintf(stderr, "cannot open metadata journal\n");
+        exit(1);
+    }
+
     // record root inode
     fs.root_inode = sb.root_inode;
 
@@ -42,14 +80,14 @@ void* fs_init(struct fuse_conn_info* conn)
 
     // read inode map
     fs.inode_map_base = 1;
-    fs.inode_map = malloc(sb.inode_map_sz * FS_BLOCK_SIZE);
+    fs.inode_map = malloc((size_t)sb.inode_map_sz * FS_BLOCK_SIZE);
     if (disk->ops->read(disk, fs.inode_map_base, sb.inode_map_sz, fs.inode_map) < 0) {
         exit(1);
     }
 
     // read block map
     fs.block_map_base = fs.inode_map_base + sb.inode_map_sz;
-    fs.block_map = malloc(sb.block_map_sz * FS_BLOCK_SIZE);
+    fs.block_map = malloc((size_t)sb.block_map_sz * FS_BLOCK_SIZE);
     if (disk->ops->read(disk, fs.block_map_base, sb.block_map_sz, fs.block_map) < 0) {
         exit(1);
     }
@@ -57,7 +95,7 @@ void* fs_init(struct fuse_conn_info* conn)
     /* The inode fuse_parser_data is written to the next set of blocks */
     fs.inode_base = fs.block_map_base + sb.block_map_sz;
     fs.n_inodes = sb.inode_region_sz * INODES_PER_BLK;
-    fs.inodes = malloc(sb.inode_region_sz * FS_BLOCK_SIZE);
+    fs.inodes = malloc((size_t)sb.inode_region_sz * FS_BLOCK_SIZE);
     if (disk->ops->read(disk, fs.inode_base, sb.inode_region_sz, fs.inodes) < 0) {
         exit(1);
     }
@@ -65,11 +103,26 @@ void* fs_init(struct fuse_conn_info* conn)
     // number of metadata blocks
     fs.n_meta = fs.inode_base + sb.inode_region_sz;
 
-    // number of blocks on device
-    fs.n_blocks = sb.num_blocks;
+    // start searches for free blocks and inodes at the beginning
+    fs.blk_cursor = 0;
+    fs.inode_cursor = 0;
 
-    // allocate dirty metadata blocks
-    fs.dirty = calloc(fs.n_meta, sizeof(void*));  // ptrs to dirty metadata blks
+    // count free blocks and inodes once; allocation keeps counts current
+    fs.n_blocks_free = count_free_blks();
+    fs.n_inodes_free = count_free_inodes();
+
+    // allocate dirty metadata block bitmap in whole 64-bit words
+    fs.dirty_map = calloc((fs.n_meta + 63) / 64, sizeof(uint64_t));
+    fs.dirty_lo = fs.dirty_hi = 0;
+
+    // allocate locks for inodes accessed by concurrent operations
+    init_inode_locks();
+
+    // write back dirty metadata and data in the background, if configured
+    if (start_writeback() < 0) {
+        fprintf(stderr, "cannot start writeback thread\n");
+        exit(1);
+    }
 
     return NULL;
 }
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fsx600.h"
 
@@ -40,7 +41,9 @@ int fs_mkdir(const char* path, mode_t mode)
     }
 
     // make new directory in parent directory
+    write_lock_inode(dir_inum);
     int inum = do_mkentry(dir_inum, leaf, mode, S_IFDIR);
+    unlock_inode(dir_inum);
     return (inum < 0) ? inum : 0;
 }
 
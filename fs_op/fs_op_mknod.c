@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fsx600.h"
 
@@ -45,7 +46,9 @@ int fs_mknod(const char* path, mode_t mode, dev_t dev)
         return dir_inum;
     }
 	// make directory entry
+    write_lock_inode(dir_inum);
     int inum = do_mkentry(dir_inum, leaf, mode, S_IFREG);
+    unlock_inode(dir_inum);
     return (inum < 0) ? inum : 0;
 }
 
@@ -14,6 +14,7 @@
 #include <fuse.h>
 
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fs_util_vol.h"
 #include "blkdev.h"
@@ -63,6 +64,8 @@ int fs_read(const char* path, char* buf, size_t len, off_t offset,
     }
 
     // read bytes of inode
+    read_lock_inode(inum);
     int nread = do_read(inum, buf, len, offset);
+    unlock_inode(inum);
     return nread;
 }
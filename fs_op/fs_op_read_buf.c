@@ -0,0 +1,86 @@
+/*
+ * fs_op_read_buf.c
+ *
+ * description: fs_read_buf function for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fuse.h>
+
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_path.h"
+#include "fs_util_vol.h"
+#include "max.h"
+
+/**
+ * read_buf - read data from an open file into a buffer vector.
+ *
+ * The data is read into a single memory buffer while the inode is
+ * locked, so FUSE does not see blocks that a concurrent truncate
+ * frees and reuses after the inode is unlocked. The low-level read
+ * operation in fs_ll_ops.c splices data from the image file instead,
+ * replying while the inode is still locked.
+ *
+ * Errors:
+ *   -ENOENT  - file does not exist
+ *   -ENOTDIR - component of path not a directory
+ *   -EISDIR  - file is a directory
+ *   -ENOMEM  - cannot allocate buffer vector
+ *   -EIO     - error reading block
+ *
+ * @param path the path to the file
+ * @param bufp set to the buffer vector, which FUSE frees
+ * @param len the number of bytes to read
+ * @param offset to start reading at
+ * @param fi fuse file info
+ * @return 0 if successful, or -error number
+ */
+int fs_read_buf(const char* path, struct fuse_bufvec **bufp, size_t len,
+                off_t offset, struct fuse_file_info* fi)
+{
+    int inum;
+    if (fi != NULL) {
+    	// get inode stored in fi->fh by fs_open()
+        inum = fi->fh;
+    } else {
+    	// get inode for path
+        inum = get_inode_of_path(path);
+
+        // report error if error
+        if (inum < 0) {
+            return inum;
+        }
+    }
+
+    /* cannot read if it is directory */
+    if (S_ISDIR(fs.inodes[inum].mode)) {
+    	return -EISDIR;
+    }
+
+    struct fuse_bufvec *bv = malloc(sizeof(*bv));
+    char *buf = malloc(max(len, 1));
+    if (bv == NULL || buf == NULL) {
+        free(bv);
+        free(buf);
+        return -ENOMEM;
+    }
+
+    // read data into memory buffer
+    read_lock_inode(inum);
+    int nread = do_read(inum, buf, len, offset);
+    unlock_inode(inum);
+    if (nread < 0) {
+        free(bv);
+        free(buf);
+        return nread;
+    }
+    *bv = FUSE_BUFVEC_INIT(nread);
+    bv->buf[0].mem = buf;
+    *bufp = bv;
+    return 0;
+}
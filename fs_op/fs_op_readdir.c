@@ -14,6 +14,7 @@
 #include <fuse.h>
 
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fs_util_vol.h"
 
@@ -28,6 +29,8 @@
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENOMEM  - cannot allocate block buffer or entry list
+ *   -EIO     - error reading block
  *
  * @param path the directory path
  * @param ptr  filler buf pointer
@@ -59,29 +62,56 @@ int fs_readdir(const char* path, void *ptr, fuse_fill_dir_t filler,
         return -ENOTDIR;
     }
 
-    // process each directory entry
+    char *buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    // copy the valid directory entries while the directory is locked
+    struct fs_dirent *ents = NULL;
+    int nents = 0;
+    read_lock_inode(inum);
     for (int blkindex = 0; ; blkindex++) {
     	// get block no of n-th directory block
-        char buf[FS_BLOCK_SIZE];
         int blkno = get_file_blk(inum, blkindex, buf, 0);
         if (blkno == 0) {
         	break;
         } else if (blkno < 0) {
+            unlock_inode(inum);
+            free(buf);
+            free(ents);
         	return -EIO;
         }
 
-    	// call filler function for each entry
         struct fs_dirent* de = (void*)buf;
+        void *p = realloc(ents, (nents + DIRENTS_PER_BLK) * sizeof(struct fs_dirent));
+        if (p == NULL) {
+            unlock_inode(inum);
+            free(buf);
+            free(ents);
+            return -ENOMEM;
+        }
+        ents = p;
     	for (int i = 0; i < DIRENTS_PER_BLK; i++) {
     		if (de[i].valid) {
-    			struct stat sb;
-    			do_stat(de[i].inode, &sb);
-    			filler(ptr, de[i].name, &sb, 0);
+    			ents[nents++] = de[i];
     		}
     	}
     }
+    unlock_inode(inum);
+    free(buf);
+
+    // call filler function for each entry, with its attributes read
+    // while its inode is locked; the directory is no longer locked, so
+    // locking the entries of "." and ".." does not invert the lock order
+    for (int i = 0; i < nents; i++) {
+        struct stat sb;
+        read_lock_inode(ents[i].inode);
+        do_stat(ents[i].inode, &sb);
+        unlock_inode(ents[i].inode);
+        filler(ptr, ents[i].name, &sb, 0);
+    }
+    free(ents);
 
     return 0;
 }
-
-
@@ -8,16 +8,24 @@
  * Philip Gust, March 2019, March 2020
  */
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fuse.h>
 
+#include "fs_util_writeback.h"
+
 /**
- * Release resources created by pending open call.
+ * Release resources created by pending open call. If the writeback
+ * thread defers writing back dirty data and metadata, and the file
+ * was opened for writing, they are written back and made durable now,
+ * so a file closed after writing is on disk. Releasing a file opened
+ * read-only does not wait for the device.
  *
  * Errors:
  *   -ENOENT  - file does not exist
  *   -ENOTDIR - component of path not a directory
+ *   -EIO     - error writing back
  *
  * @param path the file name
  * @param fi the fuse file info
@@ -25,9 +33,14 @@
  */
 int fs_release(const char* path, struct fuse_file_info* fi)
 {
+    // nothing was written through a handle opened read-only
+    int writable = (fi == NULL) || (fi->flags & O_ACCMODE) != O_RDONLY;
 	if (fi != NULL) {
 		fi->fh = 0;  // remove saved inode number
 	}
+    if (writable && is_writeback_running()) {
+        return sync_writeback();
+    }
     return 0;
 }
 
@@ -15,6 +15,7 @@
 
 #include "fs_util_dir.h"
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fs_util_vol.h"
 #include "blkdev.h"
@@ -47,8 +48,14 @@ int fs_rename(const char* src_path, const char* dst_path)
     char dst_leaf[FS_FILENAME_SIZE];
     int dstdir_inum = get_inode_of_path_dir(dst_path, dst_leaf);
 
-    // rename entry
+    // rename entry; only renames within a directory are supported,
+    // so only that directory needs to be locked
+    if (srcdir_inum <= 0 || srcdir_inum != dstdir_inum) {
+        return do_rename(srcdir_inum, src_leaf, dstdir_inum, dst_leaf);
+    }
+    write_lock_inode(srcdir_inum);
     int status = do_rename(srcdir_inum, src_leaf, dstdir_inum, dst_leaf);
+    unlock_inode(srcdir_inum);
     return status;
 }
 
@@ -11,6 +11,7 @@
 #include <sys/select.h>
 
 #include "fs_util_dir.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fsx600.h"
 
@@ -37,7 +38,9 @@ int fs_rmdir(const char* path)
         return dir_inum;
     }
 
+    write_lock_inode(dir_inum);
     int status = do_rmdir(dir_inum, leaf);
+    unlock_inode(dir_inum);
     return status;
 }
 
@@ -10,6 +10,7 @@
 
 #include <sys/statvfs.h>
 #include <string.h>
+#include <assert.h>
 
 #include "fs_util_meta.h"
 #include "fs_util_vol.h"
@@ -37,28 +38,19 @@ int fs_statfs(const char* path, struct statvfs* st)
      *   f_favail	total free file nodes available to non-superuser
      *   f_namelen	maximum length of file name
      */
-	memset(st, 0, sizeof(statvfs));
+	memset(st, 0, sizeof(*st));
 
-	// compute number of free blocks
-	int n_blocks_free = 0;
-	for (int i = 0; i < fs.n_blocks; i++) {
-		if (is_free_blk(i)) n_blocks_free++;
-	}
-
-	// compute number of free inodes
-	int n_inodes_free = 0;
-	for (int i = 0; i < fs.n_inodes; i++) {
-		if (is_free_inode(i)) {
-			n_inodes_free++;
-		}
-	}
+#ifdef FS_DEBUG
+	// verify maintained counters against full count of maps
+	assert(check_free_counts());
+#endif  /* FS_DEBUG */
 
 	st->f_bsize = FS_BLOCK_SIZE;
     st->f_blocks = fs.n_blocks;
-    st->f_bfree = n_blocks_free;
+    st->f_bfree = fs.n_blocks_free;
     st->f_bavail = st->f_bfree;
     st->f_files = fs.n_inodes;
-    st->f_ffree = n_inodes_free;
+    st->f_ffree = fs.n_inodes_free;
     st->f_favail = st->f_ffree;
     st->f_namemax = FS_FILENAME_SIZE-1;
 
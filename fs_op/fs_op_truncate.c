@@ -23,6 +23,7 @@
  *   ENOENT  - file does not exist
  *   ENOTDIR - component of path not a directory
  *   EINVAL  - length invalid
+ *   EFBIG   - length greater than the maximum file size
  *   EISDIR	 - path is a directory (only files)
  *
  * @param path the file path
@@ -45,12 +46,14 @@ int fs_truncate(const char* path, off_t len)
     }
 
     // truncate file
+    write_lock_inode(inum);
     int val = do_truncate(inum, len);
     if (val >= 0) {
         // mark inode dirty and flush metadata blocks
         mark_inode(inum);
         flush_metadata();
     }
+    unlock_inode(inum);
 
     return val;
 }
@@ -9,6 +9,7 @@
  */
 
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fs_util_vol.h"
 
@@ -35,6 +36,8 @@ int fs_unlink(const char* path)
     }
 
     // unlink entry
+    write_lock_inode(dir_inum);
     int status = do_unlink(dir_inum, leaf);
+    unlock_inode(dir_inum);
     return status;
 }
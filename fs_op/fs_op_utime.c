@@ -36,11 +36,13 @@ int fs_utime(const char* path, struct utimbuf *ut)
     }
 
     // set new mod time for inode
+    write_lock_inode(inum);
     fs.inodes[inum].mtime = ut->modtime;  // OK thorough 2100
 
     // mark inode dirty and flush metadata blocks
     mark_inode(inum);
     flush_metadata();
+    unlock_inode(inum);
 
     return 0;
 }
@@ -13,6 +13,7 @@
 #include <fuse.h>
 
 #include "fs_util_file.h"
+#include "fs_util_meta.h"
 #include "fs_util_path.h"
 #include "fs_util_vol.h"
 
@@ -27,9 +28,8 @@
  *   -ENOENT  - file does not exist
  *   -ENOTDIR - component of path not a directory
  *   -EISDIR  - file is a directory
- *   -EINVAL  - if 'offset' is greater than current file length.
- *  			(POSIX semantics support the creation of files with
- *  			"holes" in them, but we don't)
+ *   -ENOSPC  - no space in file system
+ *   -EFBIG   - write extends past the maximum file size
  *
  * @param path the file path
  * @param buf the buffer to write
@@ -59,7 +59,9 @@ int fs_write(const char* path, const char* buf, size_t len,
         return -EISDIR;
     }
 
+    write_lock_inode(inum);
     int nwritten = do_write(inum, buf, len, offset);
+    unlock_inode(inum);
     return nwritten;
 }
 
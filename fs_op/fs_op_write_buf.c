@@ -0,0 +1,177 @@
+/*
+ * fs_op_write_buf.c
+ *
+ * description: fs_write_buf function for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fuse.h>
+
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_path.h"
+#include "fs_util_vol.h"
+#include "blkdev.h"
+#include "max.h"
+#include "min.h"
+
+/**
+ * Write the next len bytes of a buffer vector to a file
+ * through a memory buffer.
+ *
+ * @param inum the inumber of the file
+ * @param src the buffer vector
+ * @param len the number of bytes to write
+ * @param offset the offset to start writing at
+ * @return number of bytes written if successful, or -error number
+ */
+static int write_mem(int inum, struct fuse_bufvec *src, size_t len, off_t offset)
+{
+    char *buf = malloc(max(len, 1));
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(len);
+    dst.buf[0].mem = buf;
+    ssize_t n = fuse_buf_copy(&dst, src, 0);
+    int nwritten = (n < 0) ? n : do_write(inum, buf, n, offset);
+    free(buf);
+    return nwritten;
+}
+
+/**
+ * write_buf - write data from a buffer vector to an open file.
+ *
+ * If the block device stores blocks directly in the image file, the
+ * full blocks of data are copied from the buffers to the runs of
+ * contiguous image file blocks that hold them, so FUSE can splice the
+ * data from the kernel to the image file without copying it through
+ * this process. Partial first and last blocks, data stored inline in
+ * the inode, and all data for other devices, are written through a
+ * memory buffer.
+ *
+ * Errors:
+ *   -ENOENT  - file does not exist
+ *   -ENOTDIR - component of path not a directory
+ *   -EISDIR  - file is a directory
+ *   -ENOSPC  - no space in file system
+ *   -EFBIG   - write extends past the maximum file size
+ *   -ENOMEM  - cannot allocate buffer
+ *   -EIO     - error writing block
+ *
+ * @param path the file path
+ * @param src the buffer vector with the data to write
+ * @param offset the offset to start writing at
+ * @param fi the fuse file info
+ * @return number of bytes written if successful, or -error number
+ */
+int fs_write_buf(const char* path, struct fuse_bufvec *src, off_t offset,
+                 struct fuse_file_info* fi)
+{
+    int inum;
+    if (fi != NULL) {
+    	// get inode stored in fi->fh by fs_open
+        inum = fi->fh;
+    } else {
+    	// get inode for specified path
+        inum = get_inode_of_path(path);
+
+        // return error code if error
+        if (inum < 0) {
+            return inum;
+        }
+    }
+    /* cannot write if it is directory */
+    if (S_ISDIR(fs.inodes[inum].mode)) {
+        return -EISDIR;
+    }
+
+    write_lock_inode(inum);
+    size_t len = fuse_buf_size(src);
+    struct fs_inode *in = &fs.inodes[inum];
+    int fd = blkdev_fd(disk);
+    if (fd < 0 || (is_inline_file(inum) && offset + len <= INLINE_DATA_SIZE)) {
+        int nwritten = write_mem(inum, src, len, offset);
+        unlock_inode(inum);
+        return nwritten;
+    }
+
+    // move inline data to a block, as the file grows past it
+    int status = expand_inline_file(inum);
+    if (status < 0) {
+        unlock_inode(inum);
+        return status;
+    }
+
+    // write partial first block through memory buffer
+    size_t head = min(len, (FS_BLOCK_SIZE - offset % FS_BLOCK_SIZE) % FS_BLOCK_SIZE);
+    status = (head == 0) ? 0 : write_mem(inum, src, head, offset);
+    size_t nwritten = max(status, 0);
+
+    // map the holes of the blocks first, so that only the blocks
+    // added in them are freed if the write fails
+    int nblks = (len - head) / FS_BLOCK_SIZE;
+    struct file_run *holes = malloc(2 * max(nblks, 1) * sizeof(struct file_run));
+    struct file_run *runs = holes + max(nblks, 1);
+    if (holes == NULL) {
+        status = -ENOMEM;
+    }
+    int blkindex = (offset + head) / FS_BLOCK_SIZE;
+    int nholes = (status < 0 || nblks == 0) ? 0
+               : get_file_runs(inum, blkindex, nblks, 0, holes);
+
+    // copy full blocks to runs of contiguous image file blocks
+    int nruns = (status < 0 || nblks == 0) ? 0
+              : get_file_runs(inum, blkindex, nblks, 1, runs);
+    for (int i = 0; i < nruns && status >= 0; i++) {
+        size_t l = (size_t)runs[i].nblks * FS_BLOCK_SIZE;
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(l);
+        dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        dst.buf[0].fd = fd;
+        dst.buf[0].pos = (off_t)runs[i].blkno * FS_BLOCK_SIZE;
+        ssize_t n = fuse_buf_copy(&dst, src, 0);
+        if (n < (ssize_t)l) {
+            status = (n < 0) ? n : -EIO;
+        }
+        nwritten += max(n, 0) / FS_BLOCK_SIZE * FS_BLOCK_SIZE;
+        if (offset + (off_t)nwritten > get_inode_size(in)) {
+            set_inode_size(in, offset + nwritten);  // extend file
+        }
+    }
+    if (status >= 0 && nblks > 0
+            && nwritten < head + (size_t)nblks * FS_BLOCK_SIZE) {
+        status = -ENOSPC;  // not all blocks mapped
+    }
+    if (status < 0 && nblks > 0) {
+        // free blocks added in holes past end, keeping blocks allocated before
+        int keep = (get_inode_size(in) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+        int n = blkindex;
+        for (int i = 0; i < nholes; i++) {
+            int n1 = max(n, keep), n2 = n + holes[i].nblks;
+            if (holes[i].blkno == 0 && n1 < n2) {
+                do_fallocate(inum, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                             (off_t)n1 * FS_BLOCK_SIZE, (off_t)(n2 - n1) * FS_BLOCK_SIZE);
+            }
+            n = n2;
+        }
+    }
+    free(holes);
+
+    // write partial last block through memory buffer
+    if (status >= 0 && nwritten < len) {
+        status = write_mem(inum, src, len - nwritten, offset + nwritten);
+        nwritten += max(status, 0);
+    } else if (nblks > 0) {
+        in->mtime = time(NULL);  // OK thorough 2100
+        mark_inode(inum);
+        flush_metadata();
+    }
+    unlock_inode(inum);
+
+    return (status < 0) ? status : (int)nwritten;
+}
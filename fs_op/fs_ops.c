@@ -12,10 +12,14 @@
 
 /**
  * Operations vector. Please don't rename it, as the
- * code in misc.c assumes it is named 'fs_ops'.
+ * code in misc.c assumes it is named 'fs_ops'. The low-level
+ * operations vector 'fs_ll_ops' is in fs_ll_ops.c.
  */
 struct fuse_operations fs_ops = {
     .chmod = fs_chmod,
+    .destroy = fs_destroy,
+    .fallocate = fs_fallocate,
+    .fsync = fs_fsync,
     .getattr = fs_getattr,
     .init = fs_init,
     .mkdir = fs_mkdir,
@@ -23,6 +27,7 @@ struct fuse_operations fs_ops = {
     .open = fs_open,
     .opendir = fs_opendir,
     .read = fs_read,
+    .read_buf = fs_read_buf,
     .readdir = fs_readdir,
     .release = fs_release,
     .releasedir = fs_releasedir,
@@ -33,6 +38,7 @@ struct fuse_operations fs_ops = {
     .unlink = fs_unlink,
     .utime = fs_utime,
     .write = fs_write,
+    .write_buf = fs_write_buf,
 };
 
 
@@ -29,6 +29,65 @@
  */
 int fs_chmod(const char* path, mode_t mode);
 
+/**
+ * destroy - this is called once by the FUSE framework when the
+ * file system is unmounted.
+ *
+ * Stops the writeback thread, writes back the dirty data and
+ * metadata, and checkpoints the metadata journal, so the volume
+ * needs no journal replay when it is next mounted. As destroy
+ * cannot return an error, a failed writeback is reported on stderr.
+ *
+ * @param private_data the private data returned by init -- unused
+ */
+void fs_destroy(void* private_data);
+
+/**
+ * fallocate - allocate or deallocate space for a byte range of a file.
+ *
+ * Mode 0 allocates the blocks of the range in as few contiguous runs
+ * as possible and extends the file to the end of the range, and
+ * FALLOC_FL_KEEP_SIZE allocates them without changing the file size.
+ * FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE zeroes the range and
+ * frees its full blocks.
+ *
+ * Errors:
+ *   -ENOENT      - file does not exist
+ *   -ENOTDIR     - component of path not a directory
+ *   -EISDIR      - file is a directory
+ *   -EINVAL      - invalid offset or length
+ *   -EOPNOTSUPP  - mode not supported
+ *   -EFBIG       - range extends past the maximum file size
+ *   -ENOSPC      - no space in file system
+ *
+ * @param path the file path
+ * @param mode 0, or the FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE flags
+ * @param offset the offset of the range
+ * @param len the length of the range
+ * @param fi the fuse file info
+ * @return 0 if successful, or -error number
+ */
+int fs_fallocate(const char* path, int mode, off_t offset, off_t len,
+                 struct fuse_file_info* fi);
+
+/**
+ * fsync - make the data and metadata of a file durable.
+ *
+ * Dirty data and metadata are written back for the whole volume,
+ * rather than for the file alone: the cached data blocks are flushed
+ * before the metadata that refers to them is committed.
+ *
+ * Errors:
+ *   -EIO     - error writing back, including an earlier background
+ *              writeback that has not been reported
+ *
+ * @param path the file path -- unused
+ * @param datasync nonzero to sync only the data -- unused
+ * @param fi the fuse file info -- unused
+ * @return 0 if successful, or -error number
+ */
+int fs_fsync(const char* path, int datasync, struct fuse_file_info* fi);
+
 /**
  * getattr - get file or directory attributes. For a description of
  * the fields in 'struct stat', see 'man lstat'.
@@ -151,6 +210,30 @@ int fs_opendir(const char* path, struct fuse_file_info* fi);
 int fs_read(const char* path, char* buf, size_t len, off_t offset,
 		    struct fuse_file_info* fi);
 
+/**
+ * read_buf - read data from an open file into a buffer vector.
+ *
+ * The data is read into a single memory buffer while the inode is
+ * locked, so FUSE does not see blocks that a concurrent truncate
+ * frees and reuses after the inode is unlocked.
+ *
+ * Errors:
+ *   -ENOENT  - file does not exist
+ *   -ENOTDIR - component of path not a directory
+ *   -EISDIR  - file is a directory
+ *   -ENOMEM  - cannot allocate buffer vector
+ *   -EIO     - error reading block
+ *
+ * @param path the path to the file
+ * @param bufp set to the buffer vector, which FUSE frees
+ * @param len the number of bytes to read
+ * @param offset to start reading at
+ * @param fi fuse file info
+ * @return 0 if successful, or -error number
+ */
+int fs_read_buf(const char* path, struct fuse_bufvec **bufp, size_t len,
+                off_t offset, struct fuse_file_info* fi);
+
 /**
  * readdir - get directory contents.
  *
@@ -162,6 +245,8 @@ int fs_read(const char* path, char* buf, size_t len, off_t offset,
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENOMEM  - cannot allocate block buffer or entry list
+ *   -EIO     - error reading block
  *
  * @param path the directory path
  * @param ptr  filler buf pointer
@@ -174,11 +259,16 @@ int fs_readdir(const char* path, void *ptr, fuse_fill_dir_t filler,
 		       off_t offset, struct fuse_file_info* fi);
 
 /**
- * Release resources created by pending open call.
+ * Release resources created by pending open call. If the writeback
+ * thread defers writing back dirty data and metadata, and the file
+ * was opened for writing, they are written back and made durable now,
+ * so a file closed after writing is on disk. Releasing a file opened
+ * read-only does not wait for the device.
  *
  * Errors:
  *   -ENOENT  - file does not exist
  *   -ENOTDIR - component of path not a directory
+ *   -EIO     - error writing back
  *
  * @param path the file name
  * @param fi the fuse file info
@@ -249,7 +339,8 @@ int fs_statfs(const char* path, struct statvfs* st);
  * Errors:
  *   ENOENT  - file does not exist
  *   ENOTDIR - component of path not a directory
- *   EINVAL  - length invalid (only supports 0)
+ *   EINVAL  - length invalid
+ *   EFBIG   - length greater than the maximum file size
  *   EISDIR	 - path is a directory (only files)
  *
  * @param path the file path
@@ -294,9 +385,8 @@ int fs_utime(const char* path, struct utimbuf *ut);
  *   -ENOENT  - file does not exist
  *   -ENOTDIR - component of path not a directory
  *   -EISDIR  - file is a directory
- *   -EINVAL  - if 'offset' is greater than current file length.
- *  			(POSIX semantics support the creation of files with
- *  			"holes" in them, but we don't)
+ *   -ENOSPC  - no space in file system
+ *   -EFBIG   - write extends past the maximum file size
  *
  * @param path the file path
  * @param buf the buffer to write
@@ -307,4 +397,32 @@ int fs_utime(const char* path, struct utimbuf *ut);
  */
 int fs_write(const char* path, const char* buf, size_t len,
 		     off_t offset, struct fuse_file_info* fi);
+
+/**
+ * write_buf - write data from a buffer vector to an open file.
+ *
+ * If the block device stores blocks directly in the image file, the
+ * full blocks of data are copied from the buffers to the runs of
+ * contiguous image file blocks that hold them, so FUSE can splice the
+ * data from the kernel to the image file without copying it through
+ * this process.
+ *
+ * Errors:
+ *   -ENOENT  - file does not exist
+ *   -ENOTDIR - component of path not a directory
+ *   -EISDIR  - file is a directory
+ *   -ENOSPC  - no space in file system
+ *   -EFBIG   - write extends past the maximum file size
+ *   -ENOMEM  - cannot allocate buffer
+ *   -EIO     - error writing block
+ *
+ * @param path the file path
+ * @param src the buffer vector with the data to write
+ * @param offset the offset to start writing at
+ * @param fi the fuse file info
+ * @return number of bytes written if successful, or -error number
+ */
+int fs_write_buf(const char* path, struct fuse_bufvec *src, off_t offset,
+                 struct fuse_file_info* fi);
+
 #endif /* FS_OPS_H_ */
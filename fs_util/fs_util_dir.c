@@ -9,6 +9,7 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <stdio.h>
@@ -111,11 +112,504 @@ int get_free_entry_in_block(struct fs_dirent* de) {
     return -ENOSPC;
 }
 
+#if (FS_VERSION > 2)
+/*
+ * Hashed directory index. A directory starts as a single block of
+ * entries. When that block is full, its entries move to a new block
+ * and block 0 becomes the root of an index that maps name hashes
+ * to blocks of entries (see struct fs_dx_node). Entries with the
+ * same hash are always kept in the same block, so a lookup reads
+ * only the index blocks on the path to one block of entries.
+ */
+
+enum {
+    /** max number of index levels below the root */
+    DX_MAX_LEVELS = 1
+};
+
+/** Index block and entry on the path to a block of entries */
+struct dx_frame {
+    /** 0-based index of the index block in the directory */
+    int n;
+    /** index of the entry followed in the index block */
+    int at;
+};
+
+/**
+ * Returns the hash of a directory entry name. Only the part
+ * of the name that is stored in an entry is hashed.
+ *
+ * @param name the name of the entry
+ * @return the hash value, with the low bit clear
+ */
+static uint32_t dx_hash(const char* name)
+{
+    // 32-bit FNV-1a hash
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < FS_FILENAME_SIZE-1 && name[i] != '\0'; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h & ~1u;
+}
+
+/**
+ * Finds the entry of an index block whose range includes a hash:
+ * the last entry whose hash is not greater than the hash. The
+ * first entry covers all hashes below the second entry.
+ *
+ * @param node the index block
+ * @param hash the hash
+ * @return the index of the entry
+ */
+static int dx_search(struct fs_dx_node* node, uint32_t hash)
+{
+    int lo = 1, hi = node->count - 1, at = 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (node->entries[mid].hash <= hash) {
+            at = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return at;
+}
+
+/**
+ * Inserts an entry at a position in an index block that has room.
+ *
+ * @param node the index block
+ * @param at the position of the new entry
+ * @param hash the hash of the new entry
+ * @param n the block of the new entry
+ */
+static void dx_insert_at(struct fs_dx_node* node, int at, uint32_t hash, int n)
+{
+    memmove(&node->entries[at+1], &node->entries[at],
+            (node->count - at) * sizeof(struct fs_dx_entry));
+    node->entries[at] = (struct fs_dx_entry){.hash = hash, .block = n};
+    node->count++;
+}
+
+/**
+ * Reads the first block of a directory, and determines whether
+ * it is the root of a directory index.
+ *
+ * @param inum the inode number of a directory
+ * @param root storage for the first block
+ * @return 1 if directory is indexed, 0 if not, or -EIO
+ */
+static int dx_get_root(int inum, struct fs_dx_node* root)
+{
+    int blkno = get_file_blk(inum, 0, root, 0);
+    if (blkno < 0) {
+        return -EIO;
+    }
+    return (blkno > 0) && (root->magic == FS_DX_MAGIC);
+}
+
+/**
+ * Writes an index block or block of entries of a directory.
+ *
+ * @param inum the inode number of a directory
+ * @param n the 0-based index of the block in the directory
+ * @param block the block to write
+ * @return 0 if successful, or -EIO
+ */
+static int dx_put_blk(int inum, int n, void* block)
+{
+    int blkno = get_file_blkno(inum, n, 0);
+    if (blkno <= 0 || write_journaled_blk(blkno, block) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Adds a block initialized with 0s to the end of a directory.
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block, whose block count is updated
+ * @return 0-based index of the block in the directory, or -ENOSPC
+ */
+static int dx_new_blk(int inum, struct fs_dx_node* root)
+{
+    int n = root->nblocks;
+    if (get_file_blkno(inum, n, 1) == 0) {
+        return -ENOSPC;
+    }
+    root->nblocks++;
+    return n;
+}
+
+/**
+ * Finds the block of entries whose range includes a hash, and
+ * records the index blocks and entries on the path to it.
+ *
+ *  Errors
+ *   -EIO     - error reading block or invalid index block
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block
+ * @param hash the hash
+ * @param path returns the path, one frame per index level
+ * @return 0-based index of the block in the directory, or -error
+ */
+static int dx_find_leaf(int inum, struct fs_dx_node* root, uint32_t hash,
+                        struct dx_frame* path)
+{
+    if (root->levels > DX_MAX_LEVELS || root->count == 0) {
+        return -EIO;
+    }
+
+    struct fs_dx_node* node = malloc(FS_BLOCK_SIZE);
+    if (node == NULL) {
+        return -ENOMEM;
+    }
+    struct fs_dx_node* p = root;
+    int n = 0;
+    for (int level = 0; ; level++) {
+        int at = dx_search(p, hash);
+        path[level] = (struct dx_frame){.n = n, .at = at};
+        n = p->entries[at].block;
+        if (level == root->levels) {
+            break;
+        }
+
+        // read index block at next level
+        if (get_file_blk(inum, n, node, 0) <= 0
+                || node->magic != FS_DX_MAGIC || node->count == 0) {
+            n = -EIO;
+            break;
+        }
+        p = node;
+    }
+    free(node);
+    return n;
+}
+
+/**
+ * Inserts an entry into an index block after the entry on the
+ * path. If the block is full, it is split, and an entry for the
+ * new block is inserted at the level above. If the root is full,
+ * its entries first move to a new index block below it.
+ *
+ *  Errors
+ *   -EIO     - error reading or writing block
+ *   -ENOSPC  - cannot allocate block, or index is full
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block, to be written by the caller
+ * @param path the path to the block of entries
+ * @param level the level of the index block on the path
+ * @param hash the hash of the new entry
+ * @param n the block of the new entry
+ * @param node storage for an index block
+ * @param upper storage for the upper half of a split index block
+ * @return 0 if successful, or -error
+ */
+static int dx_insert_blk(int inum, struct fs_dx_node* root, struct dx_frame* path,
+                         int level, uint32_t hash, int n,
+                         struct fs_dx_node* node, struct fs_dx_node* upper)
+{
+    struct fs_dx_node* p = root;
+    if (level > 0) {
+        p = node;
+        if (get_file_blk(inum, path[level].n, p, 0) <= 0) {
+            return -EIO;
+        }
+    }
+
+    int at = path[level].at + 1;
+    if (p->count < DX_ENTRIES_PER_BLK) {
+        // room for entry in index block
+        dx_insert_at(p, at, hash, n);
+        return (level > 0) ? dx_put_blk(inum, path[level].n, p) : 0;
+    }
+
+    if (level == 0) {
+        // move entries of full root to a new index block below it
+        if (root->levels == DX_MAX_LEVELS) {
+            return -ENOSPC;
+        }
+        int child = dx_new_blk(inum, root);
+        if (child < 0) {
+            return child;
+        }
+        memcpy(node, root, FS_BLOCK_SIZE);
+        node->nblocks = 0;
+        if (dx_put_blk(inum, child, node) < 0) {
+            return -EIO;
+        }
+        root->levels++;
+        root->count = 1;
+        root->entries[0] = (struct fs_dx_entry){.hash = 0, .block = child};
+
+        // the path now goes through the new index block
+        memmove(&path[1], &path[0], root->levels * sizeof(struct dx_frame));
+        path[0] = (struct dx_frame){.n = 0, .at = 0};
+        path[1].n = child;
+        return dx_insert_blk(inum, root, path, 1, hash, n, node, upper);
+    }
+
+    // split full index block, moving its upper half to a new block
+    int upper_n = dx_new_blk(inum, root);
+    if (upper_n < 0) {
+        return upper_n;
+    }
+    int half = p->count / 2;
+    memset(upper, 0, FS_BLOCK_SIZE);
+    *upper = (struct fs_dx_node){.magic = FS_DX_MAGIC, .levels = p->levels,
+                                 .count = p->count - half};
+    memcpy(upper->entries, &p->entries[half],
+           upper->count * sizeof(struct fs_dx_entry));
+    p->count = half;
+
+    // insert entry in the half that includes its position
+    if (at <= half) {
+        dx_insert_at(p, at, hash, n);
+    } else {
+        dx_insert_at(upper, at - half, hash, n);
+    }
+    if (dx_put_blk(inum, upper_n, upper) < 0
+            || dx_put_blk(inum, path[level].n, p) < 0) {
+        return -EIO;
+    }
+
+    // add new index block to index block above; the blocks were written,
+    // so their storage is reused
+    return dx_insert_blk(inum, root, path, level - 1, upper->entries[0].hash, upper_n,
+                         node, upper);
+}
+
+/**
+ * Inserts an entry into an index block after the entry on the
+ * path, splitting full index blocks as needed.
+ *
+ *  Errors
+ *   -EIO     - error reading or writing block
+ *   -ENOMEM  - cannot allocate block buffers
+ *   -ENOSPC  - cannot allocate block, or index is full
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block, to be written by the caller
+ * @param path the path to the block of entries
+ * @param level the level of the index block on the path
+ * @param hash the hash of the new entry
+ * @param n the block of the new entry
+ * @return 0 if successful, or -error
+ */
+static int dx_insert(int inum, struct fs_dx_node* root, struct dx_frame* path,
+                     int level, uint32_t hash, int n)
+{
+    struct fs_dx_node* node = malloc(FS_BLOCK_SIZE);
+    struct fs_dx_node* upper = malloc(FS_BLOCK_SIZE);
+    int status = (node == NULL || upper == NULL) ? -ENOMEM
+               : dx_insert_blk(inum, root, path, level, hash, n, node, upper);
+    free(node);
+    free(upper);
+    return status;
+}
+
+/** An entry of a directory block and the hash of its name, for sorting */
+struct dx_sort_entry {
+    uint32_t hash;
+    int entno;
+};
+
+/**
+ * Splits a full block of entries, moving the entries in the
+ * upper half of its hash range to a new block. Entries with the
+ * same hash stay in the same block.
+ *
+ *  Errors
+ *   -EIO     - error reading or writing block
+ *   -ENOMEM  - cannot allocate block buffers
+ *   -ENOSPC  - cannot allocate block, index is full, or all
+ *              entries have the same hash
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block
+ * @param path the path to the block of entries
+ * @param n the 0-based index of the block in the directory
+ * @param de the entries of the block
+ * @param h storage for the sorted hashes of the entries
+ * @param upper storage for the upper half of the entries
+ * @return 0 if successful, or -error
+ */
+static int dx_split_leaf_blk(int inum, struct fs_dx_node* root, struct dx_frame* path,
+                             int n, struct fs_dirent* de, struct dx_sort_entry* h,
+                             struct fs_dirent* upper)
+{
+    // sort entries by hash (insertion sort of one block)
+    for (int i = 0; i < DIRENTS_PER_BLK; i++) {
+        uint32_t hash = dx_hash(de[i].name);
+        int j = i;
+        for (; j > 0 && h[j-1].hash > hash; j--) {
+            h[j] = h[j-1];
+        }
+        h[j].hash = hash;
+        h[j].entno = i;
+    }
+
+    // split nearest the middle between entries with different hashes
+    int split = -1;
+    for (int d = 0; d < DIRENTS_PER_BLK/2 && split < 0; d++) {
+        int mid = DIRENTS_PER_BLK/2;
+        if (h[mid+d-1].hash != h[mid+d].hash) {
+            split = mid + d;
+        } else if (d > 0 && h[mid-d-1].hash != h[mid-d].hash) {
+            split = mid - d;
+        }
+    }
+    if (split < 0) {
+        return -ENOSPC;
+    }
+
+    // add new block to index, then move entries to it
+    int upper_n = dx_new_blk(inum, root);
+    if (upper_n < 0) {
+        return upper_n;
+    }
+    int status = dx_insert(inum, root, path, root->levels, h[split].hash, upper_n);
+    if (dx_put_blk(inum, 0, root) < 0 && status == 0) {
+        status = -EIO;
+    }
+    if (status < 0) {
+        return status;
+    }
+
+    memset(upper, 0, FS_BLOCK_SIZE);
+    for (int i = split; i < DIRENTS_PER_BLK; i++) {
+        upper[i - split] = de[h[i].entno];
+        de[h[i].entno].valid = 0;
+    }
+    if (dx_put_blk(inum, upper_n, upper) < 0 || dx_put_blk(inum, n, de) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Splits a full block of entries, moving the entries in the
+ * upper half of its hash range to a new block.
+ *
+ *  Errors
+ *   -EIO     - error reading or writing block
+ *   -ENOMEM  - cannot allocate block buffers
+ *   -ENOSPC  - cannot allocate block, index is full, or all
+ *              entries have the same hash
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block
+ * @param path the path to the block of entries
+ * @param n the 0-based index of the block in the directory
+ * @param de the entries of the block
+ * @return 0 if successful, or -error
+ */
+static int dx_split_leaf(int inum, struct fs_dx_node* root, struct dx_frame* path,
+                         int n, struct fs_dirent* de)
+{
+    struct dx_sort_entry* h = malloc(DIRENTS_PER_BLK * sizeof(struct dx_sort_entry));
+    struct fs_dirent* upper = malloc(FS_BLOCK_SIZE);
+    int status = (h == NULL || upper == NULL) ? -ENOMEM
+               : dx_split_leaf_blk(inum, root, path, n, de, h, upper);
+    free(h);
+    free(upper);
+    return status;
+}
+
+/**
+ * Converts a single-block directory to an indexed directory
+ * whose root has one entry, for a block with the entries.
+ *
+ *  Errors
+ *   -EIO     - error writing block
+ *   -ENOSPC  - cannot allocate block
+ *
+ * @param inum the inode number of a directory
+ * @param root the first block of the directory; returns the root
+ * @return 1 if successful, or -error
+ */
+static int dx_make_root(int inum, struct fs_dx_node* root)
+{
+    // move entries to second block
+    if (get_file_blkno(inum, 1, 1) == 0) {
+        return -ENOSPC;
+    }
+    if (dx_put_blk(inum, 1, root) < 0) {
+        return -EIO;
+    }
+
+    memset(root, 0, FS_BLOCK_SIZE);
+    root->magic = FS_DX_MAGIC;
+    root->levels = 0;
+    root->count = 1;
+    root->nblocks = 2;
+    root->entries[0] = (struct fs_dx_entry){.hash = 0, .block = 1};
+    return (dx_put_blk(inum, 0, root) < 0) ? -EIO : 1;
+}
+
+/**
+ * Look up a directory entry in an indexed directory, or a free
+ * entry for a name, splitting the block for the name if full.
+ *
+ * Errors
+ *   -EIO     - error reading block
+ *   -ENOENT  - entry not found
+ *   -ENOSPC  - cannot allocate space for free entry
+ *
+ * @param inum the inode number of a directory
+ * @param root the root index block
+ * @param block storage for a directory block
+ * @param blkno block no returned for a directory block
+ * @param name the name of the entry
+ * @param want_free 1 to find free entry, 0 to find entry for name
+ * @return entry in block returned through block, or -error
+ */
+static int dx_get_entry_block(int inum, struct fs_dx_node* root, void* block,
+                              int* blkno, const char* name, int want_free)
+{
+    uint32_t hash = dx_hash(name);
+    while (1) {
+        // get block of entries for name
+        struct dx_frame path[DX_MAX_LEVELS + 2];
+        int n = dx_find_leaf(inum, root, hash, path);
+        if (n < 0) {
+            return n;
+        }
+        int dir_blkno = get_file_blk(inum, n, block, 0);
+        if (dir_blkno <= 0) {
+            return -EIO;
+        }
+
+        // find entry in block
+        int entry_no = want_free ? get_free_entry_in_block(block)
+                                 : get_dir_entry_in_block(block, name);
+        if (entry_no >= 0) {
+            *blkno = dir_blkno;
+            return entry_no;
+        } else if (!want_free) {
+            return -ENOENT;
+        }
+
+        // split full block and try again
+        int status = dx_split_leaf(inum, root, path, n, block);
+        if (status < 0) {
+            return status;
+        }
+    }
+}
+#endif  /* FS_VERSION > 2 */
+
 /**
  * Look up a single directory entry in a directory.
  *
  * Errors
  *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - intermediate component of path not a directory
  *
@@ -135,6 +629,23 @@ int get_dir_entry_block(
         return -ENOTDIR;
     }
 
+#if (FS_VERSION > 2)
+    // look up entry through index of indexed directory
+    struct fs_dx_node* root = malloc(FS_BLOCK_SIZE);
+    int status = (root == NULL) ? -ENOMEM : dx_get_root(inum, root);
+    if (status != 0) {
+        status = (status < 0) ? status
+               : dx_get_entry_block(inum, root, block, blkno, name, 0);
+        free(root);
+        if (status < 0) {
+            *blkno = 0;  // no block
+            memset(block, 0, FS_BLOCK_SIZE);
+        }
+        return status;
+    }
+    free(root);
+#endif  /* FS_VERSION > 2 */
+
     /* multi-block implementation that reuses file block design.*/
     int n = 0;
     while (1) {
@@ -182,15 +693,41 @@ int get_dir_entry_block(
  *   -EIO     - error reading block
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - intermediate component of path not a directory
+ *   -ENOMEM  - cannot allocate block buffer
  *   -ENOSPC  - cannot allocate space for free entry
  *
  * @param inum the inode number of a directory
  * @param block storage for a directory block
  * @param blkno block no returned for a directory block
+ * @param name the name of the new entry
  * @return entry in block returned through block, or -error
  */
-int get_dir_free_entry_block(int inum, void* block, int* blkno)
+int get_dir_free_entry_block(int inum, void* block, int* blkno, const char* name)
 {
+#if (FS_VERSION > 2)
+    // index a single-block directory when its block is full
+    struct fs_dx_node* root = malloc(FS_BLOCK_SIZE);
+    int status = (root == NULL) ? -ENOMEM : dx_get_root(inum, root);
+    if (status == 0 && get_file_blkno(inum, 1, 0) == 0
+            && get_free_entry_in_block((void*)root) < 0) {
+        status = dx_make_root(inum, root);
+    }
+
+    // find free entry through index of indexed directory
+    if (status != 0) {
+        status = (status < 0) ? status
+               : dx_get_entry_block(inum, root, block, blkno, name, 1);
+        free(root);
+        if (status < 0) {
+            memset(block, 0, FS_BLOCK_SIZE);
+        }
+        return status;
+    }
+    free(root);
+#else
+    (void)name;  // name only chooses the block of an indexed directory
+#endif  /* FS_VERSION > 2 */
+
     /* multi-block implementation that reuses file block design.*/
     int n = 0;
     while(1) {
@@ -228,34 +765,193 @@ int get_dir_free_entry_block(int inum, void* block, int* blkno)
 */
 }
 
+enum {
+    /** number of entries in dentry cache -- a power of 2 */
+    DCACHE_ENTRIES = 1024
+};
+
+/** Cached result of looking up a name in a directory */
+struct dcache_entry {
+    /** inode number of directory, or 0 if entry unused */
+    int dir_inum;
+    /** inode number of named entry, or -ENOENT if not present */
+    int inum;
+    /** name of entry */
+    char name[FS_FILENAME_SIZE];
+};
+
 /**
- * Look up a single directory entry in a directory.
+ * Dentry cache of directory lookups, including lookups of names
+ * that are not present, so that resolving a path does not read
+ * directory blocks for each component. Entries are replaced when
+ * another lookup hashes to the same entry, and are removed when a
+ * name is added to or removed from a directory.
+ */
+static struct dcache_entry dcache[DCACHE_ENTRIES];
+
+/** lock for dentry cache entries */
+static pthread_mutex_t dcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the dentry cache entry for a directory and name.
+ *
+ * @param dir_inum the inode number of a directory
+ * @param name the name of the entry
+ * @return the cache entry, which may be for another name
+ */
+static struct dcache_entry* dcache_slot(int dir_inum, const char* name)
+{
+    // FNV-1a hash of name and directory
+    uint32_t h = 2166136261u ^ (uint32_t)dir_inum;
+    for (const char* p = name; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return &dcache[h & (DCACHE_ENTRIES - 1)];
+}
+
+/**
+ * Removes the dentry cache entry for a name in a directory.
+ *
+ * @param dir_inum the inode number of a directory
+ * @param name the name of the entry
+ */
+void dcache_remove(int dir_inum, const char* name)
+{
+    // name as stored in a directory entry
+    char key[FS_FILENAME_SIZE];
+    strncpy(key, name, FS_FILENAME_SIZE-1);
+    key[FS_FILENAME_SIZE-1] = '\0';
+
+    pthread_mutex_lock(&dcache_lock);
+    struct dcache_entry* e = dcache_slot(dir_inum, key);
+    if (e->dir_inum == dir_inum && strcmp(e->name, key) == 0) {
+        e->dir_inum = 0;
+    }
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+/**
+ * Removes all dentry cache entries for names in a directory.
+ *
+ * @param dir_inum the inode number of a directory
+ */
+void dcache_remove_dir(int dir_inum)
+{
+    pthread_mutex_lock(&dcache_lock);
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        if (dcache[i].dir_inum == dir_inum) {
+            dcache[i].dir_inum = 0;
+        }
+    }
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+/**
+ * Look up a name in the dentry cache of a directory.
+ *
+ * @param inum the inode number of a directory
+ * @param name the name of the entry
+ * @param entry_inum set to the cached inode number or -ENOENT
+ * @return 1 if the name is cached, 0 if not
+ */
+static int dcache_lookup(int inum, const char* name, int* entry_inum)
+{
+    pthread_mutex_lock(&dcache_lock);
+    struct dcache_entry* e = dcache_slot(inum, name);
+    int found = (e->dir_inum == inum && strcmp(e->name, name) == 0);
+    if (found) {
+        *entry_inum = e->inum;
+    }
+    pthread_mutex_unlock(&dcache_lock);
+    return found;
+}
+
+/**
+ * Look up a single directory entry in a directory that the
+ * caller has locked for reading or writing, so that the caller
+ * can act on the result before the entry can be changed.
  *
  * Errors
  *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - intermediate component of path not a directory
  *
- * @param inum the inode number of a directory
+ * @param inum the inode number of a locked directory
  * @param name the name of the entry
  * @return inode number of the entry or -error
  */
-int get_dir_entry_inode(int inum, const char* name)
+int get_dir_entry_inode_locked(int inum, const char* name)
 {
 #if (FS_VERSION == 0)
     // return inum if entry name is '.'
     // -- remove once directory contains '.' and '..' entries
     if (strcmp(name,".") == 0) return inum;
 #endif  /* FS_VERSION */
-    char buf[FS_BLOCK_SIZE];
+
+    // return cached result of earlier lookup; names too
+    // long to store in an entry are not cached
+    int cached = S_ISDIR(fs.inodes[inum].mode) && strlen(name) < FS_FILENAME_SIZE;
+    int entry_inum;
+    if (cached && dcache_lookup(inum, name, &entry_inum)) {
+        return entry_inum;
+    }
 
     // get block and entry number of name in directory
+    char* buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
     int blkno;
     int entno = get_dir_entry_block(inum, buf, &blkno, name);
 
     // return inode of entry if found or error returned
     struct fs_dirent* de =(void*)buf;
-    return (entno < 0) ? entno : de[entno].inode;
+    entry_inum = (entno < 0) ? entno : de[entno].inode;
+    free(buf);
+
+    // cache entry found or not present; the directory is locked,
+    // so the result is not stale if it is being modified
+    if (cached && (entno >= 0 || entno == -ENOENT)) {
+        pthread_mutex_lock(&dcache_lock);
+        struct dcache_entry* e = dcache_slot(inum, name);
+        e->dir_inum = inum;
+        e->inum = entry_inum;
+        strcpy(e->name, name);
+        pthread_mutex_unlock(&dcache_lock);
+    }
+    return entry_inum;
+}
+
+/**
+ * Look up a single directory entry in a directory.
+ * Results, including names that are not present, are kept
+ * in a dentry cache until the name is added to or removed
+ * from the directory.
+ *
+ * Errors
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
+ *   -ENOENT  - a component of the path is not present.
+ *   -ENOTDIR - intermediate component of path not a directory
+ *
+ * @param inum the inode number of a directory
+ * @param name the name of the entry
+ * @return inode number of the entry or -error
+ */
+int get_dir_entry_inode(int inum, const char* name)
+{
+    // return cached result without locking the directory
+    int entry_inum;
+    if (S_ISDIR(fs.inodes[inum].mode) && strlen(name) < FS_FILENAME_SIZE &&
+        dcache_lookup(inum, name, &entry_inum)) {
+        return entry_inum;
+    }
+
+    read_lock_inode(inum);
+    entry_inum = get_dir_entry_inode_locked(inum, name);
+    unlock_inode(inum);
+    return entry_inum;
 }
 
 /**
@@ -278,12 +974,68 @@ void set_dir_entry(struct fs_dirent* de, int inum, const char* name) {
     mark_inode(inum);
 }
 
+/**
+ * Renames an entry of a directory by adding an entry for the new
+ * name where a free entry for that name is found, and removing the
+ * entry for the old name. Used where the block of an entry depends
+ * on its name, as in an indexed directory.
+ *
+ * Errors
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
+ *   -ENOENT  - entry for old name does not exist
+ *   -ENOSPC  - cannot allocate space for new entry
+ *
+ * @param inum the inode number of a directory
+ * @param src_name the old name of the entry
+ * @param dst_name the new name of the entry
+ * @return 0 if successful, or -error
+ */
+int move_dir_entry(int inum, const char* src_name, const char* dst_name)
+{
+    int blkno;
+    char* buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    struct fs_dirent *de = (void*)buf;
+    int entno = get_dir_entry_block(inum, buf, &blkno, src_name);
+    if (entno < 0) {
+        free(buf);
+        return entno;
+    }
+    struct fs_dirent ent = de[entno];
+
+    // add entry for new name
+    entno = get_dir_free_entry_block(inum, buf, &blkno, dst_name);
+    if (entno < 0) {
+        free(buf);
+        return entno;
+    }
+    de[entno] = ent;
+    memset(de[entno].name, 0, FS_FILENAME_SIZE);
+    // truncates name at FS_FILENAME_SIZE-1, then '\0'
+    strncpy(de[entno].name, dst_name, FS_FILENAME_SIZE-1);
+    write_journaled_blk(blkno, buf);
+
+    // remove entry for old name, which may have moved to
+    // another block if adding the new entry split its block
+    entno = get_dir_entry_block(inum, buf, &blkno, src_name);
+    if (entno >= 0) {
+        de[entno].valid = 0;
+        write_journaled_blk(blkno, buf);
+    }
+    free(buf);
+    return 0;
+}
+
 /**
  * Remove an empty directory named leaf in the specified
  * directory inum.
  *
  * Errors
  *   -ENOENT   - file does not exist
+ *   -ENOMEM   - cannot allocate block buffer
  *   -ENOTDIR  - component of path not a directory
  *   -ENOTDIR  - path not a directory
  *   -ENOTEMPTY - directory not empty
@@ -301,9 +1053,13 @@ int do_rmdir(int dir_inum, const char* leaf) {
 
     /** find entry in directory */
     int blkno;
-    char buf[FS_BLOCK_SIZE];
+    char* buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
     int entno = get_dir_entry_block(dir_inum, buf, &blkno, leaf);
     if (entno < 0) {
+        free(buf);
         return -ENOENT;  // entry not found
     }
 
@@ -313,25 +1069,37 @@ int do_rmdir(int dir_inum, const char* leaf) {
 
     // ensure that entry being removed is a directory
     if (!S_ISDIR(fs.inodes[entry_inum].mode)) {
+        free(buf);
         return -ENOTDIR;  // entry must be directory
     }
 
     // ensure directory being removed is empty
     // 0 indicates not empty, < 0 indicates error
     if (is_dir_empty(entry_inum) != 1) {
+        free(buf);
         return -ENOTEMPTY;
     }
 
     // mark directory inode free and flush its block
     de[entno].valid = 0;
-    disk->ops->write(disk, blkno, 1, buf);
+    write_journaled_blk(blkno, buf);
+    free(buf);
 
-    // truncate all blocks of unlinked directory inode
-    do_truncate(entry_inum, 0);
-    mark_inode(entry_inum);
+    // remove cached lookups of entry and in directory
+    dcache_remove(dir_inum, leaf);
+    dcache_remove_dir(entry_inum);
 
-    // free unlinked directory inode
-    return_inode(entry_inum);
+    // free unlinked directory inode, waiting for operations on
+    // directory to finish, unless the kernel still refers to it
+    if (entry_inum != dir_inum) {
+        write_lock_inode(entry_inum);
+    }
+    if (!orphan_inode(entry_inum)) {
+        free_inode(entry_inum);
+    }
+    if (entry_inum != dir_inum) {
+        unlock_inode(entry_inum);
+    }
 
     // decrease size of directory by one fs_dirent
     // NOTE: add logging to report errors like this
@@ -76,11 +76,29 @@ int get_dir_entry_in_block(struct fs_dirent* de, const char* name);
  */
 int get_free_entry_in_block(struct fs_dirent* de);
 
+/**
+ * Look up a single directory entry in a directory that the
+ * caller has locked for reading or writing, so that the caller
+ * can act on the result before the entry can be changed.
+ *
+ * Errors
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
+ *   -ENOENT  - a component of the path is not present.
+ *   -ENOTDIR - intermediate component of path not a directory
+ *
+ * @param inum the inode number of a locked directory
+ * @param name the name of the entry
+ * @return inode number of the entry or -error
+ */
+int get_dir_entry_inode_locked(int inum, const char* name);
+
 /**
  * Look up a single directory entry in a directory.
  *
  * Errors
  *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - intermediate component of path not a directory
  *
@@ -100,20 +118,41 @@ int get_dir_entry_block(
  *   -EIO     - error reading block
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - intermediate component of path not a directory
+ *   -ENOMEM  - cannot allocate block buffer
  *   -ENOSPC  - cannot allocate space for free entry
  *
  * @param inum the inode number of a directory
  * @param block storage for a directory block
  * @param blkno block no returned for a directory block
+ * @param name the name of the new entry
  * @return entry in block returned through block, or -error
  */
-int get_dir_free_entry_block(int inum, void* block, int* blkno);
+int get_dir_free_entry_block(int inum, void* block, int* blkno, const char* name);
+
+/**
+ * Removes the dentry cache entry for a name in a directory.
+ *
+ * @param dir_inum the inode number of a directory
+ * @param name the name of the entry
+ */
+void dcache_remove(int dir_inum, const char* name);
+
+/**
+ * Removes all dentry cache entries for names in a directory.
+ *
+ * @param dir_inum the inode number of a directory
+ */
+void dcache_remove_dir(int dir_inum);
 
 /**
  * Look up a single directory entry in a directory.
+ * Results, including names that are not present, are kept
+ * in a dentry cache until the name is added to or removed
+ * from the directory.
  *
  * Errors
  *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - intermediate component of path not a directory
  *
@@ -132,12 +171,32 @@ int get_dir_entry_inode(int inum, const char* name);
  */
 void set_dir_entry(struct fs_dirent* de, int inum, const char* name);
 
+/**
+ * Renames an entry of a directory by adding an entry for the new
+ * name where a free entry for that name is found, and removing the
+ * entry for the old name. Used where the block of an entry depends
+ * on its name, as in an indexed directory.
+ *
+ * Errors
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
+ *   -ENOENT  - entry for old name does not exist
+ *   -ENOSPC  - cannot allocate space for new entry
+ *
+ * @param inum the inode number of a directory
+ * @param src_name the old name of the entry
+ * @param dst_name the new name of the entry
+ * @return 0 if successful, or -error
+ */
+int move_dir_entry(int inum, const char* src_name, const char* dst_name);
+
 /**
  * Remove an empty directory named leaf in the specified
  * directory inum.
  *
  * Errors
  *   -ENOENT   - file does not exist
+ *   -ENOMEM   - cannot allocate block buffer
  *   -ENOTDIR  - component of path not a directory
  *   -ENOTDIR  - path not a directory
  *   -ENOTEMPTY - directory not empty
@@ -9,6 +9,8 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -25,353 +27,1903 @@
 #include "min.h"
 
 
-/** file block of 0s */
-static char zeros[FS_BLOCK_SIZE];
+/** file block of 0s, for the largest block size */
+static char zeros[FS_MAX_BLOCK_SIZE];
+
+enum {
+    /** max number of block run requests submitted together by do_read */
+    READ_BATCH = 64,
+    /** max number of block run requests submitted together by do_write */
+    WRITE_BATCH = 64,
+    /** number of cached indirect blocks -- a power of 2 */
+    BLKMAP_ENTRIES = 256
+};
+
+/**
+ * Returns 1 if the blocks of a file are mapped by an extent tree
+ * rooted in its inode, rather than by direct and indirect blocks.
+ *
+ * @param inum the number of file inode
+ * @return 1 if file blocks are mapped by extents, 0 if not
+ */
+static int is_extent_file(int inum)
+{
+#if (FS_VERSION > 4)
+    return (fs.inodes[inum].flags & FS_EXTENTS) != 0;
+#else
+    return 0;
+#endif  /* FS_VERSION > 4 */
+}
+
+/**
+ * Returns the maximum number of blocks of a file. An extent tree
+ * maps as many blocks as an int block index can address; direct and
+ * indirect blocks map fewer, up to the triple-indirect block. A
+ * regular file with inline data is mapped by extents once it grows.
+ *
+ * @param inum the number of file inode
+ * @return the maximum number of blocks of the file
+ */
+static int max_file_blks(int inum)
+{
+    long long nblks = N_DIRECT + PTRS_PER_BLK + (long long)PTRS_PER_BLK * PTRS_PER_BLK;
+#if (FS_VERSION > 4)
+    nblks += (long long)PTRS_PER_BLK * PTRS_PER_BLK * PTRS_PER_BLK;
+    if (is_extent_file(inum) || is_inline_file(inum)) {
+        nblks = INT_MAX;
+    }
+#endif  /* FS_VERSION > 4 */
+    return (nblks < INT_MAX) ? nblks : INT_MAX;
+}
+
+/**
+ * Returns the maximum size of a file, limited by the blocks it can
+ * map and by the size field of the inode: 48 bits with size_hi, or
+ * 32 bits before FS_VERSION 5.
+ *
+ * @param inum the number of file inode
+ * @return the maximum file size in bytes
+ */
+static off_t max_file_size(int inum)
+{
+    off_t size = (off_t)max_file_blks(inum) * FS_BLOCK_SIZE;
+#if (FS_VERSION > 4)
+    off_t limit = ((off_t)1 << 48) - 1;
+#else
+    off_t limit = UINT32_MAX;
+#endif  /* FS_VERSION > 4 */
+    return (size < limit) ? size : limit;
+}
+
+/**
+ * Returns the size in bytes of the file of an inode, from its
+ * low 32 bits in size and its high 16 bits in size_hi.
+ *
+ * @param in the file inode
+ * @return the file size in bytes
+ */
+off_t get_inode_size(const struct fs_inode *in)
+{
+    return (off_t)in->size | ((off_t)in->size_hi << 32);
+}
+
+/**
+ * Sets the size in bytes of the file of an inode, as its low
+ * 32 bits in size and its high 16 bits in size_hi.
+ *
+ * @param in the file inode
+ * @param size the file size in bytes
+ */
+void set_inode_size(struct fs_inode *in, off_t size)
+{
+    in->size = (uint32_t)size;
+    in->size_hi = (uint16_t)(size >> 32);
+}
+
+/** Cached copy of an indirect block or extent tree block of a file */
+struct blkmap_entry {
+    /** 1 if entry holds the contents of a block */
+    int valid;
+    /** inode number of the file */
+    int inum;
+    /** block number of the cached block */
+    int blkno;
+    /** block pointers of the indirect block, or the extent tree
+     *  node, allocated when first used */
+    uint32_t *ptrs;
+};
+
+/**
+ * Block map cache of indirect blocks and extent tree blocks, so that
+ * resolving the block numbers of a file does not read them from disk
+ * on every access. Entries are keyed by block number, loaded when
+ * first used, kept in sync with disk when a block is added to a file,
+ * and invalidated when the file is truncated.
+ */
+static struct blkmap_entry blkmap[BLKMAP_ENTRIES];
+
+/** lock for block map cache, held while mapping file blocks except
+ *  while blocks are read, written, or allocated */
+static pthread_mutex_t blkmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** lock for the counts of blocks allocated to files */
+static pthread_mutex_t nblks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Adds n blocks, or removes -n blocks, to the count of blocks
+ * allocated to a file, if the file's blocks have been counted
+ * since the volume was mounted. Called with the inode locked
+ * for writing.
+ *
+ * @param inum the number of file inode
+ * @param n the number of blocks added, or -number removed
+ */
+static void add_file_blks(int inum, int n)
+{
+    pthread_mutex_lock(&nblks_lock);
+    if (fs.inode_nblks[inum] >= 0) {
+        fs.inode_nblks[inum] += n;
+    }
+    pthread_mutex_unlock(&nblks_lock);
+}
+
+/**
+ * Returns the cached contents of an indirect block or extent tree
+ * block of a file, reading them from disk if not cached. If the block
+ * was just allocated, its contents are initialized and written as 0s.
+ * Called with the block map cache locked; the cache is unlocked while
+ * the block is read or written, so mapping blocks of other files is
+ * not held up. The file is locked, so its blocks do not change. The
+ * contents returned remain valid until the next call.
+ *
+ * @param inum the number of file inode
+ * @param blkno block number of the block
+ * @param is_new 1 if the block was just allocated
+ * @return the block pointers, or NULL if cannot read block
+ */
+static uint32_t *get_blkmap(int inum, int blkno, int is_new)
+{
+    unsigned h = ((unsigned)blkno * 2654435761u) & (BLKMAP_ENTRIES - 1);
+    struct blkmap_entry *e = &blkmap[h];
+    if (e->valid && e->inum == inum && e->blkno == blkno && !is_new) {
+        return e->ptrs;
+    }
+
+    uint32_t *ptrs = malloc(FS_BLOCK_SIZE);
+    if (ptrs == NULL) {
+        return NULL;
+    }
+    pthread_mutex_unlock(&blkmap_lock);
+    int status = 0;
+    if (is_new) {
+        memset(ptrs, 0, FS_BLOCK_SIZE);
+        write_journaled_blk(blkno, ptrs);
+    } else {
+        status = read_journaled_blk(blkno, ptrs);
+    }
+    pthread_mutex_lock(&blkmap_lock);
+    if (status < 0) {
+        free(ptrs);
+        return NULL;
+    }
+
+    // replace entry, which other threads may have replaced meanwhile
+    free(e->ptrs);
+    e->ptrs = ptrs;
+    e->valid = 1;
+    e->inum = inum;
+    e->blkno = blkno;
+    return e->ptrs;
+}
+
+/**
+ * Allocates a free block for a file, and initializes it with 0s if
+ * it is a data block, before it is added to the file. Called with the
+ * block map cache locked; the cache is unlocked meanwhile, so cached
+ * blocks returned before by get_blkmap() may be replaced.
+ *
+ * @param zero 1 to initialize the block with 0s
+ * @return the block number, or 0 if no space
+ */
+static int get_free_file_blk(int zero)
+{
+    pthread_mutex_unlock(&blkmap_lock);
+    int blkno = get_free_blk();
+    if (blkno != 0 && zero) {
+        disk->ops->write(disk, blkno, 1, zeros);
+    }
+    pthread_mutex_lock(&blkmap_lock);
+    return blkno;
+}
+
+/**
+ * Returns the number of non-zero block pointers in an indirect block.
+ *
+ * @param ptrs the block pointers, or NULL if cannot read block
+ * @return the number of non-zero block pointers
+ */
+static int count_ptrs(const uint32_t *ptrs)
+{
+    int n = 0;
+    for (int i = 0; ptrs != NULL && i < PTRS_PER_BLK; i++) {
+        n += (ptrs[i] != 0);
+    }
+    return n;
+}
+
+/**
+ * Invalidates the cached indirect blocks and extent tree blocks
+ * of a file.
+ *
+ * @param inum the number of file inode
+ */
+static void invalidate_blkmap(int inum)
+{
+    pthread_mutex_lock(&blkmap_lock);
+    for (int i = 0; i < BLKMAP_ENTRIES; i++) {
+        if (blkmap[i].inum == inum) {
+            blkmap[i].valid = 0;
+        }
+    }
+    pthread_mutex_unlock(&blkmap_lock);
+}
+
+/**
+ * Returns the block number of the n-th block mapped by a direct block
+ * pointer, or by a tree of 1 to 3 levels of indirect blocks, adding
+ * the block and the indirect blocks above it if they do not exist and
+ * alloc == 1. The block added is new_blkno if not 0, otherwise a free
+ * block that is initialized with 0s.
+ *
+ * @param inum the number of file inode
+ * @param ptr the block pointer in the inode: direct, indir_1, indir_2,
+ *   or indir_3
+ * @param depth the number of levels of indirect blocks below ptr
+ * @param n the 0-based block index among the blocks mapped by ptr
+ * @param alloc 1=allocate block if does not exist 0 = fail
+ *   if does not exist
+ * @param new_blkno an allocated block to add, or 0 to
+ *   allocate a free block
+ * @return block number of the n-th block or 0 if unavailable
+ */
+static int indir_blkno_locked(int inum, uint32_t *ptr, int depth, int n,
+                              int alloc, int new_blkno)
+{
+    int parent = 0;          // indirect block holding ptr, 0 for inode
+    uint32_t *ptrs = NULL;   // cached pointers of parent
+    int idx = 0;             // index of ptr in parent
+    int span = 1;            // blocks mapped by each pointer at level
+    for (int i = 1; i < depth; i++) {
+        span *= PTRS_PER_BLK;
+    }
+
+    for (int level = depth; ; level--) {
+        int is_new = 0;
+        if (*ptr == 0) {
+            if (alloc == 0) {
+                return 0;  // not found if no alloc
+            }
+            // add data block, or indirect block at this level
+            int blkno = new_blkno;
+            if (level > 0 || new_blkno == 0) {
+                if ((blkno = get_free_file_blk(level == 0)) == 0) {
+                    return 0;  // no space
+                }
+                // cached parent may have been replaced while allocating
+                if (parent != 0) {
+                    if ((ptrs = get_blkmap(inum, parent, 0)) == NULL) {
+                        return_blk(blkno);
+                        return 0;
+                    }
+                    ptr = &ptrs[idx];
+                }
+            }
+            *ptr = blkno;
+            add_file_blks(inum, 1);
+            if (parent == 0) {
+                mark_inode(inum);
+            } else {
+                write_journaled_blk(parent, ptrs);
+            }
+            is_new = 1;
+        }
+        if (level == 0) {
+            return *ptr;
+        }
+
+        // descend to pointer in indirect block
+        parent = *ptr;
+        if ((ptrs = get_blkmap(inum, parent, is_new)) == NULL) {
+            return 0;
+        }
+        idx = n / span;
+        ptr = &ptrs[idx];
+        n %= span;
+        span /= PTRS_PER_BLK;
+    }
+}
+
+/**
+ * Returns the entries of an extent tree node.
+ *
+ * @param h the node header
+ * @return the entries that follow the header
+ */
+static struct fs_extent *node_extents(struct fs_extent_header *h)
+{
+    return (struct fs_extent *)(h + 1);
+}
+
+/**
+ * Returns an extent tree node of a file: the root in its inode, or
+ * the cached contents of a block, which remain valid until the next
+ * block is read from the cache.
+ *
+ * @param inum the number of file inode
+ * @param blkno the block number of the node, or 0 for the root
+ * @param is_new 1 if the block was just allocated
+ * @return the node, or NULL if cannot read block or not a node
+ */
+static struct fs_extent_header *get_extent_node(int inum, int blkno, int is_new)
+{
+    if (blkno == 0) {
+        return (struct fs_extent_header *)fs.inodes[inum].direct;
+    }
+    struct fs_extent_header *h = (void*)get_blkmap(inum, blkno, is_new);
+    if (h == NULL || (!is_new && h->magic != FS_EXTENT_MAGIC)) {
+        return NULL;
+    }
+    return h;
+}
+
+/**
+ * Writes an extent tree node of a file that was changed: marks
+ * the inode of the root, or writes the block of other nodes.
+ *
+ * @param inum the number of file inode
+ * @param blkno the block number of the node, or 0 for the root
+ * @param h the node
+ */
+static void put_extent_node(int inum, int blkno, struct fs_extent_header *h)
+{
+    if (blkno == 0) {
+        mark_inode(inum);
+    } else {
+        write_journaled_blk(blkno, h);
+    }
+}
+
+/**
+ * Initializes an empty extent tree root in place of the block
+ * pointers of a file inode, and marks the file as mapped by it.
+ * The caller marks the inode.
+ *
+ * @param in the file inode
+ */
+static void init_extent_root(struct fs_inode *in)
+{
+    struct fs_extent_header *root = (struct fs_extent_header *)in->direct;
+    memset(root, 0, INLINE_DATA_SIZE);
+    *root = (struct fs_extent_header){.magic = FS_EXTENT_MAGIC,
+            .count = 0, .max = N_ROOT_EXTENTS, .depth = 0};
+    in->flags |= FS_EXTENTS;
+}
+
+/**
+ * Returns the index of the last entry of an extent tree node whose
+ * file block is at or before file block n.
+ *
+ * @param h the node
+ * @param n the 0-based block index in file
+ * @return the index of the entry, or -1 if n precedes all entries
+ */
+static int find_extent(struct fs_extent_header *h, int n)
+{
+    struct fs_extent *ex = node_extents(h);
+    int lo = 0, hi = h->count;  // first entry past n is in [lo, hi]
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ex[mid].block <= (uint32_t)n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+/**
+ * Moves the entries of the full extent tree root of a file to a new
+ * block, and makes the root an index node with the block as its
+ * only child, adding a level to the tree.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block
+ *   -EIO     - error reading block
+ *
+ * @param inum the number of file inode
+ * @return 0 if successful, or -error number
+ */
+static int grow_extent_tree(int inum)
+{
+    int blkno = get_free_file_blk(0);
+    if (blkno == 0) {
+        return -ENOSPC;
+    }
+    struct fs_extent_header *root = get_extent_node(inum, 0, 0);
+    struct fs_extent_header *h = get_extent_node(inum, blkno, 1);
+    if (h == NULL) {
+        return_blk(blkno);
+        return -EIO;
+    }
+    *h = (struct fs_extent_header){.magic = FS_EXTENT_MAGIC,
+            .count = root->count, .max = EXTENTS_PER_BLK, .depth = root->depth};
+    memcpy(node_extents(h), node_extents(root), root->count * sizeof(struct fs_extent));
+    put_extent_node(inum, blkno, h);
+
+    root->depth++;
+    root->count = 1;
+    node_extents(root)[0] = (struct fs_extent){
+            .block = node_extents(h)[0].block, .start = blkno, .len = 0};
+    put_extent_node(inum, 0, root);
+    add_file_blks(inum, 1);
+    return 0;
+}
+
+/**
+ * Splits a full extent tree block of a file in two, moving its upper
+ * half of entries to a new block, and adds an entry for the new block
+ * to its parent node, which must not be full.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the number of file inode
+ * @param parent the block number of the parent node, or 0 for the root
+ * @param blkno the block number of the node to split
+ * @return 0 if successful, or -error number
+ */
+static int split_extent_node(int inum, int parent, int blkno)
+{
+    // copy of node, as its cached block may be replaced by the new one
+    struct fs_extent_header *left = malloc(FS_BLOCK_SIZE), *h;
+    if (left == NULL) {
+        return -ENOMEM;
+    }
+    int new_blkno = get_free_file_blk(0);
+    if (new_blkno == 0) {
+        free(left);
+        return -ENOSPC;
+    }
+    if ((h = get_extent_node(inum, blkno, 0)) == NULL) {
+        return_blk(new_blkno);
+        free(left);
+        return -EIO;
+    }
+    memcpy(left, h, FS_BLOCK_SIZE);
+
+    // move upper half of entries to new node
+    int half = left->count / 2;
+    if ((h = get_extent_node(inum, new_blkno, 1)) == NULL) {
+        return_blk(new_blkno);
+        free(left);
+        return -EIO;
+    }
+    *h = *left;
+    h->count = left->count - half;
+    memcpy(node_extents(h), node_extents(left) + half, h->count * sizeof(struct fs_extent));
+    put_extent_node(inum, new_blkno, h);
+    uint32_t key = node_extents(h)[0].block;
+
+    // keep lower half in node
+    left->count = half;
+    if ((h = get_extent_node(inum, blkno, 0)) == NULL) {
+        free(left);
+        return -EIO;
+    }
+    memcpy(h, left, FS_BLOCK_SIZE);
+    put_extent_node(inum, blkno, h);
+    free(left);
+
+    // add new node to parent after the entry of the node
+    if ((h = get_extent_node(inum, parent, 0)) == NULL) {
+        return -EIO;
+    }
+    struct fs_extent *ex = node_extents(h);
+    int i = find_extent(h, key);
+    memmove(&ex[i+2], &ex[i+1], (h->count - i - 1) * sizeof(struct fs_extent));
+    ex[i+1] = (struct fs_extent){.block = key, .start = new_blkno, .len = 0};
+    h->count++;
+    put_extent_node(inum, parent, h);
+    add_file_blks(inum, 1);
+    return 0;
+}
+
+/**
+ * Adds an extent of one block to the extent tree of a file. Full
+ * nodes on the path from the root to the leaf for the block are split
+ * on the way down, so the leaf and its parents have room for the
+ * entries added.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block of tree
+ *   -EIO     - error reading block
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based block index in file
+ * @param blkno the block number of the block
+ * @return 0 if successful, or -error number
+ */
+static int insert_extent(int inum, int n, int blkno)
+{
+    int node = 0, parent = 0;  // block numbers, 0 for root
+    for (;;) {
+        struct fs_extent_header *h = get_extent_node(inum, node, 0);
+        if (h == NULL) {
+            return -EIO;
+        }
+        if (h->count == h->max) {
+            // split full node, then start over from root
+            int status = (node == 0) ? grow_extent_tree(inum)
+                                     : split_extent_node(inum, parent, node);
+            if (status < 0) {
+                return status;
+            }
+            node = parent = 0;
+            continue;
+        }
+
+        struct fs_extent *ex = node_extents(h);
+        int i = find_extent(h, n);
+        if (h->depth == 0) {
+            // add extent to leaf after the one that precedes it
+            memmove(&ex[i+2], &ex[i+1], (h->count - i - 1) * sizeof(struct fs_extent));
+            ex[i+1] = (struct fs_extent){.block = n, .start = blkno, .len = 1};
+            h->count++;
+            put_extent_node(inum, node, h);
+            return 0;
+        }
+        parent = node;
+        node = ex[max(i, 0)].start;
+    }
+}
+
+/**
+ * Returns the block number of the n-th block of a file mapped by an
+ * extent tree, or adds a block if it does not exist and alloc == 1.
+ * A block that follows the last block of an extent on disk extends
+ * the extent; other blocks are added as new extents. The block added
+ * is new_blkno if not 0, otherwise a free block that is initialized
+ * with 0s.
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based block index in file
+ * @param alloc 1=allocate block if does not exist 0 = fail
+ *   if does not exist
+ * @param new_blkno an allocated block to add, or 0 to
+ *   allocate a free block
+ * @return block number of the n-th block or 0 if unavailable
+ */
+static int extent_blkno_locked(int inum, int n, int alloc, int new_blkno)
+{
+    // find extent in leaf node for block
+    int node = 0;
+    struct fs_extent_header *h = get_extent_node(inum, node, 0);
+    while (h != NULL && h->depth > 0) {
+        node = node_extents(h)[max(find_extent(h, n), 0)].start;
+        h = get_extent_node(inum, node, 0);
+    }
+    if (h == NULL) {
+        return 0;
+    }
+    struct fs_extent *ex = node_extents(h);
+    int i = find_extent(h, n);
+    if (i >= 0 && n - ex[i].block < ex[i].len) {
+        return ex[i].start + (n - ex[i].block);
+    }
+    if (alloc == 0) {
+        return 0;  // not found if no alloc
+    }
+
+    // extend the extent or add a new one
+    int blkno = new_blkno;
+    if (blkno == 0) {
+        if ((blkno = get_free_file_blk(1)) == 0) {
+            return 0;  // no space
+        }
+        // cached leaf may have been replaced while allocating
+        if ((h = get_extent_node(inum, node, 0)) == NULL) {
+            return_blk(blkno);
+            return 0;
+        }
+        ex = node_extents(h);
+    }
+    if (i >= 0 && ex[i].block + ex[i].len == (uint32_t)n
+            && ex[i].start + ex[i].len == (uint32_t)blkno) {
+        ex[i].len++;
+        put_extent_node(inum, node, h);
+    } else if (insert_extent(inum, n, blkno) < 0) {
+        if (new_blkno == 0) {
+            return_blk(blkno);
+        }
+        return 0;
+    }
+    add_file_blks(inum, 1);
+    return blkno;
+}
+
+/**
+ * Returns the block number of the n-th block of the file,
+ * or adds a block if it does not exist and alloc == 1. The
+ * block added is new_blkno if not 0, otherwise a free block
+ * that is initialized with 0s.
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based block index in file
+ * @param alloc 1=allocate block if does not exist 0 = fail
+ *   if does not exist
+ * @param new_blkno an allocated block to add, or 0 to
+ *   allocate a free block
+ * @return block number of the n-th block or 0 if unavailable
+ */
+static int file_blkno_locked(int inum, int n, int alloc, int new_blkno)
+{
+    if (is_extent_file(inum)) {
+        return extent_blkno_locked(inum, n, alloc, new_blkno);
+    }
+
+    // get entry from direct blocks
+    struct fs_inode *in = &fs.inodes[inum];
+    if (n < N_DIRECT) {
+        return indir_blkno_locked(inum, &in->direct[n], 0, 0, alloc, new_blkno);
+    }
+
+    // get entry from single-indirect block
+    n -= N_DIRECT;
+    if (n < PTRS_PER_BLK) {
+        return indir_blkno_locked(inum, &in->indir_1, 1, n, alloc, new_blkno);
+    }
+
+    // get entry from double-indirect block
+    n -= PTRS_PER_BLK;
+    if (n < PTRS_PER_BLK * PTRS_PER_BLK) {
+        return indir_blkno_locked(inum, &in->indir_2, 2, n, alloc, new_blkno);
+    }
+
+#if (FS_VERSION > 4)
+    // get entry from triple-indirect block
+    n -= PTRS_PER_BLK * PTRS_PER_BLK;
+    if (n < (long long)PTRS_PER_BLK * PTRS_PER_BLK * PTRS_PER_BLK) {
+        return indir_blkno_locked(inum, &in->indir_3, 3, n, alloc, new_blkno);
+    }
+#endif  /* FS_VERSION > 4 */
+    return 0;
+}
+
+/**
+ * Returns the block number of the n-th block of the file,
+ * or adds a block if it does not exist and alloc == 1. The
+ * block map cache is locked while the block is mapped, except
+ * while blocks are read, written, or allocated.
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based block index in file
+ * @param alloc 1=allocate block if does not exist 0 = fail
+ *   if does not exist
+ * @param new_blkno an allocated block to add, or 0 to
+ *   allocate a free block
+ * @return block number of the n-th block or 0 if unavailable
+ */
+static int file_blkno(int inum, int n, int alloc, int new_blkno)
+{
+    pthread_mutex_lock(&blkmap_lock);
+    int blkno = file_blkno_locked(inum, n, alloc, new_blkno);
+    pthread_mutex_unlock(&blkmap_lock);
+    return blkno;
+}
+
+/**
+ * Returns the block number of the n-th block of the file,
+ * or allocates it if it does not exist and alloc == 1. If
+ * file was extended, the new block is initialized with 0s.
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based block index in file
+ * @param alloc 1=allocate block if does not exist 0 = fail
+ *   if does not exist
+ * @return block number of the n-th block or 0 if unavailable
+ */
+int get_file_blkno(int inum, int n, int alloc)
+{
+    return file_blkno(inum, n, alloc, 0);
+}
+
+/** Ranges of blocks added to a file by an operation, to free if it fails */
+struct added_blks {
+    /** the first and last block index of each range */
+    struct { int n1, n2; } *r;
+    /** number of ranges */
+    int n;
+};
+
+/**
+ * Records that block n was added to a file, extending the last range
+ * of blocks added if block n follows it.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate range
+ *
+ * @param added the ranges of blocks added
+ * @param n the 0-based index of the block added
+ * @return 0 if successful, or -error number
+ */
+static int add_blk(struct added_blks *added, int n)
+{
+    if (added->n > 0 && added->r[added->n - 1].n2 == n - 1) {
+        added->r[added->n - 1].n2 = n;
+        return 0;
+    }
+    void *p = realloc(added->r, (added->n + 1) * sizeof(*added->r));
+    if (p == NULL) {
+        return -ENOMEM;
+    }
+    added->r = p;
+    added->r[added->n].n1 = added->r[added->n].n2 = n;
+    added->n++;
+    return 0;
+}
+
+/**
+ * Removes the last block recorded by add_blk(), if it could not
+ * be added to the file after all.
+ *
+ * @param added the ranges of blocks added
+ */
+static void remove_last_blk(struct added_blks *added)
+{
+    if (added->r[added->n - 1].n1 == added->r[added->n - 1].n2) {
+        added->n--;
+    } else {
+        added->r[added->n - 1].n2--;
+    }
+}
+
+/** frees blocks of a file; defined with the other functions that free blocks */
+static int free_file_blks(int inum, int n1, int n2);
+
+/**
+ * Frees the blocks added to a file by an operation that failed,
+ * from block index keep on, leaving holes in their place. Blocks
+ * the file had before the operation, such as blocks preallocated
+ * past its end, are kept.
+ *
+ * @param inum the number of file inode
+ * @param added the ranges of blocks added
+ * @param keep the 0-based index of the first block to free
+ */
+static void free_added_blks(int inum, struct added_blks *added, int keep)
+{
+    invalidate_blkmap(inum);
+    for (int i = added->n - 1; i >= 0; i--) {
+        if (added->r[i].n2 >= keep) {
+            free_file_blks(inum, max(added->r[i].n1, keep), added->r[i].n2);
+        }
+    }
+}
+
+/**
+ * Allocates blocks n1 through n2 of a file that extend it past
+ * its current allocated blocks in as few contiguous runs of free
+ * blocks as possible, starting after the last block of the file.
+ * The new blocks are not initialized. Stops without error if
+ * the file system runs out of space; callers that then allocate
+ * the remaining blocks with get_file_blkno() will detect it.
+ *
+ * @param inum the number of file inode
+ * @param n1 the 0-based index of first block to allocate
+ * @param n2 the 0-based index of last block to allocate
+ * @param added records the blocks added
+ */
+static void alloc_file_blks(int inum, int n1, int n2, struct added_blks *added)
+{
+    // skip blocks already allocated to file
+    struct fs_inode *in = &fs.inodes[inum];
+    n1 = max(n1, (get_inode_size(in) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+
+    // prefer run that follows last block of file
+    int goal = (n1 > 0) ? get_file_blkno(inum, n1-1, 0) + 1 : 0;
+    while (n1 <= n2) {
+        int nblks;
+        int blkno = get_free_blks(goal, n2 - n1 + 1, &nblks);
+        if (blkno == 0) {
+            return;  // no space
+        }
+        for (int i = 0; i < nblks; i++, n1++) {
+            if (add_blk(added, n1) < 0) {
+                return_blk(blkno + i);  // cannot record block added
+            } else if (file_blkno(inum, n1, 1, blkno + i) != blkno + i) {
+                remove_last_blk(added);
+                return_blk(blkno + i);  // block already allocated
+            }
+        }
+        goal = blkno + nblks;
+    }
+}
+
+/**
+ * Maps blocks n through n+nblks-1 of the file to runs of contiguous
+ * disk blocks. If alloc == 1, blocks that extend the file are added
+ * in as few runs as possible, and are not initialized, so the caller
+ * must write them in full, and mapping stops at the first block that
+ * is unavailable. If alloc == 0, blocks that do not exist are mapped
+ * to runs with block number 0 for the holes in the file.
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based index of first block
+ * @param nblks the number of blocks to map
+ * @param alloc 1=allocate blocks that do not exist 0 = map
+ *   blocks that do not exist as holes
+ * @param runs storage for up to nblks runs
+ * @return the number of runs
+ */
+int get_file_runs(int inum, int n, int nblks, int alloc, struct file_run *runs)
+{
+    // allocate blocks that extend file by many blocks contiguously
+    if (alloc && nblks > 1) {
+        struct added_blks added = {0};
+        alloc_file_blks(inum, n, n + nblks - 1, &added);
+        free(added.r);
+    }
+
+    int nruns = 0;
+    for (int i = 0; i < nblks; i++) {
+        int blkno = get_file_blkno(inum, n + i, alloc);
+        if (blkno == 0 && alloc) {
+            break;  // no space
+        }
+        int next = (nruns == 0) ? -1 : (runs[nruns-1].blkno == 0) ? 0
+                  : runs[nruns-1].blkno + runs[nruns-1].nblks;
+        if (blkno == next) {
+            runs[nruns-1].nblks++;  // extend run or hole with next block
+        } else {
+            runs[nruns++] = (struct file_run){.blkno = blkno, .nblks = 1};
+        }
+    }
+    return nruns;
+}
+
+/**
+ * Gets the n-th block of the file, or allocates it if it
+ * does not exist and alloc == 1. If file was extended, new
+ * block is initialized with 0s. If block is NULL, equivalent
+ * to get_file_blkno().
+ *
+ * Errors
+ *   -EIO  - error reading block
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based block index in file
+ * @param block storage for the block read
+ * @param alloc 1=allocate block if does not exist 0 = fail
+ *   if does not exist
+ * @return block number of the n-th block, 0 if unavailable,
+ *   or -error number
+ */
+int get_file_blk(int inum, int n, void* block, int alloc) {
+	int blkno = get_file_blkno(inum, n, alloc);
+
+	// read block if found and block storage provided
+	if ((blkno > 0) && (block != NULL)) {
+		if (read_journaled_blk(blkno, block) < 0) {
+			// report error if cannot read block
+			memset(block, 0, FS_BLOCK_SIZE);
+			return -EIO;
+		}
+    }
+
+	return blkno;
+}
+
+/**
+ * Returns 1 if the data of a file is stored inline in its inode
+ * in place of its block pointers.
+ *
+ * @param inum the number of file inode
+ * @return 1 if file data is inline, 0 if stored in blocks
+ */
+int is_inline_file(int inum)
+{
+#if (FS_VERSION > 3)
+    return (fs.inodes[inum].flags & FS_INLINE_DATA) != 0;
+#else
+    return 0;
+#endif  /* FS_VERSION > 3 */
+}
+
+/**
+ * Returns the inline data of a file, stored in place of the
+ * block pointers of the inode, from direct[0] through indir_2.
+ * Bytes past the end of file are 0s.
+ *
+ * @param in the file inode
+ * @return the INLINE_DATA_SIZE bytes of inline data
+ */
+static char *inline_data(struct fs_inode *in)
+{
+    return (char*)in->direct;
+}
+
+/**
+ * Moves the data of a file stored inline in its inode to the
+ * first block of the file, so the file can grow past the size
+ * of the inline data. Has no effect if the file is not inline.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the number of file inode
+ * @return 0 if successful, or -error number
+ */
+int expand_inline_file(int inum)
+{
+    if (!is_inline_file(inum)) {
+        return 0;
+    }
+    struct fs_inode *in = &fs.inodes[inum];
+    char *block = calloc(1, FS_BLOCK_SIZE);
+    if (block == NULL) {
+        return -ENOMEM;
+    }
+    memcpy(block, inline_data(in), INLINE_DATA_SIZE);
+    int blkno = (in->size == 0) ? 0 : get_free_blk();
+    if (blkno == 0 && in->size != 0) {
+        free(block);
+        return -ENOSPC;
+    }
+
+    // clear block pointers, and add block with data
+    memset(inline_data(in), 0, INLINE_DATA_SIZE);
+    in->flags &= ~FS_INLINE_DATA;
+#if (FS_VERSION > 4)
+    // map blocks of file by an extent tree from now on
+    init_extent_root(in);
+#endif  /* FS_VERSION > 4 */
+    mark_inode(inum);
+    if (blkno != 0) {
+        disk->ops->write(disk, blkno, 1, block);
+        file_blkno(inum, 0, 1, blkno);
+    }
+    free(block);
+    return 0;
+}
+
+/**
+ * Read bytes from content of an inode.
+ *
+ * Should return exactly the number of bytes requested, except:
+ *   - if offset >= file len, return 0
+ *   - if offset+len > file len, return bytes from offset to EOF
+ *   - on error, return <0
+ *
+ * Blocks in holes of the file that have not been allocated
+ * read as 0s without any I/O.
+ *
+ * Errors:
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the inumber of inode to truncate
+ * @param buf the read buffer
+ * @param len the number of bytes to read
+ * @param offset to start reading at
+ * @return number of bytes actually read if successful, or -error number
+ */
+int do_read(int inum, char* buf, size_t len, off_t offset) {
+    // get pointer to inode for inum
+    struct fs_inode *in = &fs.inodes[inum];
+
+    // done if offset greater than file size
+    off_t size = get_inode_size(in);
+    if (offset >= size) {
+        return 0;
+    }
+
+    // adjust length to length of file from offset
+    if (size < offset + len) {
+        len = size - offset;
+    }
+
+    // copy data stored inline in inode
+    if (is_inline_file(inum)) {
+        memcpy(buf, inline_data(in) + offset, len);
+        return len;
+    }
+
+    // index of first block
+    int blkindex = offset / FS_BLOCK_SIZE;
+
+    // bounce buffer for partial first and last blocks
+    char* bounce = NULL;
+    if (offset % FS_BLOCK_SIZE != 0 || (offset + len) % FS_BLOCK_SIZE != 0) {
+        if ((bounce = malloc(2 * FS_BLOCK_SIZE)) == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    // read blocks into buf in batches of requests, one
+    // request for each run of contiguous full blocks
+    offset -= (off_t)blkindex * FS_BLOCK_SIZE;
+    int _len = len;
+    while (len > 0) {
+        struct blkdev_req reqs[READ_BATCH];
+        struct { char* dst; char* src; int len; } copies[2];
+        int nreqs = 0, ncopies = 0;
+        int run = 0;  // 1 if last request is a run of full blocks
+
+        while (len > 0) {
+            // get block for block index
+            int blkno = get_file_blkno(inum, blkindex, 0);
+
+            int l = min(FS_BLOCK_SIZE - offset, len);
+            if (blkno == 0) {
+                // block in hole reads as 0s
+                memset(buf, 0, l);
+                run = 0;
+            } else if (run && l == FS_BLOCK_SIZE
+                    && blkno == reqs[nreqs-1].first_blk + reqs[nreqs-1].num_blks) {
+                // extend run with next full block
+                reqs[nreqs-1].num_blks++;
+            } else if (nreqs == READ_BATCH) {
+                break;  // submit batch
+            } else {
+                // read full blocks directly into buf, partial blocks
+                // into bounce buffer to copy after read completes
+                char* dst = buf;
+                run = (l == FS_BLOCK_SIZE);
+                if (!run) {
+                    dst = bounce + ncopies * FS_BLOCK_SIZE;
+                    copies[ncopies].dst = buf;
+                    copies[ncopies].src = &dst[offset];
+                    copies[ncopies].len = l;
+                    ncopies++;
+                }
+                reqs[nreqs++] = (struct blkdev_req){.op = BLKDEV_READ,
+                        .first_blk = blkno, .num_blks = 1, .buf = dst};
+            }
+
+            blkindex++;
+            buf += l;
+            len -= l;
+            offset = 0;
+        }
+
+        // submit block requests and wait for them to complete
+        blkdev_submit(disk, reqs, nreqs);
+        if (blkdev_complete(disk, reqs, nreqs) != SUCCESS) {
+            free(bounce);
+            return -EIO;
+        }
+
+        // copy partial block content to buf
+        for (int i = 0; i < ncopies; i++) {
+            memcpy(copies[i].dst, copies[i].src, copies[i].len);
+        }
+    }
+
+    free(bounce);
+    return _len;
+
+}
+
+/**
+ *  Write bytes of content to an inode.
+ *
+ * It should return exactly the number of bytes requested, except on
+ * error.
+ *
+ * If 'offset' is greater than current file length, the blocks
+ * between the end of file and 'offset' are left unallocated, as
+ * a hole that reads as 0s. Only the blocks written are allocated.
+ *
+ * Errors:
+ *   -ENOSPC  - no space in file sysem
+ *   -EFBIG   - write extends past the maximum file size
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the inumber of inode to truncate
+ * @param buf the buffer to write
+ * @param len the number of bytes to write
+ * @param offset the offset to starting writing at
+ * @return number of bytes actually written if successful, or -error number
+ */
+int do_write(int inum, const char* buf, size_t len, off_t offset) {
+    // get pointer to inode for inum
+    struct fs_inode *in = &fs.inodes[inum];
+
+    // return error code of offset out of range
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (offset + len > max_file_size(inum)) {
+        return -EFBIG;
+    }
+
+    // write data inline in inode if it fits, else move it to a block
+    if (is_inline_file(inum)) {
+        if (offset + len <= INLINE_DATA_SIZE) {
+            memcpy(inline_data(in) + offset, buf, len);
+            in->size = max(in->size, offset + len);
+            in->mtime = time(NULL);  // OK thorough 2100
+            mark_inode(inum);
+            flush_metadata();
+            return len;
+        }
+        int status = expand_inline_file(inum);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    int blkidx1 = offset / FS_BLOCK_SIZE;
+    int blkidx2 = (offset + len - 1) / FS_BLOCK_SIZE;
+
+    // blocks from this index on are past end of file
+    int nalloc = (get_inode_size(in) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+
+    // bounce buffer for partial first and last blocks
+    char* bounce = NULL;
+    if (offset % FS_BLOCK_SIZE != 0 || (offset + len) % FS_BLOCK_SIZE != 0) {
+        if ((bounce = malloc(2 * FS_BLOCK_SIZE)) == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    // allocate blocks that extend file by many blocks contiguously
+    struct added_blks added = {0};
+    if (blkidx2 - blkidx1 > 1) {
+        alloc_file_blks(inum, blkidx1, blkidx2, &added);
+    }
+
+    // write buffer to file blocks in batches of requests, one
+    // request for each run of contiguous full blocks
+    off_t end = offset;  // end of data written to file
+    offset -= (off_t)blkidx1 * FS_BLOCK_SIZE;
+    int _len = len;
+    int blkindex = blkidx1;
+    int status = 0;
+    int nbounce = 0;
+    while (len > 0 && status == 0) {
+        struct blkdev_req reqs[WRITE_BATCH];
+        int nreqs = 0;
+        int run = 0;  // 1 if last request is a run of full blocks
+        size_t batch_len = 0;
+
+        while (len > 0) {
+            // get block, adding one if block is new or in a hole
+            int blkno = get_file_blkno(inum, blkindex, 0);
+            int is_new = (blkno == 0 || blkindex >= nalloc);
+            if (blkno == 0) {
+                int new_blkno = get_free_blk();
+                if (new_blkno != 0 && add_blk(&added, blkindex) < 0) {
+                    return_blk(new_blkno);  // cannot record block added
+                    status = -ENOMEM;
+                    break;
+                }
+                blkno = (new_blkno == 0) ? 0 : file_blkno(inum, blkindex, 1, new_blkno);
+                if (blkno == 0 && new_blkno != 0) {
+                    remove_last_blk(&added);
+                    return_blk(new_blkno);  // no space for indirect block
+                }
+            }
+
+            // stop with error code if out of space
+            if (blkno <= 0) {
+                status = (blkno == 0) ? -ENOSPC : -EIO;
+                break;
+            }
+
+            int l = min(FS_BLOCK_SIZE - offset, len);
+            if (run && l == FS_BLOCK_SIZE
+                    && blkno == reqs[nreqs-1].first_blk + reqs[nreqs-1].num_blks) {
+                // extend run with next full block
+                reqs[nreqs-1].num_blks++;
+            } else if (nreqs == WRITE_BATCH) {
+                break;  // submit batch
+            } else {
+                // write full blocks directly from buf, without reading
+                // them; merge partial blocks with existing content
+                char* src = (char*)buf;
+                run = (l == FS_BLOCK_SIZE);
+                if (!run) {
+                    src = bounce + (nbounce++) * FS_BLOCK_SIZE;
+                    if (is_new) {
+                        memset(src, 0, FS_BLOCK_SIZE);  // new block
+                    } else if (disk->ops->read(disk, blkno, 1, src) < 0) {
+                        status = -EIO;
+                        break;
+                    }
+                    memcpy(src + offset, buf, l);
+                }
+                reqs[nreqs++] = (struct blkdev_req){.op = BLKDEV_WRITE,
+                        .first_blk = blkno, .num_blks = 1, .buf = src};
+            }
+
+            blkindex++;
+            buf += l;
+            len -= l;
+            batch_len += l;
+            offset = 0;
+        }
+
+        // submit block requests and wait for them to complete
+        blkdev_submit(disk, reqs, nreqs);
+        if (blkdev_complete(disk, reqs, nreqs) != SUCCESS) {
+            status = -EIO;
+            break;
+        }
+        end += batch_len;
+    }
+
+    // extend file to end of data written
+    if (end > get_inode_size(in)) {
+        set_inode_size(in, end);
+    }
+    if (status < 0) {
+        // free blocks added past end, keeping blocks allocated before
+        int keep = (get_inode_size(in) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+        free_added_blks(inum, &added, keep);
+    }
+    free(added.r);
+    free(bounce);
+    in->mtime = time(NULL);  // OK thorough 2100
+
+    mark_inode(inum);
+    flush_metadata();
+
+    return (status < 0) ? status : _len - len;
+}
+
+/**
+ * Frees the blocks in entries k1 through k2 of the blocks mapped by
+ * an indirect block, and the indirect blocks below it that no longer
+ * map any blocks. If no entries remain, the indirect block itself is
+ * freed as well and its pointer cleared, otherwise its remaining
+ * entries are written back. The bitmap updates for the data blocks of
+ * each single-indirect block are made in one pass by return_blks(),
+ * and flushed by the caller.
+ *
+ * @param inum the number of file inode
+ * @param blkno pointer to the block number of the indirect block
+ * @param depth the levels of indirect blocks, from this one down
+ * @param k1 index of the first block to free
+ * @param k2 index of the last block to free
+ * @return 0 if successful, or -error number
+ */
+static int free_indir_blks(int inum, uint32_t *blkno, int depth, long long k1, long long k2)
+{
+    uint32_t *ptrs = malloc(FS_BLOCK_SIZE);
+    if (ptrs == NULL) {
+        return -ENOMEM;
+    }
+    if (read_journaled_blk(*blkno, ptrs) < 0) {
+        free(ptrs);
+        return -EIO;
+    }
+    if (depth == 1) {
+        int n = 0;
+        for (long long i = k1; i <= k2; i++) {
+            n += (ptrs[i] != 0);
+        }
+        add_file_blks(inum, -n);
+        return_blks(ptrs + k1, k2 - k1 + 1);
+        memset(ptrs + k1, 0, (k2 - k1 + 1) * sizeof(uint32_t));
+    } else {
+        long long span = PTRS_PER_BLK;  // blocks mapped by each pointer
+        for (int i = 2; i < depth; i++) {
+            span *= PTRS_PER_BLK;
+        }
+        for (int m = k1 / span; m <= k2 / span; m++) {
+            long long i1 = (k1 > m * span) ? k1 - m * span : 0;
+            long long i2 = (k2 < (m + 1) * span - 1) ? k2 - m * span : span - 1;
+            int status;
+            if (ptrs[m] != 0
+                    && (status = free_indir_blks(inum, &ptrs[m], depth - 1, i1, i2)) < 0) {
+                free(ptrs);
+                return status;
+            }
+        }
+    }
+    if (count_ptrs(ptrs) == 0) {
+        add_file_blks(inum, -1);
+        return_blk(*blkno);
+        *blkno = 0;
+    } else {
+        write_journaled_blk(*blkno, ptrs);
+    }
+    free(ptrs);
+    return 0;
+}
+
+/** The extents and tree blocks of an extent tree, in file block order */
+struct extent_list {
+    /** the extents */
+    struct fs_extent *ex;
+    /** number of extents */
+    int nex;
+    /** block numbers of the index and leaf blocks */
+    uint32_t *nodes;
+    /** number of index and leaf blocks */
+    int nnodes;
+};
+
+/**
+ * Appends the extents of an extent tree node of a file, and of the
+ * nodes below it, to a list, and the block numbers of the nodes below
+ * it. Called with the block map cache locked.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate list
+ *   -EIO     - error reading block
+ *
+ * @param inum the number of file inode
+ * @param h a copy of the node
+ * @param list the list to append to
+ * @return 0 if successful, or -error number
+ */
+static int list_extents(int inum, struct fs_extent_header *h, struct extent_list *list)
+{
+    struct fs_extent *ex = node_extents(h);
+    if (h->depth == 0) {
+        void *p = realloc(list->ex, (list->nex + h->count) * sizeof(struct fs_extent));
+        if (p == NULL && h->count > 0) {
+            return -ENOMEM;
+        }
+        list->ex = p;
+        memcpy(list->ex + list->nex, ex, h->count * sizeof(struct fs_extent));
+        list->nex += h->count;
+        return 0;
+    }
+
+    // copy each child, as its cached block may be replaced by the others
+    uint32_t *buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    int status = 0;
+    for (int i = 0; i < h->count && status == 0; i++) {
+        void *p = realloc(list->nodes, (list->nnodes + 1) * sizeof(uint32_t));
+        if (p == NULL) {
+            status = -ENOMEM;
+            break;
+        }
+        list->nodes = p;
+        list->nodes[list->nnodes++] = ex[i].start;
+        struct fs_extent_header *child = get_extent_node(inum, ex[i].start, 0);
+        if (child == NULL || child->depth != h->depth - 1) {
+            status = -EIO;
+            break;
+        }
+        memcpy(buf, child, FS_BLOCK_SIZE);
+        status = list_extents(inum, (void*)buf, list);
+    }
+    free(buf);
+    return status;
+}
+
+/**
+ * Lists the extents and tree blocks of the extent tree of a file.
+ * The caller frees the list.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate list
+ *   -EIO     - error reading block
+ *
+ * @param inum the number of file inode
+ * @param list the list to fill
+ * @return 0 if successful, or -error number
+ */
+static int get_extent_list(int inum, struct extent_list *list)
+{
+    *list = (struct extent_list){0};
+    uint32_t buf[INLINE_DATA_SIZE / sizeof(uint32_t)];
+    struct fs_extent_header *root = (void*)buf;
+    memcpy(root, get_extent_node(inum, 0, 0), INLINE_DATA_SIZE);
+    if (root->magic != FS_EXTENT_MAGIC) {
+        return -EIO;
+    }
+    pthread_mutex_lock(&blkmap_lock);
+    int status = list_extents(inum, root, list);
+    pthread_mutex_unlock(&blkmap_lock);
+    return status;
+}
 
 /**
- * Returns the block number of the n-th block of the file,
- * or allocates it if it does not exist and alloc == 1. If
- * file was extended, the new block is initialized with 0s.
+ * Builds the extent tree of a file from a list of its extents, with
+ * full nodes from the leaves up to the root in the inode. The blocks
+ * of the nodes are taken first from a list of blocks of the old tree,
+ * and the old blocks left over are freed. The blocks are written
+ * directly; the caller invalidates the cached blocks of the file.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block of tree
+ *   -ENOMEM  - cannot allocate buffer
  *
  * @param inum the number of file inode
- * @param n the 0-based block index in file
- * @param alloc 1=allocate block if does not exist 0 = fail
- *   if does not exist
- * @return block number of the n-th block or 0 if unavailable
+ * @param ex the extents, in file block order; replaced by index entries
+ * @param nex the number of extents
+ * @param nodes the blocks of the old tree
+ * @param nnodes the number of blocks of the old tree
+ * @return 0 if successful, or -error number
  */
-int get_file_blkno(int inum, int n, int alloc)
+static int build_extent_tree(int inum, struct fs_extent *ex, int nex,
+                             uint32_t *nodes, int nnodes)
 {
-    uint32_t buf[PTRS_PER_BLK];
+    struct fs_extent_header *h = malloc(FS_BLOCK_SIZE);
+    if (h == NULL) {
+        return -ENOMEM;
+    }
 
-    // get entry from direct blocks
-    struct fs_inode *in = &fs.inodes[inum];
-    if (n < N_DIRECT) {
-        if (in->direct[n] == 0) {
-        	if (alloc == 0) {
-        		return 0;  // not found if no alloc
-        	}
-        	// alloc and add block to inode
-            int blkno = get_free_blk();
-            if (blkno == 0) {  // no space
-            	return 0;
+    // pack entries of each level into blocks, and index the blocks
+    // at the next level, until the entries fit in the root
+    int depth = 0;
+    while (nex > N_ROOT_EXTENTS) {
+        int nblks = (nex + EXTENTS_PER_BLK - 1) / EXTENTS_PER_BLK;
+        for (int k = 0; k < nblks; k++) {
+            int is_new = (nnodes == 0);
+            int blkno = is_new ? get_free_blk() : (int)nodes[--nnodes];
+            if (blkno == 0) {
+                free(h);
+                return -ENOSPC;
             }
-            in->direct[n] = blkno;
-            mark_inode(inum);
-            disk->ops->write(disk, in->direct[n], 1, zeros);
+            add_file_blks(inum, is_new);
+            int count = min(nex - k * EXTENTS_PER_BLK, EXTENTS_PER_BLK);
+            memset(h, 0, FS_BLOCK_SIZE);
+            *h = (struct fs_extent_header){.magic = FS_EXTENT_MAGIC,
+                    .count = count, .max = EXTENTS_PER_BLK, .depth = depth};
+            memcpy(node_extents(h), &ex[k * EXTENTS_PER_BLK], count * sizeof(struct fs_extent));
+            write_journaled_blk(blkno, h);
+            // entry k of the level above replaces entries already packed
+            ex[k] = (struct fs_extent){.block = node_extents(h)[0].block,
+                    .start = blkno, .len = 0};
         }
-        return in->direct[n];
+        nex = nblks;
+        depth++;
     }
+    free(h);
 
-    // get entry from single-indirect block
-    n -= N_DIRECT;
-    if (n < PTRS_PER_BLK) {
-        if (in->indir_1 == 0) {
-        	if (alloc == 0) { // not found if no alloc
-        		return 0;
-        	}
-        	// add single-indirect block
-            int blkno = get_free_blk();
-            if (blkno == 0) {  // no space
-            	return 0;
-            }
-            in->indir_1 = blkno;
-            mark_inode(inum);
-            disk->ops->write(disk, in->indir_1, 1, zeros);
-        }
-        disk->ops->read(disk, in->indir_1, 1, buf);
-        if (buf[n] == 0) {
-        	if (alloc == 0) {
-        		return 0;
-        	}
-        	// extend single-indirect block
-            int blkno = get_free_blk();
-            if (blkno == 0) {  // no space
-            	return 0;
-            }
-            buf[n] = blkno;
-            disk->ops->write(disk, in->indir_1, 1, buf);
+    struct fs_inode *in = &fs.inodes[inum];
+    init_extent_root(in);
+    h = get_extent_node(inum, 0, 0);
+    h->count = nex;
+    h->depth = depth;
+    memcpy(node_extents(h), ex, nex * sizeof(struct fs_extent));
+    add_file_blks(inum, -nnodes);
+    return_blks(nodes, nnodes);
+    return 0;
+}
+
+/**
+ * Frees blocks n1 through n2 of a file mapped by an extent tree. The
+ * extents are trimmed, or split if the range is in the middle of one,
+ * and the tree is rebuilt from the extents that remain, reusing its
+ * blocks. Each run of freed blocks is returned in one pass. Fails
+ * without freeing any blocks if the rebuilt tree may not fit.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block of tree
+ *   -ENOMEM  - cannot allocate list
+ *   -EIO     - error reading block
+ *
+ * @param inum the number of file inode
+ * @param n1 the 0-based index of first block to free
+ * @param n2 the 0-based index of last block to free
+ * @return 0 if successful, or -error number
+ */
+static int free_extent_blks(int inum, int n1, int n2)
+{
+    struct extent_list list;
+    int status = get_extent_list(inum, &list);
+    struct fs_extent *ex = (status == 0)
+            ? malloc((list.nex + 1) * sizeof(struct fs_extent)) : NULL;
+    if (ex == NULL) {
+        free(list.ex);
+        free(list.nodes);
+        return (status < 0) ? status : -ENOMEM;
+    }
+
+    // keep the parts of extents before and after the range
+    int nex = 0;
+    for (int i = 0; i < list.nex; i++) {
+        struct fs_extent *e = &list.ex[i];
+        long long first = e->block, last = first + e->len - 1;
+        if (last < n1 || first > n2) {
+            ex[nex++] = *e;
+            continue;
+        }
+        if (first < n1) {
+            ex[nex++] = (struct fs_extent){.block = first, .start = e->start,
+                    .len = n1 - first};
+        }
+        if (last > n2) {
+            ex[nex++] = (struct fs_extent){.block = n2 + 1,
+                    .start = e->start + (n2 + 1 - first), .len = last - n2};
         }
-        return buf[n];
     }
 
-    // get entry for indirect blocks
-    n -= PTRS_PER_BLK;
-    if (n > PTRS_PER_BLK * PTRS_PER_BLK) {
-        return 0;
+    // blocks for a tree of the extents, beyond those of the old tree
+    int nblks = 0;
+    for (int n = nex; n > N_ROOT_EXTENTS; ) {
+        n = (n + EXTENTS_PER_BLK - 1) / EXTENTS_PER_BLK;
+        nblks += n;
     }
-    int m = n / PTRS_PER_BLK;
-    int k = n - m * PTRS_PER_BLK;
-    if (in->indir_2 == 0) {
-    	if (alloc == 0) {  // not found of no alloc
-    		return 0;
-    	}
-        int blkno = get_free_blk();
-        if (blkno == 0) {  // no space
-        	return 0;
-        }
-        in->indir_2 = blkno;
-        mark_inode(inum);
-        disk->ops->write(disk, in->indir_2, 1, zeros);
+    if (nblks > list.nnodes && nblks - list.nnodes > fs.n_blocks_free) {
+        status = -ENOSPC;
+    } else {
+        // free blocks in range, then rebuild tree
+        for (int i = 0; i < list.nex; i++) {
+            struct fs_extent *e = &list.ex[i];
+            long long first = max(e->block, n1), last = min(e->block + e->len - 1, n2);
+            if (first <= last) {
+                add_file_blks(inum, -(last - first + 1));
+                return_blk_run(e->start + (first - e->block), last - first + 1);
+            }
+        }
+        status = build_extent_tree(inum, ex, nex, list.nodes, list.nnodes);
+        invalidate_blkmap(inum);
+    }
+    free(ex);
+    free(list.ex);
+    free(list.nodes);
+    return status;
+}
+
+/**
+ * Frees blocks n1 through n2 of a file, including the indirect blocks
+ * or extent tree blocks that no longer map any blocks, leaving a hole
+ * in their place. The caller invalidates the cached indirect blocks
+ * of the file, and marks the inode and flushes the metadata once.
+ *
+ * @param inum the number of file inode
+ * @param n1 the 0-based index of first block to free
+ * @param n2 the 0-based index of last block to free
+ * @return 0 if successful, or -error number
+ */
+static int free_file_blks(int inum, int n1, int n2)
+{
+    struct fs_inode *in = &fs.inodes[inum];
+    n2 = min(n2, max_file_blks(inum) - 1);
+    if (is_extent_file(inum)) {
+        return (n1 <= n2) ? free_extent_blks(inum, n1, n2) : 0;
     }
 
-    // get double-indirect block
-    disk->ops->read(disk, in->indir_2, 1, buf);
-    if (buf[m] == 0) {
-    	if (alloc == 0) {
-    		return 0;
-    	}
-    	// add double-indirect block with new free block
-        int blkno = get_free_blk();
-        if (blkno == 0) {  // no space
-        	return 0;
+    /* free direct blocks in range */
+    if (n1 < N_DIRECT) {
+        int n = min(n2 + 1, N_DIRECT) - n1;
+        int nfreed = 0;
+        for (int i = n1; i < n1 + n; i++) {
+            nfreed += (in->direct[i] != 0);
         }
-        buf[m] = blkno;
-        disk->ops->write(disk, in->indir_2, 1, buf);
-        disk->ops->write(disk, buf[m], 1, zeros);
+        add_file_blks(inum, -nfreed);
+        return_blks(in->direct + n1, n);
+        memset(in->direct + n1, 0, n * sizeof(uint32_t));
     }
 
-    // get single-indirect block from double-indirect
-    int buf_m = buf[m];
-    disk->ops->read(disk, buf_m, 1, buf);
-    if (buf[k] == 0) {
-    	if (alloc == 0) {  // not found if no alloc
-    		return 0;
-    	}
-    	// add single-indirect block with new free block
-        int blkno = get_free_blk();
-        if (blkno == 0) {  // no space
-        	return 0;
+    /* free blocks of single, double, and triple indirect blocks in range */
+    uint32_t *roots[] = {&in->indir_1, &in->indir_2, &in->indir_3};
+    long long base = N_DIRECT;     // first block mapped by root
+    long long span = PTRS_PER_BLK; // blocks mapped by root
+    for (int depth = 1; depth <= 3; depth++) {
+        if (*roots[depth-1] != 0 && n1 < base + span && n2 >= base) {
+            long long k1 = (n1 > base) ? n1 - base : 0;
+            long long k2 = (n2 < base + span - 1) ? n2 - base : span - 1;
+            int status = free_indir_blks(inum, roots[depth-1], depth, k1, k2);
+            if (status < 0) {
+                return status;
+            }
         }
-        buf[k] = blkno;
-        disk->ops->write(disk, buf_m, 1, buf);
-        disk->ops->write(disk, buf[k], 1, zeros);
+        base += span;
+        span *= PTRS_PER_BLK;
     }
-    return buf[k];
+    return 0;
 }
 
 /**
- * Gets the n-th block of the file, or allocates it if it
- * does not exist and alloc == 1. If file was extended, new
- * block is initialized with 0s. If block is NULL, equivalent
- * to get_file_blkno().
- *
- * Errors
- *   -EIO  - error reading block
+ * Writes 0s to len bytes at offset off of the n-th block of a file,
+ * if the block is allocated.
  *
  * @param inum the number of file inode
  * @param n the 0-based block index in file
- * @param block storage for the block read
- * @param alloc 1=allocate block if does not exist 0 = fail
- *   if does not exist
- * @return block number of the n-th block, 0 if unavailable,
- *   or -error number
+ * @param off the offset in the block
+ * @param len the number of bytes to zero
+ * @return 0 if successful, or -error number
  */
-int get_file_blk(int inum, int n, void* block, int alloc) {
-	int blkno = get_file_blkno(inum, n, alloc);
-
-	// read block if found and block storage provided
-	if ((blkno > 0) && (block != NULL)) {
-		if (disk->ops->read(disk, blkno, 1, block) < 0) {
-			// report error if cannot read block
-			memset(block, 0, FS_BLOCK_SIZE);
-			return -EIO;
-		}
+static int zero_file_blk(int inum, int n, int off, int len)
+{
+    char *block = malloc(FS_BLOCK_SIZE);
+    if (block == NULL) {
+        return -ENOMEM;
     }
-
-	return blkno;
+    int blkno = get_file_blk(inum, n, block, 0);
+    if (blkno > 0) {
+        memset(block + off, 0, len);
+        disk->ops->write(disk, blkno, 1, block);
+    }
+    free(block);
+    return min(blkno, 0);
 }
 
 /**
- * Read bytes from content of an inode.
- *
- * Should return exactly the number of bytes requested, except:
- *   - if offset >= file len, return 0
- *   - if offset+len > file len, return bytes from offset to EOF
- *   - on error, return <0
+ * Truncate file specified by inode to exactly len bytes.
+ * If the file is shortened, blocks past the new end of file,
+ * including indirect blocks that no longer map any blocks, are
+ * freed in one pass, and the remainder of the last block is
+ * zeroed. If the file is extended, no blocks are allocated, and
+ * the new content is a hole that reads as 0s. A regular file that
+ * is truncated to at most INLINE_DATA_SIZE bytes stores its data
+ * inline in its inode. The caller marks the inode and flushes the
+ * metadata once.
  *
- * Errors:
+ * Errors
+ *   -EINVAL  - invalid length argument
+ *   -EFBIG   - length greater than the maximum file size
+ *   -ENOSPC  - no space to move inline data to a block
  *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *
  * @param inum the inumber of inode to truncate
- * @param buf the read buffer
- * @param len the number of bytes to read
- * @param offset to start reading at
- * @return number of bytes actually read if successful, or -error number
+ * @param len new length of file
+ * @return 0 if successful, or -error number
  */
-int do_read(int inum, char* buf, size_t len, off_t offset) {
-    // get pointer to inode for inum
-    struct fs_inode *in = &fs.inodes[inum];
-
-    // done if offset greater than file size
-    if (offset >= in->size) {
-        return 0;
+int do_truncate(int inum, off_t len)
+{
+    if (len < 0) {
+    	return -EINVAL;		/* invalid argument */
     }
-
-    // adjust length to length of file from offset
-    if (in->size < offset + len) {
-        len = in->size - offset;
+    if (len > max_file_size(inum)) {
+        return -EFBIG;
     }
 
-    // index of first block
-    int blkidx1 = offset / FS_BLOCK_SIZE;
-    int blkidx2 = (offset + len) / FS_BLOCK_SIZE;
-
-    // read blocks into buf
-    offset -= blkidx1 * FS_BLOCK_SIZE;
-    int _len = len;
-    for (int blkindex = blkidx1; blkindex <= blkidx2; blkindex++) {
-    	// get block for block index
-        char blk[FS_BLOCK_SIZE];
-        int blkno = get_file_blk(inum, blkindex, blk, 0);
-
-        // report error if not found
-        if (blkno <= 0) {
-            return -EIO;
+    /// get inode for inum
+    struct fs_inode *in = &fs.inodes[inum];
+    int status;
+
+#if (FS_VERSION > 3)
+    if (is_inline_file(inum)) {
+        // zero inline data past new end of file
+        if (len <= INLINE_DATA_SIZE) {
+            if (len < in->size) {
+                memset(inline_data(in) + len, 0, INLINE_DATA_SIZE - len);
+            }
+            set_inode_size(in, len);
+            in->mtime = time(NULL);  // OK thorough 2100
+            return 0;
+        }
+        if ((status = expand_inline_file(inum)) < 0) {
+            return status;
         }
+    } else if (S_ISREG(in->mode) && len <= INLINE_DATA_SIZE) {
+        // move data to inline data, and free all blocks
+        char data[INLINE_DATA_SIZE] = {0};
+        if ((status = do_read(inum, data, len, 0)) < 0) {
+            return status;
+        }
+        invalidate_blkmap(inum);
+        if ((status = free_file_blks(inum, 0, INT_MAX)) < 0) {
+            return status;
+        }
+        memcpy(inline_data(in), data, INLINE_DATA_SIZE);
+        in->flags = (in->flags & ~FS_EXTENTS) | FS_INLINE_DATA;
+        set_inode_size(in, len);
+        in->mtime = time(NULL);  // OK thorough 2100
+        return 0;
+    }
+#endif  /* FS_VERSION > 3 */
 
-        // copy block content to buf
-        int l = min(FS_BLOCK_SIZE - offset, len);
-        memcpy(buf, &blk[offset], l);
+    // cached indirect blocks are freed or changed
+    invalidate_blkmap(inum);
 
-        buf += l;
-        len -= l;
-        offset = 0;
+    // free blocks past last block kept
+    int nblks = (len + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    status = free_file_blks(inum, nblks, INT_MAX);
+    if (status < 0) {
+        return status;
     }
 
-    return _len;
+    // zero remainder of last block, so extending file exposes 0s
+    int off = len % FS_BLOCK_SIZE;
+    if (off != 0 && (status = zero_file_blk(inum, nblks - 1, off, FS_BLOCK_SIZE - off)) < 0) {
+        return status;
+    }
+
+    // reset inode size and modification time
+    set_inode_size(in, len);
+    in->mtime = time(NULL);  // OK thorough 2100
 
+    return 0;
 }
 
 /**
- *  Write bytes of content to an inode.
+ * Allocates the blocks in holes of a file from block n1 through n2
+ * in as few contiguous runs of free blocks as possible, each starting
+ * after the block that precedes it in the file, and initializes them
+ * with 0s. If it fails, the blocks it added are freed again.
  *
- * It should return exactly the number of bytes requested, except on
- * error.
- *
- * Errors:
- *   -ENOSPC  - no space in file sysem
- *   -EINVAL  - if 'offset' is greater than current file length.
- *  			(POSIX semantics support the creation of files with
- *  			"holes" in them, but we don't)
+ * Errors
+ *   -ENOSPC  - no space in file system
+ *   -ENOMEM  - cannot allocate buffer
  *
- * @param inum the inumber of inode to truncate
- * @param buf the buffer to write
- * @param len the number of bytes to write
- * @param offset the offset to starting writing at
- * @return number of bytes actually written if successful, or -error number
+ * @param inum the number of file inode
+ * @param n1 the 0-based index of first block to allocate
+ * @param n2 the 0-based index of last block to allocate
+ * @return 0 if successful, or -error number
  */
-int do_write(int inum, const char* buf, size_t len, off_t offset) {
-    // get pointer to inode for inum
-    struct fs_inode *in = &fs.inodes[inum];
-
-    // return error code of offset out of range
-    if (offset > in->size) {
-        return -EINVAL;
+static int prealloc_file_blks(int inum, int n1, int n2)
+{
+    char *zbuf = calloc(WRITE_BATCH, FS_BLOCK_SIZE);
+    if (zbuf == NULL) {
+        return -ENOMEM;
     }
-
-    int blkidx1 = offset / FS_BLOCK_SIZE;
-    int blkidx2 = (offset + len) / FS_BLOCK_SIZE;
-
-    // write buffer to file blocks
-    offset -= blkidx1 * FS_BLOCK_SIZE;
-    int _len = len;
-    for (int blkindex = blkidx1; blkindex <= blkidx2; blkindex++) {
-    	// get block
-        char blk[FS_BLOCK_SIZE];
-    	int blkno = get_file_blk(inum, blkindex, blk, 1);
-
-    	// return error code if error or out of space
-    	if (blkno <= 0) {
-            mark_inode(inum);
-            flush_metadata();
-            return (blkno == 0) ? -ENOSPC : blkno;
+    struct added_blks added = {0};
+    int status = 0;
+    int goal = (n1 > 0) ? get_file_blkno(inum, n1-1, 0) + 1 : 0;
+    while (n1 <= n2 && status == 0) {
+        // skip allocated blocks, to start of next hole
+        int blkno = get_file_blkno(inum, n1, 0);
+        if (blkno != 0) {
+            goal = blkno + 1;
+            n1++;
+            continue;
+        }
+        int nhole = 1;
+        while (n1 + nhole <= n2 && get_file_blkno(inum, n1 + nhole, 0) == 0) {
+            nhole++;
         }
 
-        // copy more buffer fuse_parser_data to block
-        int l = min(FS_BLOCK_SIZE - offset, len);
-        memcpy(&blk[offset], buf, l);
-
-        // write block back to disk
-        disk->ops->write(disk, blkno, 1, blk);
-        buf += l;
-        len -= l;
-        offset = 0;
-        in->size += l;
-        in->mtime = time(NULL);  // OK thorough 2100
+        // fill hole with runs of free blocks
+        while (nhole > 0 && status == 0) {
+            int nblks;
+            blkno = get_free_blks(goal, nhole, &nblks);
+            if (blkno == 0) {
+                status = -ENOSPC;
+                break;
+            }
+            for (int i = 0; i < nblks; i += WRITE_BATCH) {
+                disk->ops->write(disk, blkno + i, min(nblks - i, WRITE_BATCH), zbuf);
+            }
+            for (int i = 0; i < nblks; i++) {
+                if (status < 0 || (status = add_blk(&added, n1 + i)) < 0) {
+                    return_blk(blkno + i);  // cannot record block added
+                } else if (file_blkno(inum, n1 + i, 1, blkno + i) != blkno + i) {
+                    remove_last_blk(&added);
+                    return_blk(blkno + i);
+                    status = -ENOSPC;  // no space for indirect block
+                }
+            }
+            n1 += nblks;
+            nhole -= nblks;
+            goal = blkno + nblks;
+        }
     }
 
-    mark_inode(inum);
-    flush_metadata();
-
-    return _len - len;
+    // free only the blocks added, keeping blocks allocated before
+    if (status < 0) {
+        free_added_blks(inum, &added, 0);
+    }
+    free(added.r);
+    free(zbuf);
+    return status;
 }
 
 /**
- * Truncate fuse_parser_data specified by inode.
- * Currently only length 0 is supported.
+ * Allocates or deallocates space for a byte range of a file.
+ *
+ * If mode is 0, the blocks in holes of the range are allocated in
+ * as few contiguous runs as possible and filled with 0s, so later
+ * writes to the range do not allocate blocks, and the file is extended
+ * to the end of the range. With FALLOC_FL_KEEP_SIZE, the blocks are
+ * allocated but the file size does not change. With
+ * FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, the range is zeroed,
+ * and its full blocks are freed, leaving a hole, including blocks
+ * preallocated past the end of the file. If allocation fails, only
+ * the blocks it added are freed. The caller marks the inode and
+ * flushes the metadata.
  *
  * Errors
- *   -EINVAL  - invalid length argument
+ *   -EINVAL      - invalid offset or length
+ *   -EOPNOTSUPP  - mode not supported
+ *   -EFBIG       - range extends past the maximum file size
+ *   -ENOSPC      - no space in file system
+ *   -ENOMEM      - cannot allocate buffer
+ *   -EIO         - error reading block
  *
- * @param inum the inumber of inode to truncate
- * @param len new length of file -- currently only 0 allowed
+ * @param inum the inumber of inode
+ * @param mode 0, or the FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE flags
+ * @param offset the offset of the range
+ * @param len the length of the range
  * @return 0 if successful, or -error number
  */
-int do_truncate(int inum, int len)
+int do_fallocate(int inum, int mode, off_t offset, off_t len)
 {
-    if (len != 0) {
-    	return -EINVAL;		/* invalid argument */
+    if (offset < 0 || len <= 0) {
+        return -EINVAL;
+    }
+    if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0
+            || mode == FALLOC_FL_PUNCH_HOLE) {
+        return -EOPNOTSUPP;  // punching hole must keep size
     }
 
-    /// get inode for inum
     struct fs_inode *in = &fs.inodes[inum];
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        // range within the blocks the file can have, including
+        // blocks preallocated past its end with FALLOC_FL_KEEP_SIZE
+        off_t max_end = is_inline_file(inum) ? INLINE_DATA_SIZE : max_file_size(inum);
+        off_t end = (len < max_end - offset) ? offset + len : max_end;
+        if (offset >= end) {
+            return 0;
+        }
 
-	uint32_t buf[PTRS_PER_BLK], buf1[PTRS_PER_BLK];
-    int i, j;
-
-    /* unlink double indirect nodes */
-    if (in->indir_2) {
-        disk->ops->read(disk, in->indir_2, 1, buf);
-        for (i = 0; i < PTRS_PER_BLK; i++) {
-            if (buf[i] != 0) {  // block allocated
-                disk->ops->read(disk, buf[i], 1, buf1);
-                for (j = 0; j < PTRS_PER_BLK; j++) {
-                    if (buf1[j] != 0) { // block allocated
-                        return_blk(buf1[j]);  // free block
-                    }
-                }
-                return_blk(buf[i]);  // return head block
-            }
+        // zero range of inline data
+        if (is_inline_file(inum)) {
+            memset(inline_data(in) + offset, 0, end - offset);
+            in->mtime = time(NULL);  // OK thorough 2100
+            return 0;
         }
-        return_blk(in->indir_2); // free head block
-        in->indir_2 = 0;
-    }
 
-    /* unlink single indirect nodes */
-    if (in->indir_1) {
-        disk->ops->read(disk, in->indir_1, 1, buf);
-        for (i = 0; i < PTRS_PER_BLK; i++) {
-            if (buf[i] != 0) {
-                return_blk(buf[i]);  // free head block
+        // zero partial first and last blocks
+        int status;
+        int n1 = offset / FS_BLOCK_SIZE, n2 = (end - 1) / FS_BLOCK_SIZE;
+        int off1 = offset % FS_BLOCK_SIZE, off2 = end - (off_t)n2 * FS_BLOCK_SIZE;
+        if (n1 == n2 && (off1 != 0 || off2 != FS_BLOCK_SIZE)) {
+            status = zero_file_blk(inum, n1, off1, off2 - off1);
+            n1++;  // no full blocks
+        } else {
+            status = 0;
+            if (off1 != 0) {
+                status = zero_file_blk(inum, n1++, off1, FS_BLOCK_SIZE - off1);
+            }
+            if (status == 0 && off2 != FS_BLOCK_SIZE) {
+                status = zero_file_blk(inum, n2--, 0, off2);
             }
         }
-        return_blk(in->indir_1);
-        in->indir_1 = 0;
-    }
 
-    /* unlink direct nodes */
-    for (i = 0; i < N_DIRECT; i++) {
-        if (in->direct[i] != 0) {
-            return_blk(in->direct[i]);  // free direct blocks
-            in->direct[i] = 0;
+        // free full blocks
+        if (status == 0 && n1 <= n2) {
+            invalidate_blkmap(inum);
+            status = free_file_blks(inum, n1, n2);
         }
+        in->mtime = time(NULL);  // OK thorough 2100
+        return status;
     }
 
-    // reset inode size and modification time
-    in->size = 0;
-    in->mtime = time(NULL);  // OK thorough 2100
+    if (offset + len > max_file_size(inum)) {
+        return -EFBIG;
+    }
 
-    return 0;
+    // inline data needs no blocks if range fits
+    int status = 0;
+    if (is_inline_file(inum) && offset + len <= INLINE_DATA_SIZE) {
+        if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + len > in->size) {
+            set_inode_size(in, offset + len);
+            in->mtime = time(NULL);  // OK thorough 2100
+        }
+        return 0;
+    }
+    if ((status = expand_inline_file(inum)) < 0) {
+        return status;
+    }
+    status = prealloc_file_blks(inum, offset / FS_BLOCK_SIZE,
+                                    (offset + len - 1) / FS_BLOCK_SIZE);
+    if (status == 0 && !(mode & FALLOC_FL_KEEP_SIZE) && offset + len > get_inode_size(in)) {
+        set_inode_size(in, offset + len);
+        in->mtime = time(NULL);  // OK thorough 2100
+    }
+    return status;
 }
 
 /**
@@ -387,6 +1939,8 @@ int do_truncate(int inum, int len)
  *   -ENOTDIR  - component of source or target path not a directory
  *   -EEXIST   - destination already exists
  *   -EINVAL   - source and destination not in the same directory
+ *   -ENOSPC   - no space for entry with new name
+ *   -ENOMEM   - cannot allocate block buffers
  *
  * @param src_path the source path
  * @param dst_path the destination path.
@@ -403,29 +1957,50 @@ int do_rename(int srcdir_inum, const char* src_leaf,
     /* get source/target directory inode */
     struct fs_inode *din = &fs.inodes[srcdir_inum];
 
+    /* block buffers for source and target directory entries */
+    struct fs_dirent *s_de = malloc(FS_BLOCK_SIZE);
+    struct fs_dirent *t_de = malloc(FS_BLOCK_SIZE);
+    if (s_de == NULL || t_de == NULL) {
+        free(s_de);
+        free(t_de);
+        return -ENOMEM;
+    }
+
     /* find source directory entry */
     int s_blkno;
-    struct fs_dirent s_de[DIRENTS_PER_BLK];
     int s_dirno = get_dir_entry_block(srcdir_inum, s_de, &s_blkno, src_leaf);
-    if (s_dirno < 0) {
-        return -ENOENT;  // source does not exist
-    }
 
     /* ensure target directory entry does not exist */
     int t_blkno;
-    struct fs_dirent t_de[DIRENTS_PER_BLK];
-    int t_dirno = get_dir_entry_block(dstdir_inum, t_de, &t_blkno, dst_leaf);
-    if (t_dirno >= 0) {
-        return -EEXIST;  // destination entry already exists
+    int t_dirno = (s_dirno < 0) ? -ENOENT
+                : get_dir_entry_block(dstdir_inum, t_de, &t_blkno, dst_leaf);
+
+    int status = (s_dirno < 0) ? -ENOENT  // source does not exist
+               : (t_dirno >= 0) ? -EEXIST  // destination entry already exists
+               : 0;
+    if (status == 0) {
+#if (FS_VERSION > 2)
+        // move entry to the directory block for its new name
+        status = move_dir_entry(srcdir_inum, src_leaf, dst_leaf);
+#else
+        // update directory entry
+        // truncates leaf at FS_FILENAME_SIZE-1, then '\0'
+        strncpy(s_de[s_dirno].name, dst_leaf, FS_FILENAME_SIZE-1);
+        write_journaled_blk(s_blkno, s_de);
+#endif  /* FS_VERSION > 2 */
+    }
+    free(s_de);
+    free(t_de);
+    if (status < 0) {
+        return status;
     }
-
-    // update directory entry
-    // truncates leaf at FS_FILENAME_SIZE-1, then '\0'
-    strncpy(s_de[s_dirno].name, dst_leaf, FS_FILENAME_SIZE-1);
-    disk->ops->write(disk, s_blkno, 1, s_de);
     din->mtime = time(NULL);  // reset modification time
     // OK thorough 2100
 
+    // remove cached lookups of old and new names
+    dcache_remove(srcdir_inum, src_leaf);
+    dcache_remove(dstdir_inum, dst_leaf);
+
     // mark directory inode block dirty and flush to disk
     mark_inode(srcdir_inum);
     flush_metadata();
@@ -434,7 +2009,117 @@ int do_rename(int srcdir_inum, const char* src_leaf,
 }
 
 /**
- * Fill in a stat structure for an inode.
+ * Returns the number of blocks mapped by an indirect block, including
+ * the indirect blocks below it. Called with the block map cache locked.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the number of file inode
+ * @param blkno the block number of the indirect block
+ * @param depth the levels of indirect blocks, from this one down
+ * @return the number of blocks, or -error number
+ */
+static int count_indir_blks(int inum, int blkno, int depth)
+{
+    uint32_t *ptrs = get_blkmap(inum, blkno, 0);
+    if (depth == 1) {
+        return count_ptrs(ptrs);
+    }
+
+    // copy pointers, as their entry may be replaced by the others
+    uint32_t *ptrs2 = malloc(FS_BLOCK_SIZE);
+    if (ptrs2 == NULL) {
+        return -ENOMEM;
+    }
+    memcpy(ptrs2, (ptrs != NULL) ? (void*)ptrs : zeros, FS_BLOCK_SIZE);
+    int nblks = 0;
+    for (int m = 0; m < PTRS_PER_BLK && nblks >= 0; m++) {
+        if (ptrs2[m] != 0) {
+            int n = count_indir_blks(inum, ptrs2[m], depth - 1);
+            nblks = (n < 0) ? n : nblks + 1 + n;
+        }
+    }
+    free(ptrs2);
+    return nblks;
+}
+
+/**
+ * Counts the blocks allocated to a file, including its indirect
+ * blocks or extent tree blocks. Blocks in holes of the file are
+ * not counted, and a file with inline data has no blocks.
+ *
+ * Errors
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the number of file inode
+ * @return the number of blocks allocated to the file, or -error number
+ */
+static int count_file_blks(int inum)
+{
+    struct fs_inode *in = &fs.inodes[inum];
+    int nblks = 0;
+    if (is_inline_file(inum)) {
+        return 0;  // no blocks for inline data
+    }
+    if (is_extent_file(inum)) {
+        struct extent_list list;
+        if (get_extent_list(inum, &list) == 0) {
+            nblks = list.nnodes;
+            for (int i = 0; i < list.nex; i++) {
+                nblks += list.ex[i].len;
+            }
+        }
+        free(list.ex);
+        free(list.nodes);
+        return nblks;
+    }
+    for (int i = 0; i < N_DIRECT; i++) {
+        nblks += (in->direct[i] != 0);
+    }
+
+    pthread_mutex_lock(&blkmap_lock);
+    uint32_t roots[] = {in->indir_1, in->indir_2, in->indir_3};
+    for (int depth = 1; depth <= 3 && nblks >= 0; depth++) {
+        if (roots[depth-1] != 0) {
+            int n = count_indir_blks(inum, roots[depth-1], depth);
+            nblks = (n < 0) ? n : nblks + 1 + n;
+        }
+    }
+    pthread_mutex_unlock(&blkmap_lock);
+    return nblks;
+}
+
+/**
+ * Returns the number of blocks allocated to a file. The blocks are
+ * counted when first needed after the volume is mounted, and the
+ * count is then kept as blocks are added to and freed from the file.
+ * Called with the inode locked, so blocks are not added or freed
+ * while they are counted. If the blocks cannot be counted, 0 is
+ * returned, and they are counted again when next needed.
+ *
+ * @param inum the number of file inode
+ * @return the number of blocks allocated to the file
+ */
+static int get_file_blks(int inum)
+{
+    pthread_mutex_lock(&nblks_lock);
+    int nblks = fs.inode_nblks[inum];
+    pthread_mutex_unlock(&nblks_lock);
+    if (nblks < 0) {
+        nblks = count_file_blks(inum);
+        if (nblks < 0) {
+            return 0;
+        }
+        pthread_mutex_lock(&nblks_lock);
+        fs.inode_nblks[inum] = nblks;
+        pthread_mutex_unlock(&nblks_lock);
+    }
+    return nblks;
+}
+
+/**
+ * Fill in a stat structure for an inode. Called with the inode locked.
  *
  * @param inum inode number
  * @param sb pointer to stat structure
@@ -449,9 +2134,9 @@ void do_stat(int inum, struct stat *sb)
     sb->st_nlink = in->nlink;
     sb->st_uid = in->uid;
     sb->st_gid = in->gid;
-    sb->st_size = in->size;
-    // number of 512-byte blocks rounded up to nearest block
-    sb->st_blocks =  (in->size + 512 - 1) / 512;
+    sb->st_size = get_inode_size(in);
+    // number of 512-byte blocks allocated to file
+    sb->st_blocks = (blkcnt_t)get_file_blks(inum) * (FS_BLOCK_SIZE / 512);
     sb->st_atime = sb->st_mtime = in->mtime;
     sb->st_ctime = in->ctime;
 }
@@ -477,8 +2162,17 @@ int init_new_inode(mode_t mode, unsigned ftype) {
     // set S_IFMT field with specified ftype value
     in->mode = ((mode & ~S_IFMT) | (ftype & S_IFMT));
     in->ctime = in->mtime = time(NULL);  // OK thorough 2100
-    in->size = 0;
+    set_inode_size(in, 0);
     in->nlink = 0;
+    pthread_mutex_lock(&nblks_lock);
+    fs.inode_nblks[inum] = 0;  // new inode has no blocks
+    pthread_mutex_unlock(&nblks_lock);
+#if (FS_VERSION > 3)
+    // regular file data is inline until file grows
+    in->flags = S_ISREG(in->mode) ? FS_INLINE_DATA : 0;
+#else
+    in->flags = 0;
+#endif  /* FS_VERSION > 3 */
     struct fuse_context *ctx = fuse_get_context();
     in->uid = (ctx->pid == 0) ? getuid() : ctx->uid;
     in->gid = (ctx->pid == 0) ? getgid() : ctx->gid;
@@ -498,6 +2192,7 @@ int init_new_inode(mode_t mode, unsigned ftype) {
  *   -EEXIST   - directory already exists
  *   -ENOSPC   - free inode not available
  *   -ENOSPC   - results in >32 entries in directory
+ *   -ENOMEM   - cannot allocate block buffer
  *
  * @param dir_inum the inum of the directory inode
  * @param leaf the leaf name in the inode directory
@@ -515,20 +2210,26 @@ int do_mkentry(int dir_inum, const char* leaf, mode_t mode, unsigned ftype)
 
     // make sure entry does not exist in directory
     int blkno;
-    char buf[FS_BLOCK_SIZE];
+    char *buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
 	if (get_dir_entry_block(dir_inum, buf, &blkno, leaf) >= 0) {
+		free(buf);
 		return -EEXIST;	// leaf already exists
 	}
 
 	// find free directory entry
-	int entno = get_dir_free_entry_block(dir_inum, buf, &blkno);
+	int entno = get_dir_free_entry_block(dir_inum, buf, &blkno, leaf);
 	if (entno < 0) {
+		free(buf);
 		return -ENOSPC;	// no free directory entry
     }
 
 	// init new inode for entry
 	int inum = init_new_inode(mode, ftype);
 	if (inum < 0) {
+		free(buf);
 		return inum;
 	}
 
@@ -537,7 +2238,9 @@ int do_mkentry(int dir_inum, const char* leaf, mode_t mode, unsigned ftype)
 	set_dir_entry(&de[entno], inum, leaf);
 
     // write updated directory block to disk
-    disk->ops->write(disk, blkno, 1, buf);
+    write_journaled_blk(blkno, buf);
+    free(buf);
+    dcache_remove(dir_inum, leaf);  // remove cached lookup of leaf
 
     // increment size of directory by one fs_dirent
     din->size += sizeof(struct fs_dirent);
@@ -549,6 +2252,20 @@ int do_mkentry(int dir_inum, const char* leaf, mode_t mode, unsigned ftype)
     return inum;
 }
 
+/**
+ * Free an unlinked inode: truncate it to 0 length, mark its
+ * inode block dirty, and return it to the free list. The caller
+ * holds the write lock of the inode.
+ *
+ * @param inum the inode number
+ */
+void free_inode(int inum)
+{
+    do_truncate(inum, 0);
+    mark_inode(inum);
+    return_inode(inum);
+}
+
 /**
  * Remove an file named leaf in the specified
  * directory inum.
@@ -558,6 +2275,7 @@ int do_mkentry(int dir_inum, const char* leaf, mode_t mode, unsigned ftype)
  *   -ENOTDIR  - component of path not a directory
  *   -EISDIR    - path is a directory
  *   -ENOTEMPTY - directory not empty
+ *   -ENOMEM    - cannot allocate block buffer
  *
  * @param dir_inum the inumber of a directory inode
  * @param leaf the name of a child directory entry
@@ -572,9 +2290,13 @@ int do_unlink(int dir_inum, const char* leaf) {
 
     /* find directory entry block and index */
     int blkno;
-    char buf[FS_BLOCK_SIZE];
+    char *buf = malloc(FS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
     int entno = get_dir_entry_block(dir_inum, buf, &blkno, leaf);
     if (entno < 0) {
+        free(buf);
         return -ENOENT;
     }
 
@@ -584,19 +2306,23 @@ int do_unlink(int dir_inum, const char* leaf) {
 
     /* ensure that entry being removed is not a directory */
     if (S_ISDIR(fs.inodes[inum].mode)) {
+        free(buf);
         return -EISDIR;
     }
 
     // mark directory entry free and write directory block
     de[entno].valid = 0;
-    disk->ops->write(disk, blkno, 1, buf);
-
-    // truncate file to 0 length and mark its inode block dirty
-    do_truncate(inum, 0);
-    mark_inode(inum);
-
-    // free unlinked file inode
-    return_inode(inum);
+    write_journaled_blk(blkno, buf);
+    free(buf);
+    dcache_remove(dir_inum, leaf);  // remove cached lookup of leaf
+
+    // free unlinked file inode, waiting for operations on open file
+    // to finish, unless the kernel still refers to it
+    write_lock_inode(inum);
+    if (!orphan_inode(inum)) {
+        free_inode(inum);
+    }
+    unlock_inode(inum);
 
     // decrease size of directory by one fs_dirent
     // NOTE: add logging to report errors like this
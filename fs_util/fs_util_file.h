@@ -11,9 +11,29 @@
 #ifndef FS_UTIL_FILE_H_
 #define FS_UTIL_FILE_H_
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 
+#include "fsx600.h"
+
+#ifndef FALLOC_FL_KEEP_SIZE
+/** fallocate mode that allocates blocks without changing file size */
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+/** fallocate mode that frees blocks, leaving a hole */
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+
+/** Run of contiguous disk blocks of a file */
+struct file_run {
+    /** block number of first block in run */
+    int blkno;
+    /** number of blocks in run */
+    int nblks;
+};
+
 /**
  * Returns the block number of the n-th block of the file,
  * or allocates it if it does not exist and alloc == 1. If
@@ -27,6 +47,24 @@
  */
 int get_file_blkno(int inum, int n, int alloc);
 
+/**
+ * Maps blocks n through n+nblks-1 of the file to runs of contiguous
+ * disk blocks. If alloc == 1, blocks that extend the file are added
+ * in as few runs as possible, and are not initialized, so the caller
+ * must write them in full, and mapping stops at the first block that
+ * is unavailable. If alloc == 0, blocks that do not exist are mapped
+ * to runs with block number 0 for the holes in the file.
+ *
+ * @param inum the number of file inode
+ * @param n the 0-based index of first block
+ * @param nblks the number of blocks to map
+ * @param alloc 1=allocate blocks that do not exist 0 = map
+ *   blocks that do not exist as holes
+ * @param runs storage for up to nblks runs
+ * @return the number of runs
+ */
+int get_file_runs(int inum, int n, int nblks, int alloc, struct file_run *runs);
+
 /**
  * Gets the n-th block of the file, or allocates it if it
  * does not exist and alloc == 1. If file was extended, new
@@ -46,6 +84,47 @@ int get_file_blkno(int inum, int n, int alloc);
  */
 int get_file_blk(int inum, int n, void* block, int alloc);
 
+/**
+ * Returns 1 if the data of a file is stored inline in its inode
+ * in place of its block pointers.
+ *
+ * @param inum the number of file inode
+ * @return 1 if file data is inline, 0 if stored in blocks
+ */
+int is_inline_file(int inum);
+
+/**
+ * Moves the data of a file stored inline in its inode to the
+ * first block of the file, so the file can grow past the size
+ * of the inline data. Has no effect if the file is not inline.
+ *
+ * Errors
+ *   -ENOSPC  - no space for block
+ *   -ENOMEM  - cannot allocate block buffer
+ *
+ * @param inum the number of file inode
+ * @return 0 if successful, or -error number
+ */
+int expand_inline_file(int inum);
+
+/**
+ * Returns the size in bytes of the file of an inode, from its
+ * low 32 bits in size and its high 16 bits in size_hi.
+ *
+ * @param in the file inode
+ * @return the file size in bytes
+ */
+off_t get_inode_size(const struct fs_inode *in);
+
+/**
+ * Sets the size in bytes of the file of an inode, as its low
+ * 32 bits in size and its high 16 bits in size_hi.
+ *
+ * @param in the file inode
+ * @param size the file size in bytes
+ */
+void set_inode_size(struct fs_inode *in, off_t size);
+
 /**
  * Read bytes from content of an inode.
  *
@@ -54,8 +133,12 @@ int get_file_blk(int inum, int n, void* block, int alloc);
  *   - if offset+len > file len, return bytes from offset to EOF
  *   - on error, return <0
  *
+ * Blocks in holes of the file that have not been allocated
+ * read as 0s without any I/O.
+ *
  * Errors:
  *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *
  * @param inum the inumber of inode to truncate
  * @param buf the read buffer
@@ -71,11 +154,14 @@ int do_read(int inum, char* buf, size_t len, off_t offset);
  * It should return exactly the number of bytes requested, except on
  * error.
  *
+ * If 'offset' is greater than current file length, the blocks
+ * between the end of file and 'offset' are left unallocated, as
+ * a hole that reads as 0s. Only the blocks written are allocated.
+ *
  * Errors:
  *   -ENOSPC  - no space in file sysem
- *   -EINVAL  - if 'offset' is greater than current file length.
- *  			(POSIX semantics support the creation of files with
- *  			"holes" in them, but we don't)
+ *   -EFBIG   - write extends past the maximum file size
+ *   -ENOMEM  - cannot allocate block buffer
  *
  * @param inum the inumber of inode to truncate
  * @param buf the buffer to write
@@ -87,17 +173,54 @@ int do_write(int inum, const char* buf, size_t len, off_t offset);
 
 
 /**
- * Truncate fuse_parser_data specified by inode.
- * Currently only length 0 is supported.
+ * Truncate file specified by inode to exactly len bytes.
+ * If the file is shortened, blocks past the new end of file
+ * are freed in one pass; if it is extended, the new content
+ * is a hole that reads as 0s. A regular file that is truncated to
+ * at most INLINE_DATA_SIZE bytes stores its data inline in its inode.
+ * The caller marks the inode and flushes the metadata.
  *
  * Errors
  *   -EINVAL  - invalid length argument
+ *   -EFBIG   - length greater than the maximum file size
+ *   -ENOSPC  - no space to move inline data to a block
+ *   -EIO     - error reading block
+ *   -ENOMEM  - cannot allocate block buffer
  *
  * @param inum the inumber of inode to truncate
- * @param len new length of file -- currently only 0 allowed
+ * @param len new length of file
+ * @return 0 if successful, or -error number
+ */
+int do_truncate(int inum, off_t len);
+
+/**
+ * Allocates or deallocates space for a byte range of a file.
+ *
+ * If mode is 0, the blocks in holes of the range are allocated in
+ * as few contiguous runs as possible and filled with 0s, and the file
+ * is extended to the end of the range. With FALLOC_FL_KEEP_SIZE, the
+ * blocks are allocated but the file size does not change. With
+ * FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, the range is zeroed,
+ * and its full blocks are freed, leaving a hole, including blocks
+ * preallocated past the end of the file. If allocation fails, only
+ * the blocks it added are freed. The caller marks the inode and
+ * flushes the metadata.
+ *
+ * Errors
+ *   -EINVAL      - invalid offset or length
+ *   -EOPNOTSUPP  - mode not supported
+ *   -EFBIG       - range extends past the maximum file size
+ *   -ENOSPC      - no space in file system
+ *   -ENOMEM      - cannot allocate buffer
+ *   -EIO         - error reading block
+ *
+ * @param inum the inumber of inode
+ * @param mode 0, or the FALLOC_FL_KEEP_SIZE and FALLOC_FL_PUNCH_HOLE flags
+ * @param offset the offset of the range
+ * @param len the length of the range
  * @return 0 if successful, or -error number
  */
-int do_truncate(int inum, int len);
+int do_fallocate(int inum, int mode, off_t offset, off_t len);
 
 /**
  * Rename a file or directory.
@@ -112,6 +235,8 @@ int do_truncate(int inum, int len);
  *   -ENOTDIR  - component of source or target path not a directory
  *   -EEXIST   - destination already exists
  *   -EINVAL   - source and destination not in the same directory
+ *   -ENOSPC   - no space for entry with new name
+ *   -ENOMEM   - cannot allocate block buffers
  *
  * @param src_path the source path
  * @param dst_path the destination path.
@@ -121,7 +246,7 @@ int do_rename(int srcdir_inum, const char* src_leaf,
               int dstdir_inum, const char* dst_leaf);
 
 /**
- * Fill in a stat structure for an inode.
+ * Fill in a stat structure for an inode. Called with the inode locked.
  *
  * @param inum inode number
  * @param sb pointer to stat structure
@@ -151,6 +276,7 @@ int init_new_inode(mode_t mode, unsigned ftype);
  *   -EEXIST   - directory already exists
  *   -ENOSPC   - free inode not available
  *   -ENOSPC   - results in >32 entries in directory
+ *   -ENOMEM   - cannot allocate block buffer
  *
  * @param dir_inum the inum of the directory inode
  * @param leaf the leaf name in the inode directory
@@ -160,6 +286,15 @@ int init_new_inode(mode_t mode, unsigned ftype);
  */
 int do_mkentry(int dir_inum, const char* leaf, mode_t mode, unsigned ftype);
 
+/**
+ * Free an unlinked inode: truncate it to 0 length, mark its
+ * inode block dirty, and return it to the free list. The caller
+ * holds the write lock of the inode.
+ *
+ * @param inum the inode number
+ */
+void free_inode(int inum);
+
 /**
  * Remove an file named leaf in the specified
  * directory inum.
@@ -169,6 +304,7 @@ int do_mkentry(int dir_inum, const char* leaf, mode_t mode, unsigned ftype);
  *   -ENOTDIR  - component of path not a directory
  *   -EISDIR    - path is a directory
  *   -ENOTEMPTY - directory not empty
+ *   -ENOMEM    - cannot allocate block buffer
  *
  * @param dir_inum the inumber of a directory inode
  * @param leaf the name of a child directory entry
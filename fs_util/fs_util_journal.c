@@ -0,0 +1,714 @@
+/*
+ * fs_util_journal.c
+ *
+ * description: metadata journal functions for CS 5600 / 7600 file system
+ *
+ * Metadata updates are written ahead to a journal region of the volume
+ * (see struct fs_journal_block in fs_app/fsx600.h). Each group commit
+ * of flush_metadata() appends one transaction to the journal with a
+ * single sequential write and flush, in place of a write of each run
+ * of dirty metadata blocks to its home location. The home locations
+ * are written only when the journal fills or the volume is unmounted,
+ * from an in-memory image of the journal, so a metadata block updated
+ * by many commits is written home once. After an unclean shutdown,
+ * the transactions committed since the last checkpoint are replayed
+ * when the volume is mounted.
+ *
+ * The directory, indirect, and extent tree blocks of files are
+ * journaled with the inodes and bitmaps. Writes of these blocks are
+ * kept in memory until the next transaction, and reads find the
+ * latest copy in memory until a checkpoint writes it home, so none
+ * of them is written in place ahead of the inode and bitmap changes
+ * committed with it. File data is still written in place. A block
+ * freed while the journal holds a copy of it is revoked by the next
+ * transaction, so replay does not overwrite the block once it is
+ * reused for file data.
+ *
+ * A transaction holds the blocks dirty when it is committed, which
+ * may include part of an operation still in progress on another
+ * thread, and a transaction too large for the journal is written in
+ * place, so an operation is not guaranteed to be all or nothing.
+ *
+ * The journal advances only when a transaction has been written and
+ * flushed; a transaction that fails is undone in memory, and its
+ * blocks are committed with the next one. A checkpoint that fails
+ * leaves the journal as it was, to be written home again later.
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_util_journal.h"
+#include "fs_util_vol.h"
+#include "blkdev.h"
+
+enum {
+    /** max number of block requests submitted together by a checkpoint */
+    CKPT_BATCH = 64,
+    /** change of a journaled block since the last transaction: a copy */
+    JNL_COPY = 1,
+    /** change of a journaled block since the last transaction: freed */
+    JNL_REVOKE = 2
+};
+
+/** A directory, indirect, or extent tree block journaled with the metadata */
+struct jnl_blk {
+    /** the block number */
+    int blkno;
+    /** journal block with the latest committed copy not yet written home, or 0 */
+    int home;
+    /** home before the transaction being committed, restored if it fails */
+    int prev_home;
+    /** JNL_COPY or JNL_REVOKE if changed since the last transaction, or 0 */
+    int pending;
+    /** 1 if the journal holds a copy since the last checkpoint */
+    int logged;
+    /** next block in the hash chain */
+    struct jnl_blk *next;
+    /** the pending copy of the block */
+    char data[];
+};
+
+/** in-memory image of the journal region */
+static char *jnl_buf;
+
+/** journal block with the latest committed copy of each
+ *  metadata block not yet written home, or 0 if none */
+static int *home_pos;
+
+/** hash chains of journaled blocks, and the mask of the chain index */
+static struct jnl_blk **jnl_blks;
+static unsigned jnl_blks_mask;
+
+/** number of journaled blocks, and number with pending changes */
+static int n_jnl_blks, n_pending;
+
+/** number of metadata blocks */
+static int jnl_n_meta;
+
+/** journal block where the next transaction starts */
+static int jnl_head;
+
+/** sequence number of the next transaction */
+static uint32_t jnl_seq;
+
+/** descriptor blocks, entries, and block copies of the transaction begun */
+static int txn_ndesc, txn_n, txn_ncopy;
+
+/** block numbers and journal blocks of the copies written home by a checkpoint */
+static struct ckpt_blk {
+    int blkno;
+    int pos;
+} *ckpt_blks;
+
+/**
+ * Returns a block of the in-memory image of the journal.
+ *
+ * @param n the block index in the journal
+ * @return the block
+ */
+static struct fs_journal_block *jnl_block(int n)
+{
+    return (struct fs_journal_block *)(jnl_buf + (size_t)n * FS_BLOCK_SIZE);
+}
+
+/**
+ * Returns the number of descriptor blocks that list the
+ * entries of a transaction.
+ *
+ * @param n the number of entries
+ * @return the number of descriptor blocks
+ */
+static int desc_blks(int n)
+{
+    size_t len = sizeof(struct fs_journal_block) + (size_t)n * sizeof(uint32_t);
+    return (len + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+/**
+ * Returns the FNV-1a checksum of a buffer.
+ *
+ * @param buf the buffer
+ * @param len the length of the buffer
+ * @return the checksum
+ */
+static uint32_t checksum(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Returns the link to a journaled block in its hash chain.
+ *
+ * @param blkno the block number
+ * @return the link to the block, which is NULL if not journaled
+ */
+static struct jnl_blk **find_jnl_blk(int blkno)
+{
+    unsigned h = ((unsigned)blkno * 2654435761u) & jnl_blks_mask;
+    struct jnl_blk **p = &jnl_blks[h];
+    while (*p != NULL && (*p)->blkno != blkno) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+/**
+ * Returns a journaled block, adding it if not journaled.
+ *
+ * @param blkno the block number
+ * @return the block, or NULL if no memory
+ */
+static struct jnl_blk *get_jnl_blk(int blkno)
+{
+    struct jnl_blk **p = find_jnl_blk(blkno);
+    if (*p == NULL) {
+        struct jnl_blk *b = malloc(sizeof(struct jnl_blk) + FS_BLOCK_SIZE);
+        if (b == NULL) {
+            return NULL;
+        }
+        *b = (struct jnl_blk){.blkno = blkno};
+        *p = b;
+        n_jnl_blks++;
+    }
+    return *p;
+}
+
+/**
+ * Removes a journaled block from its hash chain once it has no
+ * pending change, no committed copy, and no copy in the journal.
+ *
+ * @param p the link to the block
+ */
+static void put_jnl_blk(struct jnl_blk **p)
+{
+    struct jnl_blk *b = *p;
+    if (b->pending == 0 && b->home == 0 && !b->logged) {
+        *p = b->next;
+        free(b);
+        n_jnl_blks--;
+    }
+}
+
+/**
+ * Sets the pending change of a journaled block.
+ *
+ * @param b the block
+ * @param pending JNL_COPY, JNL_REVOKE, or 0 for none
+ */
+static void set_pending(struct jnl_blk *b, int pending)
+{
+    n_pending += (pending != 0) - (b->pending != 0);
+    b->pending = pending;
+}
+
+/**
+ * Writes and flushes the journal superblock, recording that replay
+ * starts with the next transaction, at the head of the journal.
+ *
+ * @return 0 if successful, or -EIO if error
+ */
+static int write_journal_super(void)
+{
+    struct fs_journal_block *sb = jnl_block(0);
+    memset(sb, 0, FS_BLOCK_SIZE);
+    sb->magic = FS_JOURNAL_MAGIC;
+    sb->type = FS_JOURNAL_SUPER;
+    sb->seq = jnl_seq;
+    sb->count = jnl_head;
+    if (disk->ops->write(disk, fs.journal_base, 1, sb) != SUCCESS
+            || disk->ops->flush(disk, fs.journal_base, 1) != SUCCESS) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Returns 1 if a block may be journaled with the metadata:
+ * a block of the volume past the metadata and the journal.
+ *
+ * @param blkno the block number
+ * @return 1 if the block may be journaled, 0 if not
+ */
+static int is_jnl_blk(int blkno)
+{
+    return blkno >= fs.journal_base + (int)fs.journal_sz && blkno < fs.n_blocks;
+}
+
+/**
+ * Opens the metadata journal of the volume, if it has one. The
+ * committed transactions in the journal are replayed, writing the
+ * latest copies of their blocks that were not revoked to their
+ * home locations, and the journal is left empty. Called when the
+ * volume is mounted, before its metadata is read.
+ *
+ * @param n_meta the number of metadata blocks of the volume
+ * @return the number of transactions replayed, or -1 if error
+ */
+int open_journal(int n_meta)
+{
+    if (fs.journal_sz == 0) {
+        return 0;
+    }
+    jnl_n_meta = n_meta;
+    jnl_blks_mask = 1;
+    while (jnl_blks_mask < fs.journal_sz) {
+        jnl_blks_mask *= 2;
+    }
+    jnl_blks = calloc(jnl_blks_mask--, sizeof(struct jnl_blk *));
+    jnl_buf = malloc((size_t)fs.journal_sz * FS_BLOCK_SIZE);
+    home_pos = calloc(n_meta, sizeof(int));
+    ckpt_blks = malloc(fs.journal_sz * sizeof(struct ckpt_blk));
+    if (jnl_blks == NULL || jnl_buf == NULL || home_pos == NULL || ckpt_blks == NULL
+            || disk->ops->read(disk, fs.journal_base, fs.journal_sz, jnl_buf) < 0) {
+        return -1;
+    }
+    struct fs_journal_block *sb = jnl_block(0);
+    if (sb->magic != FS_JOURNAL_MAGIC || sb->type != FS_JOURNAL_SUPER) {
+        return -1;
+    }
+
+    // find latest copy of each block in transactions, in sequence until one is not intact
+    jnl_seq = sb->seq;
+    int pos = sb->count, nreplayed = 0;
+    while (pos > 0 && pos < fs.journal_sz) {
+        struct fs_journal_block *d = jnl_block(pos);
+        if (d->magic != FS_JOURNAL_MAGIC || d->type != FS_JOURNAL_DESC
+                || d->seq != jnl_seq || d->count >= (uint32_t)fs.journal_sz) {
+            break;
+        }
+        int n = d->count, ndesc = desc_blks(n), ncopy = 0;
+        if (pos + ndesc > fs.journal_sz) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            ncopy += (d->blknos[i] & FS_JOURNAL_REVOKE) == 0;
+        }
+        if (pos + ndesc + ncopy + 1 > fs.journal_sz) {
+            break;
+        }
+        struct fs_journal_block *c = jnl_block(pos + ndesc + ncopy);
+        if (c->magic != FS_JOURNAL_MAGIC || c->type != FS_JOURNAL_COMMIT
+                || c->seq != jnl_seq || c->count != (uint32_t)n
+                || c->checksum != checksum(d, (size_t)(ndesc + ncopy) * FS_BLOCK_SIZE)) {
+            break;  // transaction not committed
+        }
+        for (int i = 0, j = 0; i < n; i++) {
+            int blkno = d->blknos[i] & ~FS_JOURNAL_REVOKE;
+            if ((d->blknos[i] & FS_JOURNAL_REVOKE) != 0) {
+                // block was freed: earlier copies are not replayed
+                struct jnl_blk **p = find_jnl_blk(blkno);
+                if (*p != NULL) {
+                    (*p)->home = 0;
+                    put_jnl_blk(p);
+                }
+                continue;
+            }
+            int at = pos + ndesc + j++;
+            if (blkno > 0 && blkno < n_meta) {
+                home_pos[blkno] = at;
+            } else if (is_jnl_blk(blkno)) {
+                struct jnl_blk *b = get_jnl_blk(blkno);
+                if (b == NULL) {
+                    return -1;
+                }
+                b->home = at;
+            }
+        }
+        pos += ndesc + ncopy + 1;
+        jnl_seq++;
+        nreplayed++;
+    }
+
+    // write latest copies home, and start with empty journal
+    jnl_head = pos;
+    if (nreplayed > 0) {
+        if (checkpoint_journal() < 0) {
+            return -1;
+        }
+        fprintf(stderr, "replayed %d metadata journal transactions\n", nreplayed);
+    } else {
+        jnl_head = 1;
+        if (write_journal_super() < 0) {
+            return -1;
+        }
+    }
+    return nreplayed;
+}
+
+/**
+ * Begins a transaction of n metadata blocks, and of the pending
+ * changes of journaled blocks. The journal is checkpointed first
+ * if it has no room for the transaction, or if the transaction is
+ * larger than the journal, so that blocks the caller then writes in
+ * place are not overwritten by older copies in the journal.
+ *
+ * Errors
+ *   -EIO     - error checkpointing the journal; the blocks must not
+ *              be written in place while it holds older copies
+ *
+ * @param n the number of metadata blocks
+ * @return 0 if begun, 1 if the volume has no journal or the
+ *   transaction is larger than the journal, or -error
+ */
+int begin_journal(int n)
+{
+    if (jnl_buf == NULL) {
+        return 1;
+    }
+    n += n_pending;
+    int nblks = desc_blks(n) + n + 1;
+    if (nblks > fs.journal_sz - 1) {
+        return (checkpoint_journal() < 0) ? -EIO : 1;  // larger than the journal
+    }
+    if (jnl_head + nblks > fs.journal_sz && checkpoint_journal() < 0) {
+        return -EIO;
+    }
+
+    txn_ndesc = desc_blks(n);
+    txn_n = txn_ncopy = 0;
+    struct fs_journal_block *d = jnl_block(jnl_head);
+    memset(d, 0, (size_t)txn_ndesc * FS_BLOCK_SIZE);
+    d->magic = FS_JOURNAL_MAGIC;
+    d->type = FS_JOURNAL_DESC;
+    d->seq = jnl_seq;
+    return 0;
+}
+
+/**
+ * Adds a run of metadata blocks to the transaction begun by
+ * begin_journal(), copying their current contents.
+ *
+ * @param blkno the block number of the first block
+ * @param nblks the number of blocks
+ * @param buf the contents of the blocks
+ */
+void add_journal(int blkno, int nblks, const void *buf)
+{
+    struct fs_journal_block *d = jnl_block(jnl_head);
+    for (int i = 0; i < nblks; i++) {
+        d->blknos[txn_n + i] = blkno + i;
+    }
+    memcpy(jnl_block(jnl_head + txn_ndesc + txn_ncopy), buf, (size_t)nblks * FS_BLOCK_SIZE);
+    txn_n += nblks;
+    txn_ncopy += nblks;
+}
+
+/**
+ * Adds the pending changes of journaled blocks to the transaction
+ * begun by begin_journal(): a copy of each block written, and a
+ * revoke record of each block freed. The copies are read from the
+ * journal image from then on. Called with the metadata lock held.
+ */
+void add_journal_blks(void)
+{
+    struct fs_journal_block *d = jnl_block(jnl_head);
+    for (unsigned h = 0; h <= jnl_blks_mask && n_pending > 0; h++) {
+        for (struct jnl_blk **p = &jnl_blks[h]; *p != NULL; ) {
+            struct jnl_blk *b = *p;
+            if (b->pending == JNL_REVOKE) {
+                d->blknos[txn_n++] = b->blkno | FS_JOURNAL_REVOKE;
+            } else if (b->pending == JNL_COPY) {
+                d->blknos[txn_n++] = b->blkno;
+                b->prev_home = b->home;
+                b->home = jnl_head + txn_ndesc + txn_ncopy++;
+                b->logged = 1;
+                memcpy(jnl_block(b->home), b->data, FS_BLOCK_SIZE);
+            }
+            set_pending(b, 0);
+            put_jnl_blk(p);
+            if (*p == b) {
+                p = &b->next;
+            }
+        }
+    }
+}
+
+/**
+ * Commits the transaction begun by begin_journal(), writing it
+ * to the journal with a single write, and flushing it to disk.
+ * If the write or flush fails, the journal is left as it was,
+ * and abort_journal() must be called.
+ *
+ * Errors
+ *   -EIO     - error writing or flushing the transaction
+ *
+ * @return 0 if successful, or -error
+ */
+int commit_journal(void)
+{
+    struct fs_journal_block *d = jnl_block(jnl_head);
+    d->count = txn_n;
+    struct fs_journal_block *c = jnl_block(jnl_head + txn_ndesc + txn_ncopy);
+    memset(c, 0, FS_BLOCK_SIZE);
+    c->magic = FS_JOURNAL_MAGIC;
+    c->type = FS_JOURNAL_COMMIT;
+    c->seq = jnl_seq;
+    c->count = txn_n;
+    c->checksum = checksum(d, (size_t)(txn_ndesc + txn_ncopy) * FS_BLOCK_SIZE);
+
+    int nblks = txn_ndesc + txn_ncopy + 1;
+    if (disk->ops->write(disk, fs.journal_base + jnl_head, nblks, d) != SUCCESS
+            || disk->ops->flush(disk, fs.journal_base + jnl_head, nblks) != SUCCESS) {
+        return -EIO;
+    }
+
+    // committed copies of metadata blocks are written home by the next checkpoint
+    for (int i = 0, j = 0; i < txn_n; i++) {
+        if ((d->blknos[i] & FS_JOURNAL_REVOKE) == 0) {
+            int blkno = d->blknos[i];
+            if (blkno < jnl_n_meta) {
+                home_pos[blkno] = jnl_head + txn_ndesc + j;
+            }
+            j++;
+        }
+    }
+    jnl_head += nblks;
+    jnl_seq++;
+    return 0;
+}
+
+/**
+ * Undoes adding the pending changes of journaled blocks to a
+ * transaction that failed to commit, so that they are added to the
+ * next one: a block not written or freed since is pending again,
+ * and reads find its earlier committed copy. A block stays logged,
+ * as the failed transaction may be on disk, so it is revoked if it
+ * is freed. Called with the metadata lock held.
+ */
+void abort_journal(void)
+{
+    struct fs_journal_block *d = jnl_block(jnl_head);
+    int start = jnl_head + txn_ndesc, end = start + txn_ncopy;
+    for (int i = 0; i < txn_n; i++) {
+        int blkno = d->blknos[i] & ~FS_JOURNAL_REVOKE;
+        struct jnl_blk *b = is_jnl_blk(blkno) ? *find_jnl_blk(blkno) : NULL;
+        if (b == NULL) {
+            continue;  // metadata block, or freed since
+        }
+        if ((d->blknos[i] & FS_JOURNAL_REVOKE) != 0) {
+            if (b->pending == 0) {
+                set_pending(b, JNL_REVOKE);
+            }
+        } else if (b->home >= start && b->home < end) {
+            b->home = b->prev_home;
+            if (b->pending == 0) {
+                set_pending(b, JNL_COPY);
+            }
+        }
+    }
+}
+
+/**
+ * Compares the block numbers of two copies written home.
+ *
+ * @param a the first copy
+ * @param b the second copy
+ * @return <0, 0, or >0 as the first block is before, at, or after the second
+ */
+static int cmp_ckpt_blk(const void *a, const void *b)
+{
+    return ((const struct ckpt_blk *)a)->blkno - ((const struct ckpt_blk *)b)->blkno;
+}
+
+/**
+ * Checkpoints the journal: writes the latest committed copy of each
+ * block in the journal to its home location, and leaves the journal
+ * empty. Has no effect if the volume has no journal. If a write or
+ * flush fails, the journal is left as it was, so its copies are
+ * written home by a later checkpoint or replay. Called with the
+ * metadata lock held.
+ *
+ * Errors
+ *   -EIO     - error writing or flushing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int checkpoint_journal(void)
+{
+    if (jnl_buf == NULL || jnl_head == 1) {
+        return 0;  // no journal, or journal empty
+    }
+
+    // each copy written home is in a distinct journal block
+    int n = 0;
+    for (int blkno = 0; blkno < jnl_n_meta; blkno++) {
+        if (home_pos[blkno] != 0) {
+            ckpt_blks[n++] = (struct ckpt_blk){.blkno = blkno, .pos = home_pos[blkno]};
+        }
+    }
+    int n_meta_blks = n;
+    for (unsigned h = 0; h <= jnl_blks_mask && n_jnl_blks > 0; h++) {
+        for (struct jnl_blk *b = jnl_blks[h]; b != NULL; b = b->next) {
+            if (b->home != 0) {
+                ckpt_blks[n++] = (struct ckpt_blk){.blkno = b->blkno, .pos = b->home};
+            }
+        }
+    }
+    qsort(ckpt_blks + n_meta_blks, n - n_meta_blks, sizeof(struct ckpt_blk), cmp_ckpt_blk);
+
+    // write home blocks in batches of requests, in block order
+    struct blkdev_req reqs[CKPT_BATCH];
+    for (int i = 0; i < n; i += CKPT_BATCH) {
+        int nreqs = (n - i < CKPT_BATCH) ? n - i : CKPT_BATCH;
+        for (int k = 0; k < nreqs; k++) {
+            reqs[k] = (struct blkdev_req){.op = BLKDEV_WRITE, .first_blk = ckpt_blks[i+k].blkno,
+                    .num_blks = 1, .buf = jnl_block(ckpt_blks[i+k].pos)};
+        }
+        if (blkdev_submit(disk, reqs, nreqs) != SUCCESS
+                || blkdev_complete(disk, reqs, nreqs) != SUCCESS) {
+            return -EIO;
+        }
+    }
+    if (disk->ops->flush(disk, 0, fs.n_blocks) != SUCCESS) {
+        return -EIO;
+    }
+    memset(home_pos, 0, jnl_n_meta * sizeof(int));
+
+    // journal no longer holds copies, so freed blocks need not be revoked
+    for (unsigned h = 0; h <= jnl_blks_mask && n_jnl_blks > 0; h++) {
+        for (struct jnl_blk **p = &jnl_blks[h]; *p != NULL; ) {
+            struct jnl_blk *b = *p;
+            b->home = 0;
+            b->logged = 0;
+            if (b->pending == JNL_REVOKE) {
+                set_pending(b, 0);
+            }
+            put_jnl_blk(p);
+            if (*p == b) {
+                p = &b->next;
+            }
+        }
+    }
+
+    // home blocks are durable, so the journal can be reused
+    jnl_head = 1;
+    return write_journal_super();
+}
+
+/**
+ * Returns the number of journaled blocks with pending changes.
+ * Called with the metadata lock held.
+ *
+ * @return the number of journaled blocks with pending changes
+ */
+int count_journal_blks(void)
+{
+    return n_pending;
+}
+
+/**
+ * Reads the latest copy of a directory, indirect, or extent tree
+ * block held by the journal. Called with the metadata lock held.
+ *
+ * @param blkno the block number
+ * @param buf storage for the block
+ * @return 1 if the block was read, or 0 if it must be read from
+ *   its home location
+ */
+int read_journal_blk(int blkno, void *buf)
+{
+    if (jnl_blks == NULL || n_jnl_blks == 0) {
+        return 0;
+    }
+    struct jnl_blk *b = *find_jnl_blk(blkno);
+    if (b == NULL || b->pending == JNL_REVOKE) {
+        return 0;
+    }
+    if (b->pending == JNL_COPY) {
+        memcpy(buf, b->data, FS_BLOCK_SIZE);
+    } else if (b->home != 0) {
+        memcpy(buf, jnl_block(b->home), FS_BLOCK_SIZE);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Writes a directory, indirect, or extent tree block to memory, to
+ * be added to the next transaction. Called with the metadata lock held.
+ *
+ * @param blkno the block number
+ * @param buf the contents of the block
+ * @return 0 if written, or -1 if the volume has no journal or
+ *   no memory, and the block must be written in place
+ */
+int write_journal_blk(int blkno, const void *buf)
+{
+    if (jnl_blks == NULL || !is_jnl_blk(blkno)) {
+        return -1;
+    }
+    struct jnl_blk *b = get_jnl_blk(blkno);
+    if (b == NULL) {
+        return -1;
+    }
+    memcpy(b->data, buf, FS_BLOCK_SIZE);
+    set_pending(b, JNL_COPY);
+    return 0;
+}
+
+/**
+ * Revokes a block being freed: its pending copy is discarded, and if
+ * the journal holds a copy, the next transaction records that earlier
+ * copies must not be replayed. Called with the metadata lock held.
+ *
+ * @param blkno the block number
+ */
+void revoke_journal_blk(int blkno)
+{
+    if (jnl_blks == NULL || n_jnl_blks == 0) {
+        return;
+    }
+    struct jnl_blk **p = find_jnl_blk(blkno);
+    if (*p == NULL) {
+        return;
+    }
+    struct jnl_blk *b = *p;
+    b->home = 0;
+    set_pending(b, b->logged ? JNL_REVOKE : 0);
+    put_jnl_blk(p);
+}
+
+/**
+ * Writes the pending copies of journaled blocks in place, when their
+ * transaction is larger than the journal and begin_journal() failed.
+ * The journal was checkpointed, so nothing need be revoked. A copy
+ * that fails to be written stays pending. Called with the metadata
+ * lock held.
+ *
+ * Errors
+ *   -EIO     - error writing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int write_journal_blks(void)
+{
+    int status = 0;
+    for (unsigned h = 0; h <= jnl_blks_mask && n_pending > 0; h++) {
+        for (struct jnl_blk **p = &jnl_blks[h]; *p != NULL; ) {
+            struct jnl_blk *b = *p;
+            if (b->pending == JNL_COPY
+                    && disk->ops->write(disk, b->blkno, 1, b->data) != SUCCESS) {
+                status = -EIO;
+            } else {
+                set_pending(b, 0);
+            }
+            put_jnl_blk(p);
+            if (*p == b) {
+                p = &b->next;
+            }
+        }
+    }
+    return status;
+}
@@ -0,0 +1,150 @@
+/*
+ * fs_util_journal.h
+ *
+ * description: metadata journal functions for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#ifndef FS_UTIL_JOURNAL_H_
+#define FS_UTIL_JOURNAL_H_
+
+/**
+ * Opens the metadata journal of the volume, if it has one. The
+ * committed transactions in the journal are replayed, writing the
+ * latest copies of their blocks that were not revoked to their
+ * home locations, and the journal is left empty. Called when the
+ * volume is mounted, before its metadata is read.
+ *
+ * @param n_meta the number of metadata blocks of the volume
+ * @return the number of transactions replayed, or -1 if error
+ */
+int open_journal(int n_meta);
+
+/**
+ * Begins a transaction of n metadata blocks, and of the pending
+ * changes of journaled blocks. The journal is checkpointed first if it has no room for the transaction, or if
+ * the transaction is larger than the journal, so that blocks the
+ * caller then writes in place are not overwritten by older copies
+ * in the journal.
+ *
+ * Errors
+ *   -EIO     - error checkpointing the journal; the blocks must not
+ *              be written in place while it holds older copies
+ *
+ * @param n the number of metadata blocks
+ * @return 0 if begun, 1 if the volume has no journal or the
+ *   transaction is larger than the journal, or -error
+ */
+int begin_journal(int n);
+
+/**
+ * Adds a run of metadata blocks to the transaction begun by
+ * begin_journal(), copying their current contents.
+ *
+ * @param blkno the block number of the first block
+ * @param nblks the number of blocks
+ * @param buf the contents of the blocks
+ */
+void add_journal(int blkno, int nblks, const void *buf);
+
+/**
+ * Adds the pending changes of journaled blocks to the transaction
+ * begun by begin_journal(): a copy of each block written, and a
+ * revoke record of each block freed. The copies are read from the
+ * journal image from then on. Called with the metadata lock held.
+ */
+void add_journal_blks(void);
+
+/**
+ * Commits the transaction begun by begin_journal(), writing it
+ * to the journal with a single write, and flushing it to disk.
+ * If the write or flush fails, the journal is left as it was,
+ * and abort_journal() must be called.
+ *
+ * Errors
+ *   -EIO     - error writing or flushing the transaction
+ *
+ * @return 0 if successful, or -error
+ */
+int commit_journal(void);
+
+/**
+ * Undoes adding the pending changes of journaled blocks to a
+ * transaction that failed to commit, so that they are added to the
+ * next one: a block not written or freed since is pending again,
+ * and reads find its earlier committed copy. A block stays logged,
+ * as the failed transaction may be on disk, so it is revoked if it
+ * is freed. Called with the metadata lock held.
+ */
+void abort_journal(void);
+
+/**
+ * Checkpoints the journal: writes the latest committed copy of each
+ * block in the journal to its home location, and leaves the journal
+ * empty. Has no effect if the volume has no journal. If a write or
+ * flush fails, the journal is left as it was, so its copies are
+ * written home by a later checkpoint or replay. Called with the
+ * metadata lock held.
+ *
+ * Errors
+ *   -EIO     - error writing or flushing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int checkpoint_journal(void);
+
+/**
+ * Returns the number of journaled blocks with pending changes.
+ * Called with the metadata lock held.
+ *
+ * @return the number of journaled blocks with pending changes
+ */
+int count_journal_blks(void);
+
+/**
+ * Reads the latest copy of a directory, indirect, or extent tree
+ * block held by the journal. Called with the metadata lock held.
+ *
+ * @param blkno the block number
+ * @param buf storage for the block
+ * @return 1 if the block was read, or 0 if it must be read from
+ *   its home location
+ */
+int read_journal_blk(int blkno, void *buf);
+
+/**
+ * Writes a directory, indirect, or extent tree block to memory, to
+ * be added to the next transaction. Called with the metadata lock held.
+ *
+ * @param blkno the block number
+ * @param buf the contents of the block
+ * @return 0 if written, or -1 if the volume has no journal or
+ *   no memory, and the block must be written in place
+ */
+int write_journal_blk(int blkno, const void *buf);
+
+/**
+ * Revokes a block being freed: its pending copy is discarded, and if
+ * the journal holds a copy, the next transaction records that earlier
+ * copies must not be replayed. Called with the metadata lock held.
+ *
+ * @param blkno the block number
+ */
+void revoke_journal_blk(int blkno);
+
+/**
+ * Writes the pending copies of journaled blocks in place, when their
+ * transaction is larger than the journal and begin_journal() failed.
+ * The journal was checkpointed, so nothing need be revoked. A copy
+ * that fails to be written stays pending. Called with the metadata
+ * lock held.
+ *
+ * Errors
+ *   -EIO     - error writing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int write_journal_blks(void);
+
+#endif /* FS_UTIL_JOURNAL_H_ */
@@ -8,23 +8,443 @@
  * Philip Gust, March 2019, March 2020
  */
 
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "fs_util_journal.h"
 #include "fs_util_meta.h"
 #include "fs_util_vol.h"
+#include "fs_util_writeback.h"
 #include "blkdev.h"
+#include "max.h"
+#include "min.h"
+
+/*
+ * Locking: FUSE operations may run concurrently on several threads.
+ * Each inode has a reader-writer lock that is held while its content
+ * or attributes are read or modified; directory operations lock the
+ * parent directory before the entry's inode. The block map, inode
+ * map, and dirty metadata bitmap each have a mutex, acquired in that
+ * order after any inode locks; the lock of the dirty metadata bitmap
+ * also guards the journaled blocks. The in-memory inode references have
+ * their own mutex, which is not held while acquiring other locks.
+ */
+
+/** lock for block map, free block count, and block cursor */
+static pthread_mutex_t block_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** lock for inode map, free inode count, and inode cursor */
+static pthread_mutex_t inode_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** lock for in-memory inode references and generations */
+static pthread_mutex_t inode_ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** lock for dirty metadata bitmap and flushing */
+static pthread_mutex_t meta_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** signaled when a group commit of metadata completes */
+static pthread_cond_t commit_cond = PTHREAD_COND_INITIALIZER;
+
+/** 1 while a thread commits a group of metadata blocks */
+static int committing;
+
+/** number of group commits started and completed */
+static unsigned groups_started, groups_done;
+
+/** the last group commit that failed, or 0 if none */
+static unsigned group_failed;
+
+/** number of dirty metadata blocks */
+static int n_dirty;
+
+/**
+ * Sets the block size of the volume, and derives the numbers
+ * of directory entries, inodes, block pointers, bitmap bits,
+ * and directory index entries per block.
+ *
+ * @param blk_size the block size in bytes
+ */
+void set_block_size(int blk_size)
+{
+    fs.blk_size = blk_size;
+    fs.dirents_per_blk = FS_DIRENTS_PER_BLK(blk_size);
+    fs.inodes_per_blk = FS_INODES_PER_BLK(blk_size);
+    fs.ptrs_per_blk = FS_PTRS_PER_BLK(blk_size);
+    fs.bits_per_blk = FS_BITS_PER_BLK(blk_size);
+    fs.dx_entries_per_blk = FS_DX_ENTRIES_PER_BLK(blk_size);
+    fs.extents_per_blk = FS_EXTENTS_PER_BLK(blk_size);
+}
+
+/**
+ * Finds the first bit with a value in the range [start, end) of
+ * a bitmap. The bitmap is scanned 64 bits at a time, skipping
+ * words with no bits of the value. Relies on the fd_set bit for
+ * n being bit n%8 of byte n/8, which holds for the little-endian
+ * hosts that share the on-disk bitmaps.
+ *
+ * @param map the bitmap
+ * @param start the first bit to consider
+ * @param end one past the last bit to consider
+ * @param set 1 to find a set bit, 0 to find a clear bit
+ * @return the first bit with the value, or -1 if none
+ */
+static int find_bit(fd_set *map, int start, int end, int set)
+{
+    const uint64_t *words = (const uint64_t*)map;
+    const uint64_t flip = set ? 0 : ~(uint64_t)0;
+    int w = start / 64;
+    // ignore bits before start in first word
+    uint64_t match = (words[w] ^ flip) & (~(uint64_t)0 << (start % 64));
+    while (1) {
+        if (match != 0) {
+            int i = w*64 + __builtin_ctzll(match);
+            return (i < end) ? i : -1;
+        }
+        if (++w*64 >= end) {
+            return -1;
+        }
+        match = words[w] ^ flip;
+    }
+}
+
+/**
+ * Finds the first clear bit in the range [start, end) of a bitmap.
+ *
+ * @param map the bitmap
+ * @param start the first bit to consider
+ * @param end one past the last bit to consider
+ * @return the first clear bit, or -1 if none
+ */
+static inline int find_clear_bit(fd_set *map, int start, int end)
+{
+    return find_bit(map, start, end, 0);
+}
+
+/**
+ * Finds a clear bit in a bitmap, starting at a cursor and
+ * wrapping around to the beginning of the bitmap (next fit).
+ *
+ * @param map the bitmap
+ * @param cursor the first bit to consider
+ * @param nbits the number of bits in the bitmap
+ * @return the clear bit, or -1 if none
+ */
+static int find_clear_bit_from(fd_set *map, int cursor, int nbits)
+{
+    if (cursor >= nbits) {
+        cursor = 0;
+    }
+    int i = find_clear_bit(map, cursor, nbits);
+    if (i < 0 && cursor > 0) {
+        i = find_clear_bit(map, 0, cursor);
+    }
+    return i;
+}
+
+/**
+ * Counts the clear bits in the first nbits bits of a bitmap.
+ *
+ * @param map the bitmap
+ * @param nbits the number of bits in the bitmap
+ * @return the number of clear bits
+ */
+static int count_clear_bits(fd_set *map, int nbits)
+{
+    const uint64_t *words = (const uint64_t*)map;
+    int n = 0;
+    for (int w = 0; w < nbits / 64; w++) {
+        n += 64 - __builtin_popcountll(words[w]);
+    }
+    // count bits of partial last word
+    for (int i = nbits - nbits % 64; i < nbits; i++) {
+        n += !FD_ISSET(i, map);
+    }
+    return n;
+}
+
+/**
+ * Returns the in-memory copy of a metadata block, and the end
+ * of the metadata region (inode map, block map, or inodes)
+ * that contains it.
+ *
+ * @param blkno the metadata block number
+ * @param end returns one past the last block of the region
+ * @return pointer to the block in memory
+ */
+static void *get_meta_blk(int blkno, int *end)
+{
+    if (blkno >= fs.inode_base) {
+        *end = fs.n_meta;
+        return (char*)fs.inodes + (size_t)(blkno - fs.inode_base) * FS_BLOCK_SIZE;
+    }
+    if (blkno >= fs.block_map_base) {
+        *end = fs.inode_base;
+        return (char*)fs.block_map + (size_t)(blkno - fs.block_map_base) * FS_BLOCK_SIZE;
+    }
+    *end = fs.block_map_base;
+    return (char*)fs.inode_map + (size_t)(blkno - fs.inode_map_base) * FS_BLOCK_SIZE;
+}
 
 /**
- * Flush dirty metadata blocks to disk.
+ * Mark a run of metadata blocks as dirty. Caller holds meta_lock.
+ *
+ * @param blkno the first metadata block number
+ * @param n the number of blocks
+ */
+static void mark_meta_run(int blkno, int n)
+{
+    for (int i = blkno; i < blkno + n; i++) {
+        if (!FD_ISSET(i, fs.dirty_map)) {
+            n_dirty++;
+        }
+        FD_SET(i, fs.dirty_map);
+    }
+    if (fs.dirty_lo >= fs.dirty_hi) {
+        fs.dirty_lo = blkno;
+        fs.dirty_hi = blkno + n;
+    } else {
+        fs.dirty_lo = min(fs.dirty_lo, blkno);
+        fs.dirty_hi = max(fs.dirty_hi, blkno + n);
+    }
+}
+
+/**
+ * Mark a metadata block as dirty.
+ *
+ * @param blkno the metadata block number
+ */
+static void mark_meta(int blkno)
+{
+    pthread_mutex_lock(&meta_lock);
+    mark_meta_run(blkno, 1);
+    pthread_mutex_unlock(&meta_lock);
+}
+
+/**
+ * Returns the number of dirty metadata blocks, including
+ * journaled blocks written since the last commit.
+ *
+ * @return the number of dirty metadata blocks
+ */
+int count_dirty_metadata(void)
+{
+    pthread_mutex_lock(&meta_lock);
+    int n = n_dirty + count_journal_blks();
+    pthread_mutex_unlock(&meta_lock);
+    return n;
+}
+
+/**
+ * Commit dirty metadata blocks to disk. Only the range of blocks
+ * marked dirty since the last commit is scanned, and each run of
+ * adjacent dirty blocks in a metadata region is added to one
+ * transaction of the metadata journal, or written in place with
+ * a single write if the volume has no journal. The directory,
+ * indirect, and extent tree blocks written since the last commit
+ * are added to the same transaction. Blocks are marked clean before
+ * they are written, so a block modified and marked during the write
+ * is written again by a later commit.
+ *
+ * Concurrent commits are grouped: while one thread commits a journal
+ * transaction, other threads that call wait for it, and the next of them
+ * commits the blocks marked dirty by all of them in one transaction.
+ * A thread returns when a transaction that began after it called
+ * has committed, or when no blocks are dirty. If the transaction
+ * fails, its blocks are marked dirty again, and it fails for all of
+ * the threads in the group unless a later transaction has committed.
+ *
+ * Errors
+ *   -EIO     - error writing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int commit_metadata(void)
+{
+    pthread_mutex_lock(&meta_lock);
+    int group = groups_started + 1;
+    while (committing) {
+        pthread_cond_wait(&commit_cond, &meta_lock);
+    }
+    if (groups_done >= group || (fs.dirty_lo >= fs.dirty_hi && count_journal_blks() == 0)) {
+        int status = (groups_done >= group && group_failed == groups_done) ? -EIO : 0;
+        pthread_mutex_unlock(&meta_lock);
+        return status;  // committed by another thread, or nothing to commit
+    }
+
+    // no room in the journal, and blocks must not be written in place
+    int status = begin_journal(n_dirty);
+    if (status < 0) {
+        pthread_mutex_unlock(&meta_lock);
+        return status;
+    }
+    int journaled = (status == 0);
+    status = 0;
+    committing = 1;
+    groups_started++;
+
+    int blkno = fs.dirty_lo, dirty_lo = fs.dirty_lo;
+    int dirty_hi = fs.dirty_hi;
+    fs.dirty_lo = fs.dirty_hi = 0;
+    while (blkno < dirty_hi) {
+        blkno = find_bit(fs.dirty_map, blkno, dirty_hi, 1);
+        if (blkno < 0) {
+            break;
+        }
+
+        // run ends at next clean block or end of region
+        int end;
+        void *buf = get_meta_blk(blkno, &end);
+        end = min(end, dirty_hi);
+        int run_end = find_bit(fs.dirty_map, blkno, end, 0);
+        if (run_end < 0) {
+            run_end = end;
+        }
+
+        for (int i = blkno; i < run_end; i++) {
+            FD_CLR(i, fs.dirty_map);
+        }
+        n_dirty -= run_end - blkno;
+        if (journaled) {
+            add_journal(blkno, run_end - blkno, buf);
+        } else if (disk->ops->write(disk, blkno, run_end - blkno, buf) != SUCCESS) {
+            mark_meta_run(blkno, run_end - blkno);  // write again next commit
+            status = -EIO;
+        }
+        blkno = run_end;
+    }
+    if (journaled) {
+        add_journal_blks();
+    } else if (write_journal_blks() < 0) {
+        status = -EIO;
+    }
+
+    // blocks are copied to the transaction, so they can be marked while it commits
+    if (journaled) {
+        pthread_mutex_unlock(&meta_lock);
+        status = commit_journal();
+        pthread_mutex_lock(&meta_lock);
+        if (status < 0) {
+            // commit the blocks of the transaction with the next one
+            if (dirty_lo < dirty_hi) {
+                mark_meta_run(dirty_lo, dirty_hi - dirty_lo);
+            }
+            abort_journal();
+        }
+    }
+    committing = 0;
+    groups_done = groups_started;
+    if (status < 0) {
+        group_failed = groups_done;
+    }
+    pthread_cond_broadcast(&commit_cond);
+    pthread_mutex_unlock(&meta_lock);
+    return status;
+}
+
+/**
+ * Flush dirty metadata blocks to disk at the end of an operation.
+ * If the writeback thread is running, the flush is deferred to it;
+ * otherwise the blocks are committed before returning.
  */
 void flush_metadata(void)
 {
-    for (int i = 0; i < fs.n_meta; i++) {
-        if (fs.dirty[i] != NULL) {
-            disk->ops->write(disk, i, 1, fs.dirty[i]);
-            fs.dirty[i] = NULL;
+    if (!defer_writeback()) {
+        commit_metadata();
+    }
+}
+
+/**
+ * Makes the metadata durable at its home locations: commits the
+ * dirty metadata blocks, and checkpoints the metadata journal.
+ *
+ * Errors
+ *   -EIO     - error writing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int sync_metadata(void)
+{
+    int status = commit_metadata();
+    pthread_mutex_lock(&meta_lock);
+    while (committing) {
+        pthread_cond_wait(&commit_cond, &meta_lock);
+    }
+    if (checkpoint_journal() < 0) {
+        status = -EIO;
+    }
+    pthread_mutex_unlock(&meta_lock);
+    return status;
+}
+
+/**
+ * Reads a directory, indirect, or extent tree block of a file. If the
+ * volume has a journal, the latest copy of the block may be in memory,
+ * not yet written home.
+ *
+ * @param blkno the block number
+ * @param buf storage for the block
+ * @return 0 if successful, or -1 if error
+ */
+int read_journaled_blk(int blkno, void *buf)
+{
+    if (fs.journal_sz > 0) {
+        pthread_mutex_lock(&meta_lock);
+        int found = read_journal_blk(blkno, buf);
+        pthread_mutex_unlock(&meta_lock);
+        if (found) {
+            return 0;
+        }
+    }
+    return (disk->ops->read(disk, blkno, 1, buf) < 0) ? -1 : 0;
+}
+
+/**
+ * Writes a directory, indirect, or extent tree block of a file. If
+ * the volume has a journal, the block is committed to it with the
+ * metadata by the next flush rather than written in place, so it is
+ * not written ahead of the inode and bitmap changes committed with it.
+ *
+ * @param blkno the block number
+ * @param buf the contents of the block
+ * @return 0 if successful, or -1 if error
+ */
+int write_journaled_blk(int blkno, void *buf)
+{
+    if (fs.journal_sz > 0) {
+        pthread_mutex_lock(&meta_lock);
+        int status = write_journal_blk(blkno, buf);
+        pthread_mutex_unlock(&meta_lock);
+        if (status == 0) {
+            return 0;
         }
     }
+    return (disk->ops->write(disk, blkno, 1, buf) < 0) ? -1 : 0;
+}
+
+/**
+ * Revokes journaled copies of a run of blocks being freed, so they
+ * are neither read nor replayed once the blocks are reused. Called
+ * with the block map locked, before the blocks can be reallocated.
+ *
+ * @param blknos the block numbers, or NULL for a run
+ * @param blkno the first block number of a run
+ * @param n the number of blocks
+ */
+static void revoke_blks(const uint32_t *blknos, int blkno, int n)
+{
+    if (fs.journal_sz == 0) {
+        return;
+    }
+    pthread_mutex_lock(&meta_lock);
+    for (int i = 0; i < n; i++) {
+        int b = (blknos != NULL) ? (int)blknos[i] : blkno + i;
+        if (b != 0) {
+            revoke_journal_blk(b);
+        }
+    }
+    pthread_mutex_unlock(&meta_lock);
 }
 
 /**
@@ -34,18 +454,87 @@ void flush_metadata(void)
  */
 int get_free_blk(void)
 {
-    for (int i = 0; i < fs.n_blocks; i++) {
-        if (!FD_ISSET(i, fs.block_map)) {
-        	// mark block allocated
-            FD_SET(i, fs.block_map);
+    pthread_mutex_lock(&block_map_lock);
+    int i = find_clear_bit_from(fs.block_map, fs.blk_cursor, fs.n_blocks);
+    if (i < 0) {
+        pthread_mutex_unlock(&block_map_lock);
+        return 0;
+    }
+
+    // mark block allocated
+    FD_SET(i, fs.block_map);
+    fs.blk_cursor = i + 1;
+    fs.n_blocks_free--;
 
-            // mark block map block dirty
-            int n = i / BITS_PER_BLK;
-            fs.dirty[fs.block_map_base + n] = (void*)fs.block_map + n*FS_BLOCK_SIZE;
-            return i;
+    // mark block map block dirty
+    mark_meta(fs.block_map_base + i / BITS_PER_BLK);
+    pthread_mutex_unlock(&block_map_lock);
+    return i;
+}
+
+/**
+ * Gets a run of up to n contiguous free block numbers from the
+ * free list. Looks for a run of n free blocks starting at or after
+ * the goal block, wrapping around to the beginning of the volume.
+ * If there is no run of n free blocks, gets the longest run found.
+ *
+ * @param goal the preferred first block, or 0 for no preference
+ * @param n the number of blocks wanted
+ * @param nblks returns the number of blocks in the run
+ * @return first block number of run or 0 if none available
+ */
+int get_free_blks(int goal, int n, int *nblks)
+{
+    pthread_mutex_lock(&block_map_lock);
+    if (goal <= 0 || goal >= fs.n_blocks) {
+        goal = (fs.blk_cursor < fs.n_blocks) ? fs.blk_cursor : 0;
+    }
+
+    // search [goal, n_blocks) and then [0, goal) for longest run
+    int best = -1, best_len = 0;
+    for (int pass = 0; pass < 2 && best_len < n; pass++) {
+        int start = (pass == 0) ? goal : 0;
+        int end = (pass == 0) ? fs.n_blocks : goal;
+        while (start < end) {
+            int i = find_clear_bit(fs.block_map, start, end);
+            if (i < 0) {
+                break;
+            }
+            // run ends at next allocated block
+            int lim = min(i + n, fs.n_blocks);
+            int j = find_bit(fs.block_map, i, lim, 1);
+            if (j < 0) {
+                j = lim;
+            }
+            if (j - i > best_len) {
+                best = i;
+                best_len = j - i;
+                if (best_len == n) {
+                    break;
+                }
+            }
+            start = j;
         }
     }
-    return 0;
+    if (best < 0) {
+        pthread_mutex_unlock(&block_map_lock);
+        *nblks = 0;
+        return 0;
+    }
+
+    // mark blocks of run allocated and block map blocks dirty
+    for (int i = best; i < best + best_len; i++) {
+        FD_SET(i, fs.block_map);
+    }
+    for (int m = best / BITS_PER_BLK; m <= (best + best_len - 1) / BITS_PER_BLK; m++) {
+        mark_meta(fs.block_map_base + m);
+    }
+    fs.blk_cursor = best + best_len;
+    fs.n_blocks_free -= best_len;
+    pthread_mutex_unlock(&block_map_lock);
+
+    *nblks = best_len;
+    return best;
 }
 
 /**
@@ -56,11 +545,74 @@ int get_free_blk(void)
 void return_blk(int blkno)
 {
 	// mark block free
-    FD_CLR(blkno, fs.block_map);
+    pthread_mutex_lock(&block_map_lock);
+    revoke_blks(NULL, blkno, 1);
+    if (FD_ISSET(blkno, fs.block_map)) {
+        FD_CLR(blkno, fs.block_map);
+        fs.n_blocks_free++;
+    }
 
     // mark block map block dirty
-    int n = blkno / BITS_PER_BLK;
-    fs.dirty[fs.block_map_base + n] = (void*)fs.block_map + n*FS_BLOCK_SIZE;
+    mark_meta(fs.block_map_base + blkno / BITS_PER_BLK);
+    pthread_mutex_unlock(&block_map_lock);
+}
+
+/**
+ * Return the blocks in an array of block numbers to the free
+ * list, skipping 0 entries. The block map is locked once for
+ * all of the blocks, and each block map block is marked dirty
+ * once for a run of blocks that it covers.
+ *
+ * @param blknos the block numbers
+ * @param n the number of block numbers
+ */
+void return_blks(const uint32_t *blknos, int n)
+{
+    pthread_mutex_lock(&block_map_lock);
+    revoke_blks(blknos, 0, n);
+    int dirty = -1;  // block map block last marked dirty
+    for (int i = 0; i < n; i++) {
+        int blkno = blknos[i];
+        if (blkno == 0) {
+            continue;
+        }
+        if (FD_ISSET(blkno, fs.block_map)) {
+            FD_CLR(blkno, fs.block_map);
+            fs.n_blocks_free++;
+        }
+        if (blkno / BITS_PER_BLK != dirty) {
+            dirty = blkno / BITS_PER_BLK;
+            mark_meta(fs.block_map_base + dirty);
+        }
+    }
+    pthread_mutex_unlock(&block_map_lock);
+}
+
+/**
+ * Return a run of contiguous blocks to the free list. The block
+ * map is locked once for all of the blocks, and each block map
+ * block that covers the run is marked dirty once.
+ *
+ * @param blkno the block number of the first block
+ * @param n the number of blocks
+ */
+void return_blk_run(int blkno, int n)
+{
+    if (n <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&block_map_lock);
+    revoke_blks(NULL, blkno, n);
+    for (int i = blkno; i < blkno + n; i++) {
+        if (FD_ISSET(i, fs.block_map)) {
+            FD_CLR(i, fs.block_map);
+            fs.n_blocks_free++;
+        }
+    }
+    for (int m = blkno / BITS_PER_BLK; m <= (blkno + n - 1) / BITS_PER_BLK; m++) {
+        mark_meta(fs.block_map_base + m);
+    }
+    pthread_mutex_unlock(&block_map_lock);
 }
 
 /**
@@ -91,18 +643,22 @@ int is_free_inode(int inum) {
  */
 int get_free_inode(void)
 {
-    for (int i = 0; i < fs.n_inodes; i++) {
-        if (!FD_ISSET(i, fs.inode_map)) {
-        	// mark inode allocated
-            FD_SET(i, fs.inode_map);
-
-            // mark inode map block dirty
-            int n = i / BITS_PER_BLK;
-            fs.dirty[fs.inode_map_base + n] = (void*)fs.inode_map + n*FS_BLOCK_SIZE;
-            return i;
-        }
+    pthread_mutex_lock(&inode_map_lock);
+    int i = find_clear_bit_from(fs.inode_map, fs.inode_cursor, fs.n_inodes);
+    if (i < 0) {
+        pthread_mutex_unlock(&inode_map_lock);
+        return 0;
     }
-    return 0;
+
+    // mark inode allocated
+    FD_SET(i, fs.inode_map);
+    fs.inode_cursor = i + 1;
+    fs.n_inodes_free--;
+
+    // mark inode map block dirty
+    mark_meta(fs.inode_map_base + i / BITS_PER_BLK);
+    pthread_mutex_unlock(&inode_map_lock);
+    return i;
 }
 
 /**
@@ -113,11 +669,69 @@ int get_free_inode(void)
 void return_inode(int inum)
 {
 	// mark inode free
-    FD_CLR(inum, fs.inode_map);
+    pthread_mutex_lock(&inode_map_lock);
+    if (FD_ISSET(inum, fs.inode_map)) {
+        FD_CLR(inum, fs.inode_map);
+        fs.n_inodes_free++;
+    }
 
     // mark inode map block dirty
-    int n = inum / BITS_PER_BLK;
-    fs.dirty[fs.inode_map_base + n] = (void*)fs.inode_map + n*FS_BLOCK_SIZE;
+    mark_meta(fs.inode_map_base + inum / BITS_PER_BLK);
+    pthread_mutex_unlock(&inode_map_lock);
+
+    // a reused inode number has a new generation
+    pthread_mutex_lock(&inode_ref_lock);
+    fs.inode_refs[inum].generation++;
+    fs.inode_refs[inum].orphan = 0;
+    pthread_mutex_unlock(&inode_ref_lock);
+}
+
+/**
+ * Counts the free blocks in the block map.
+ *
+ * @return the number of free blocks
+ */
+int count_free_blks(void)
+{
+    return count_clear_bits(fs.block_map, fs.n_blocks);
+}
+
+/**
+ * Counts the free inodes in the inode map.
+ *
+ * @return the number of free inodes
+ */
+int count_free_inodes(void)
+{
+    return count_clear_bits(fs.inode_map, fs.n_inodes);
+}
+
+/**
+ * Checks that the free block and free inode counters
+ * agree with a full count of the block and inode maps,
+ * and reports any difference.
+ *
+ * @return 1 (true) if counters are consistent, 0 (false) if not
+ */
+int check_free_counts(void)
+{
+    pthread_mutex_lock(&block_map_lock);
+    pthread_mutex_lock(&inode_map_lock);
+    int n_blocks_free = count_free_blks();
+    int n_inodes_free = count_free_inodes();
+    int blocks_ok = (n_blocks_free == fs.n_blocks_free);
+    int inodes_ok = (n_inodes_free == fs.n_inodes_free);
+    if (n_blocks_free != fs.n_blocks_free) {
+        fprintf(stderr, "free block count %d, block map has %d free\n",
+                fs.n_blocks_free, n_blocks_free);
+    }
+    if (n_inodes_free != fs.n_inodes_free) {
+        fprintf(stderr, "free inode count %d, inode map has %d free\n",
+                fs.n_inodes_free, n_inodes_free);
+    }
+    pthread_mutex_unlock(&inode_map_lock);
+    pthread_mutex_unlock(&block_map_lock);
+    return blocks_ok && inodes_ok;
 }
 
 /**
@@ -128,7 +742,138 @@ void return_inode(int inum)
 void mark_inode(int inum)
 {
 	// mark inode block dirty
-    long n = inum / INODES_PER_BLK;
-    fs.dirty[fs.inode_base + n] = (void*)fs.inodes + n*FS_BLOCK_SIZE;
+    mark_meta(fs.inode_base + inum / INODES_PER_BLK);
+}
+
+/**
+ * Allocate and initialize the reader-writer locks, the in-memory
+ * references, and the allocated block counts of the inodes.
+ */
+void init_inode_locks(void)
+{
+    fs.inode_locks = malloc(fs.n_inodes * sizeof(pthread_rwlock_t));
+    for (int i = 0; i < fs.n_inodes; i++) {
+        pthread_rwlock_init(&fs.inode_locks[i], NULL);
+    }
+    fs.inode_refs = calloc(fs.n_inodes, sizeof(struct inode_ref));
+    fs.inode_nblks = malloc(fs.n_inodes * sizeof(int));
+    for (int i = 0; i < fs.n_inodes; i++) {
+        fs.inode_nblks[i] = -1;  // counted when first needed
+    }
+}
+
+/**
+ * Adds kernel references to an inode: lookups that the kernel
+ * will later forget, and open handles that it will release.
+ *
+ * @param inum the inode number
+ * @param nlookup the number of lookups to add
+ * @param nopen the number of open handles to add
+ */
+void ref_inode(int inum, uint64_t nlookup, int nopen)
+{
+    pthread_mutex_lock(&inode_ref_lock);
+    fs.inode_refs[inum].nlookup += nlookup;
+    fs.inode_refs[inum].nopen += nopen;
+    pthread_mutex_unlock(&inode_ref_lock);
 }
 
+/**
+ * Removes kernel references to an inode.
+ *
+ * @param inum the inode number
+ * @param nlookup the number of lookups forgotten
+ * @param nopen the number of open handles released
+ * @return 1 if the inode is an orphan with no references left,
+ *   which the caller must free, or 0 if not
+ */
+int unref_inode(int inum, uint64_t nlookup, int nopen)
+{
+    pthread_mutex_lock(&inode_ref_lock);
+    struct inode_ref *ref = &fs.inode_refs[inum];
+    ref->nlookup = (nlookup < ref->nlookup) ? ref->nlookup - nlookup : 0;
+    ref->nopen = max(0, ref->nopen - nopen);
+    int release = ref->orphan && ref->nlookup == 0 && ref->nopen == 0;
+    if (release) {
+        ref->orphan = 0;  // freed once, by the caller
+    }
+    pthread_mutex_unlock(&inode_ref_lock);
+    return release;
+}
+
+/**
+ * Marks an unlinked inode as an orphan if the kernel still refers
+ * to it, so that it is freed when the last reference is removed.
+ *
+ * @param inum the inode number
+ * @return 1 if the inode is an orphan, or 0 if it can be freed now
+ */
+int orphan_inode(int inum)
+{
+    pthread_mutex_lock(&inode_ref_lock);
+    struct inode_ref *ref = &fs.inode_refs[inum];
+    ref->orphan = ref->nlookup > 0 || ref->nopen > 0;
+    int orphan = ref->orphan;
+    pthread_mutex_unlock(&inode_ref_lock);
+    return orphan;
+}
+
+/**
+ * Determines whether an inode is an unlinked orphan.
+ *
+ * @param inum the inode number
+ * @return 1 (true) or 0 (false)
+ */
+int is_orphan_inode(int inum)
+{
+    pthread_mutex_lock(&inode_ref_lock);
+    int orphan = fs.inode_refs[inum].orphan;
+    pthread_mutex_unlock(&inode_ref_lock);
+    return orphan;
+}
+
+/**
+ * Returns the generation of an inode number, which is incremented
+ * each time the inode is freed, so that the kernel can distinguish
+ * a reused inode number from the inode it referred to before.
+ *
+ * @param inum the inode number
+ * @return the generation
+ */
+uint64_t get_inode_generation(int inum)
+{
+    pthread_mutex_lock(&inode_ref_lock);
+    uint64_t generation = fs.inode_refs[inum].generation;
+    pthread_mutex_unlock(&inode_ref_lock);
+    return generation;
+}
+
+/**
+ * Lock an inode for reading its content or attributes.
+ *
+ * @param inum the inode number
+ */
+void read_lock_inode(int inum)
+{
+    pthread_rwlock_rdlock(&fs.inode_locks[inum]);
+}
+
+/**
+ * Lock an inode for modifying its content or attributes.
+ *
+ * @param inum the inode number
+ */
+void write_lock_inode(int inum)
+{
+    pthread_rwlock_wrlock(&fs.inode_locks[inum]);
+}
+
+/**
+ * Unlock an inode locked for reading or writing.
+ *
+ * @param inum the inode number
+ */
+void unlock_inode(int inum)
+{
+    pthread_rwlock_unlock(&fs.inode_locks[inum]);
+}
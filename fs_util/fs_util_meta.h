@@ -11,11 +11,78 @@
 #ifndef FS_UTIL_META_H_
 #define FS_UTIL_META_H_
 
+#include <stdint.h>
+
 /**
- * Flush dirty metadata blocks to disk.
+ * Sets the block size of the volume, and derives the numbers
+ * of directory entries, inodes, block pointers, bitmap bits,
+ * and directory index entries per block.
+ *
+ * @param blk_size the block size in bytes
+ */
+void set_block_size(int blk_size);
+
+/**
+ * Commit dirty metadata blocks to disk. Commits by concurrent
+ * threads are group committed to the metadata journal.
+ *
+ * Errors
+ *   -EIO     - error writing blocks; the blocks are marked dirty
+ *              again, to be written by the next commit
+ *
+ * @return 0 if successful, or -error
+ */
+int commit_metadata(void);
+
+/**
+ * Flush dirty metadata blocks to disk at the end of an operation.
+ * If the writeback thread is running, the flush is deferred to it;
+ * otherwise the blocks are committed before returning.
  */
 void flush_metadata(void);
 
+/**
+ * Makes the metadata durable at its home locations: commits the
+ * dirty metadata blocks, and checkpoints the metadata journal.
+ *
+ * Errors
+ *   -EIO     - error writing blocks
+ *
+ * @return 0 if successful, or -error
+ */
+int sync_metadata(void);
+
+/**
+ * Returns the number of dirty metadata blocks, including
+ * journaled blocks written since the last commit.
+ *
+ * @return the number of dirty metadata blocks
+ */
+int count_dirty_metadata(void);
+
+/**
+ * Reads a directory, indirect, or extent tree block of a file. If the
+ * volume has a journal, the latest copy of the block may be in memory,
+ * not yet written home.
+ *
+ * @param blkno the block number
+ * @param buf storage for the block
+ * @return 0 if successful, or -1 if error
+ */
+int read_journaled_blk(int blkno, void *buf);
+
+/**
+ * Writes a directory, indirect, or extent tree block of a file. If
+ * the volume has a journal, the block is committed to it with the
+ * metadata by the next flush rather than written in place, so it is
+ * not written ahead of the inode and bitmap changes committed with it.
+ *
+ * @param blkno the block number
+ * @param buf the contents of the block
+ * @return 0 if successful, or -1 if error
+ */
+int write_journaled_blk(int blkno, void *buf);
+
 /**
  * Gets a free block number from the free list.
  *
@@ -23,6 +90,19 @@ void flush_metadata(void);
  */
 int get_free_blk(void);
 
+/**
+ * Gets a run of up to n contiguous free block numbers from the
+ * free list. Looks for a run of n free blocks starting at or after
+ * the goal block, wrapping around to the beginning of the volume.
+ * If there is no run of n free blocks, gets the longest run found.
+ *
+ * @param goal the preferred first block, or 0 for no preference
+ * @param n the number of blocks wanted
+ * @param nblks returns the number of blocks in the run
+ * @return first block number of run or 0 if none available
+ */
+int get_free_blks(int goal, int n, int *nblks);
+
 /**
  * Return a block to the free list.
  *
@@ -30,6 +110,25 @@ int get_free_blk(void);
  */
 void return_blk(int blkno);
 
+/**
+ * Return the blocks in an array of block numbers to the free
+ * list, skipping 0 entries. The block map is locked once for
+ * all of the blocks.
+ *
+ * @param blknos the block numbers
+ * @param n the number of block numbers
+ */
+void return_blks(const uint32_t *blknos, int n);
+
+/**
+ * Return a run of contiguous blocks to the free list. The block
+ * map is locked once for all of the blocks.
+ *
+ * @param blkno the block number of the first block
+ * @param n the number of blocks
+ */
+void return_blk_run(int blkno, int n);
+
 /**
  * Determines whether block with blkno is free.
  *
@@ -62,6 +161,29 @@ void return_inode(int inum);
 int is_free_inode(int inum);
 
 
+/**
+ * Counts the free blocks in the block map.
+ *
+ * @return the number of free blocks
+ */
+int count_free_blks(void);
+
+/**
+ * Counts the free inodes in the inode map.
+ *
+ * @return the number of free inodes
+ */
+int count_free_inodes(void);
+
+/**
+ * Checks that the free block and free inode counters
+ * agree with a full count of the block and inode maps,
+ * and reports any difference.
+ *
+ * @return 1 (true) if counters are consistent, 0 (false) if not
+ */
+int check_free_counts(void);
+
 /**
  * Mark a inode as dirty.
  *
@@ -69,5 +191,82 @@ int is_free_inode(int inum);
  */
 void mark_inode(int inum);
 
+/**
+ * Allocate and initialize the reader-writer locks, the in-memory
+ * references, and the allocated block counts of the inodes.
+ */
+void init_inode_locks(void);
+
+/**
+ * Adds kernel references to an inode: lookups that the kernel
+ * will later forget, and open handles that it will release.
+ *
+ * @param inum the inode number
+ * @param nlookup the number of lookups to add
+ * @param nopen the number of open handles to add
+ */
+void ref_inode(int inum, uint64_t nlookup, int nopen);
+
+/**
+ * Removes kernel references to an inode.
+ *
+ * @param inum the inode number
+ * @param nlookup the number of lookups forgotten
+ * @param nopen the number of open handles released
+ * @return 1 if the inode is an orphan with no references left,
+ *   which the caller must free, or 0 if not
+ */
+int unref_inode(int inum, uint64_t nlookup, int nopen);
+
+/**
+ * Marks an unlinked inode as an orphan if the kernel still refers
+ * to it, so that it is freed when the last reference is removed.
+ *
+ * @param inum the inode number
+ * @return 1 if the inode is an orphan, or 0 if it can be freed now
+ */
+int orphan_inode(int inum);
+
+/**
+ * Determines whether an inode is an unlinked orphan.
+ *
+ * @param inum the inode number
+ * @return 1 (true) or 0 (false)
+ */
+int is_orphan_inode(int inum);
+
+/**
+ * Returns the generation of an inode number, which is incremented
+ * each time the inode is freed, so that the kernel can distinguish
+ * a reused inode number from the inode it referred to before.
+ *
+ * @param inum the inode number
+ * @return the generation
+ */
+uint64_t get_inode_generation(int inum);
+
+/**
+ * Lock an inode for reading its content or attributes.
+ *
+ * @param inum the inode number
+ */
+void read_lock_inode(int inum);
+
+/**
+ * Lock an inode for modifying its content or attributes.
+ * Directory operations lock the parent directory before
+ * the inode of an entry.
+ *
+ * @param inum the inode number
+ */
+void write_lock_inode(int inum);
+
+/**
+ * Unlock an inode locked for reading or writing.
+ *
+ * @param inum the inode number
+ */
+void unlock_inode(int inum);
+
 
 #endif /* FS_UTIL_META_H_ */
@@ -8,34 +8,35 @@
  * Philip Gust, March 2019, March 2020
  */
 
-#include <limits.h>
-#include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 
 #include "fs_util_dir.h"
 #include "fs_util_path.h"
 #include "fs_util_vol.h"
-#include "split.h"
 
 /** File path delimiter character */
 const char* PATH_DELIM = "/";
 
 /**
- * State information for path resolution.
+ * State information for path resolution. Path elements
+ * are read from the path in place, one at a time.
  */
 struct path_state {
-    /** array of path tokens */
-    char** pathtoks;
-    /** length of path array */
-    int pathlen;
+    /** next character of path to resolve */
+    const char* next;
+    /** 1 if path ends in path separator, so leaf element is "." */
+    int dotleaf;
     /** 1 to omit leaf element, 0 otherwise */
     int noleaf;
-    /** current path array index */
-    int idx;
     /** symlink count */
     int symcount;
     /** current path inum */
     int inum;
+    /** current path element, or "" if none */
+    char tok[FS_FILENAME_SIZE];
+    /** 1 if current path element is too long for a directory entry */
+    int toolong;
 };
 
 /**
@@ -51,32 +52,56 @@ struct path_state {
 static void init_path_state(struct path_state* ps, const char* path, int noleaf) {
     ps->inum = fs.root_inode;
     ps->symcount = 0;
-    ps->idx = 0;
+    ps->next = path;
+    ps->tok[0] = '\0';
+    ps->toolong = 0;
 
-    // add '.' to end of path if ends with PATH_DELIM
-    char lpath[strlen(path)+2];
-    strcpy(lpath, path);
+    // leaf is '.' if path ends with PATH_DELIM
     int idx = strlen(path) - strlen(PATH_DELIM);
-    if (idx >= 0) {
-        if (strstr(path+idx, PATH_DELIM) != NULL) { // ends with path delimiter
-            strcat(lpath, ".");  // append "." current directory
+    ps->dotleaf = (idx >= 0) && (strcmp(path+idx, PATH_DELIM) == 0);
+
+    ps->noleaf = (noleaf != 0);  // 1 if noleaf, 0 otherwise
+}
+
+/**
+ * Reads the next path element into the path state.
+ * Empty elements between path separators are skipped.
+ *
+ * @param ps the path state
+ * @return 1 if element read, 0 if no more elements
+ */
+static int next_path_token(struct path_state* ps) {
+    ps->next += strspn(ps->next, PATH_DELIM);
+    size_t len = strcspn(ps->next, PATH_DELIM);
+    if (len == 0) {
+        if (!ps->dotleaf) {
+            return 0;
         }
+        // implicit "." leaf of path ending in path separator
+        ps->dotleaf = 0;
+        strcpy(ps->tok, ".");
+        ps->toolong = 0;
+        return 1;
     }
 
-    ps->noleaf = (noleaf != 0);  // 1 if noleaf, 0 otherwise
-    ps->pathlen = split(lpath, NULL, 0, PATH_DELIM);  // count path names
-    ps->pathtoks = malloc(ps->pathlen*sizeof(char*));
-    split(lpath, ps->pathtoks, ps->pathlen, PATH_DELIM);
+    // copy element, truncated to fit a directory entry
+    ps->toolong = (len > FS_FILENAME_SIZE-1);
+    size_t n = ps->toolong ? FS_FILENAME_SIZE-1 : len;
+    memcpy(ps->tok, ps->next, n);
+    ps->tok[n] = '\0';
+    ps->next += len;
+    return 1;
 }
 
 /**
- * Release path state struct resources.
+ * Determines whether the current path element is the leaf.
  *
  * @param ps the path state
+ * @return 1 (true) if current element is the leaf, 0 (false) otherwise
  */
-static void release_path_state(struct path_state* ps) {
-    free_split_tokens(ps->pathtoks, ps->pathlen);
-    memset(ps, 0, sizeof(struct path_state));
+static int is_path_leaf(struct path_state* ps) {
+    ps->next += strspn(ps->next, PATH_DELIM);
+    return (*ps->next == '\0') && !ps->dotleaf;
 }
 
 /**
@@ -87,11 +112,17 @@ static void release_path_state(struct path_state* ps) {
  * @return 0 if finished, < 0 if error, > 0 for next inode number
  */
 static int next_path_state(struct path_state* ps, int inum) {
-    if (ps->idx >= (ps->pathlen - ps->noleaf)) {
+    if (!next_path_token(ps)) {
+        return 0;
+    }
+    if (ps->toolong) {
+        return -ENAMETOOLONG;  // cannot be a directory entry name
+    }
+    if (ps->noleaf && is_path_leaf(ps)) {
         return 0;
     }
     // get inode for named element
-    ps->inum = get_dir_entry_inode(inum, ps->pathtoks[ps->idx]);
+    ps->inum = get_dir_entry_inode(inum, ps->tok);
     return ps->inum;
 }
 
@@ -102,6 +133,7 @@ static int next_path_state(struct path_state* ps, int inum) {
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENAMETOOLONG - a component of path too long for a directory entry
  *
  * @param ps the file path state
  * @return inum of path inode or error
@@ -115,7 +147,6 @@ static int get_inode_of_path_state(struct path_state* ps)
         // resolve next symlink path element
         status = 0;
         inum = ps->inum;	// accept inode of current token
-        ps->idx++;	// advance to next path token
     }
 
     // return inum or error status
@@ -129,6 +160,7 @@ static int get_inode_of_path_state(struct path_state* ps)
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENAMETOOLONG - a component of path too long for a directory entry
  *
  * @param path the file path
  * @return inode of path node or error
@@ -139,9 +171,7 @@ int get_inode_of_path(const char* path)
     struct path_state ps;
     init_path_state(&ps, path, 0);	// include leaf
 
-    int inum = get_inode_of_path_state(&ps);
-    release_path_state(&ps);
-    return inum;
+    return get_inode_of_path_state(&ps);
 }
 
 /**
@@ -153,6 +183,7 @@ int get_inode_of_path(const char* path)
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENAMETOOLONG - a component of path too long for a directory entry
  *
  * @param path the file path
  * @param leaf pointer to space for FS_FILENAME_SIZE leaf name
@@ -167,9 +198,8 @@ int get_inode_of_path_dir(const char* path, char* leaf)
 
     // if resolution successful, record path leaf
     if (inum > 0) {
-        strcpy(leaf, (ps.pathlen == 0) ? "" : ps.pathtoks[ps.pathlen-1]);
+        strcpy(leaf, ps.tok);
     }
 
-    release_path_state(&ps);
     return inum;
 }
@@ -26,6 +26,7 @@ extern const char* PATH_DELIM;
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENAMETOOLONG - a component of path too long for a directory entry
  *
  * @param path the file path
  * @param leaf pointer to space for FS_FILENAME_SIZE leaf name
@@ -40,6 +41,7 @@ int get_inode_of_path_dir(const char* path, char* leaf);
  * Errors
  *   -ENOENT  - a component of the path is not present.
  *   -ENOTDIR - an intermediate component of path not a directory
+ *   -ENAMETOOLONG - a component of path too long for a directory entry
  *
  * @param path the file path
  * @return inode of path node or error
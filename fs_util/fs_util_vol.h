@@ -11,6 +11,8 @@
 #ifndef FS_UTIL_VOL_H_
 #define FS_UTIL_VOL_H_
 
+#include <pthread.h>
+#include <stdint.h>
 #include <sys/select.h>
 
 #include "fsx600.h"
@@ -19,16 +21,60 @@
  * disk access - the global variable 'disk' points to a blkdev
  * structure which has been initialized to access the image file.
  *
- * NOTE - blkdev access is in terms of BLOCK_SIZE byte blocks
+ * NOTE - blkdev access is in terms of FS_BLOCK_SIZE byte blocks;
+ * a volume with blocks larger than BLOCK_SIZE is accessed through
+ * a device layered by blkscale_create()
  */
 extern struct blkdev *disk;
 
 
+/** in-memory references to an inode by the FUSE kernel module */
+struct inode_ref {
+	/** number of lookups the kernel has not yet forgotten */
+	uint64_t nlookup;
+
+	/** number of open file and directory handles */
+	int nopen;
+
+	/** 1 if unlinked while referenced, and freed when unreferenced */
+	int orphan;
+
+	/** generation of the inode number, incremented when it is freed */
+	uint64_t generation;
+};
+
 /** information about ext2 fs volume */
 struct ext2_fs {
+	/** block size in bytes from superblock */
+	int blk_size;
+
+	/** directory entries per block */
+	int dirents_per_blk;
+
+	/** inodes per block */
+	int inodes_per_blk;
+
+	/** block pointers per block */
+	int ptrs_per_blk;
+
+	/** bits per bitmap block */
+	int bits_per_blk;
+
+	/** entries per directory index block */
+	int dx_entries_per_blk;
+
+	/** entries per extent tree block */
+	int extents_per_blk;
+
 	/** number of metadata blocks */
 	int n_meta;
 
+	/** blkno of first metadata journal block */
+	int journal_base;
+
+	/** number of metadata journal blocks, 0 for no journal */
+	int journal_sz;
+
 	/** blkno of first inode map block */
 	int inode_map_base;
 
@@ -56,13 +102,52 @@ struct ext2_fs {
 	/** number of available blocks from superblock */
 	int n_blocks;
 
-	/** array of dirty metadata blocks to write */
-	void **dirty;
+	/** block number at which to start search for a free block */
+	int blk_cursor;
+
+	/** inode number at which to start search for a free inode */
+	int inode_cursor;
+
+	/** number of free blocks in block map */
+	int n_blocks_free;
+
+	/** number of free inodes in inode map */
+	int n_inodes_free;
+
+	/** bitmap of dirty metadata blocks to write */
+	fd_set *dirty_map;
+
+	/** range [dirty_lo, dirty_hi) of metadata blocks that may be dirty */
+	int dirty_lo, dirty_hi;
+
+	/** reader-writer lock for each inode */
+	pthread_rwlock_t *inode_locks;
+
+	/** kernel references and generation of each inode */
+	struct inode_ref *inode_refs;
+
+	/** number of blocks allocated to each inode, or -1 if not yet counted */
+	int *inode_nblks;
 };
 
 /** Instance of ex2 fs structure */
 extern struct ext2_fs fs;
 
+/** file system block size in bytes */
+#define FS_BLOCK_SIZE (fs.blk_size)
+/** directory entries per block */
+#define DIRENTS_PER_BLK (fs.dirents_per_blk)
+/** inodes per block */
+#define INODES_PER_BLK (fs.inodes_per_blk)
+/** block pointers per block */
+#define PTRS_PER_BLK (fs.ptrs_per_blk)
+/** bits per bitmap block */
+#define BITS_PER_BLK (fs.bits_per_blk)
+/** entries per directory index block */
+#define DX_ENTRIES_PER_BLK (fs.dx_entries_per_blk)
+/** entries per extent tree block */
+#define EXTENTS_PER_BLK (fs.extents_per_blk)
+
 
 
 #endif /* FS_UTIL_VOL_H_ */
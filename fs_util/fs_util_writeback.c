@@ -0,0 +1,242 @@
+/*
+ * fs_util_writeback.c
+ *
+ * description: background writeback functions for CS 5600 / 7600 file system
+ *
+ * When writeback is configured, operations that modify the volume do
+ * not write back their metadata before they return. flush_metadata()
+ * defers to a writeback thread instead, which commits the dirty
+ * metadata and flushes the cached data blocks once the oldest of them
+ * has been dirty for the age threshold, or as soon as the dirty share
+ * of the metadata or of the block cache reaches the ratio threshold.
+ * fsync, release of a file opened for writing, and unmounting the
+ * volume write back and flush synchronously, so their data and
+ * metadata are durable. An error writing back in the thread is kept
+ * and reported by the next synchronous writeback.
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "fs_util_meta.h"
+#include "fs_util_vol.h"
+#include "fs_util_writeback.h"
+#include "blkcache.h"
+#include "blkdev.h"
+
+/** lock for writeback state */
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** signaled when blocks become dirty, thresholds are exceeded, or on stop */
+static pthread_cond_t wb_cond = PTHREAD_COND_INITIALIZER;
+
+/** the writeback thread */
+static pthread_t wb_thread;
+
+/** dirty age threshold in ms, or 0 if writeback not configured */
+static int wb_age_ms;
+
+/** dirty ratio threshold in percent */
+static int wb_ratio;
+
+/** block cache device, or NULL if none */
+static struct blkdev *wb_cache;
+
+/** 1 while the writeback thread is running, and 1 when it must stop */
+static int wb_running, wb_stopping;
+
+/** 1 if blocks were dirtied since the last writeback, and when the first was */
+static int wb_dirty;
+static struct timespec wb_since;
+
+/** 1 if a dirty ratio threshold was exceeded since the last writeback */
+static int wb_kick;
+
+/** error of a writeback by the thread, until reported by sync_writeback() */
+static int wb_error;
+
+/**
+ * Writes back dirty cached data blocks and metadata, and makes
+ * them durable: the data is flushed before the metadata that
+ * refers to it is committed, and the device is flushed again.
+ *
+ * @return 0 if successful, or -EIO if error
+ */
+static int write_back(void)
+{
+    int status = 0;
+    if (disk->ops->flush(disk, 0, fs.n_blocks) != SUCCESS) {
+        status = -EIO;
+    }
+    if (commit_metadata() < 0) {
+        status = -EIO;
+    }
+    if (disk->ops->flush(disk, 0, fs.n_meta) != SUCCESS) {
+        status = -EIO;
+    }
+    return status;
+}
+
+/**
+ * Configures background writeback, before the volume is mounted.
+ * Dirty metadata and cached data blocks are written back when the
+ * oldest has been dirty for age_ms ms, or when ratio percent of the
+ * metadata blocks or of the block cache is dirty.
+ *
+ * @param age_ms the dirty age threshold in ms
+ * @param ratio the dirty ratio threshold in percent
+ * @param cache the block cache device, or NULL if none
+ */
+void configure_writeback(int age_ms, int ratio, struct blkdev *cache)
+{
+    wb_age_ms = age_ms;
+    wb_ratio = ratio;
+    wb_cache = cache;
+}
+
+/**
+ * Writeback thread: waits until blocks are dirty, and then until the
+ * oldest reaches the age threshold or a ratio threshold is exceeded,
+ * and writes back the dirty data and metadata.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *writeback_thread(void *arg)
+{
+    pthread_mutex_lock(&wb_lock);
+    while (!wb_stopping) {
+        if (!wb_dirty) {
+            pthread_cond_wait(&wb_cond, &wb_lock);
+            continue;
+        }
+        if (!wb_kick) {
+            struct timespec deadline = wb_since;
+            deadline.tv_sec += wb_age_ms / 1000;
+            deadline.tv_nsec += (long)(wb_age_ms % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait(&wb_cond, &wb_lock, &deadline) != ETIMEDOUT) {
+                continue;  // recheck state
+            }
+        }
+
+        // blocks dirtied during the writeback start a new age
+        wb_dirty = wb_kick = 0;
+        pthread_mutex_unlock(&wb_lock);
+        int status = write_back();
+        pthread_mutex_lock(&wb_lock);
+        if (status < 0) {
+            wb_error = status;
+        }
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return NULL;
+}
+
+/**
+ * Starts the writeback thread, if writeback was configured.
+ * Called when the volume is mounted.
+ *
+ * @return 0 if successful or not configured, or -1 if error
+ */
+int start_writeback(void)
+{
+    if (wb_age_ms <= 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&wb_lock);
+    wb_dirty = wb_kick = wb_stopping = 0;
+    wb_running = pthread_create(&wb_thread, NULL, writeback_thread, NULL) == 0;
+    pthread_mutex_unlock(&wb_lock);
+    return wb_running ? 0 : -1;
+}
+
+/**
+ * Stops the writeback thread, if it is running. Called when the
+ * volume is unmounted; dirty blocks are then written synchronously.
+ */
+void stop_writeback(void)
+{
+    pthread_mutex_lock(&wb_lock);
+    if (!wb_running) {
+        pthread_mutex_unlock(&wb_lock);
+        return;
+    }
+    wb_running = 0;
+    wb_stopping = 1;
+    pthread_cond_signal(&wb_cond);
+    pthread_mutex_unlock(&wb_lock);
+    pthread_join(wb_thread, NULL);
+}
+
+/**
+ * Returns 1 if the writeback thread is running, so that flushes of
+ * metadata can be deferred to it.
+ *
+ * @return 1 if the writeback thread is running, 0 if not
+ */
+int is_writeback_running(void)
+{
+    pthread_mutex_lock(&wb_lock);
+    int running = wb_running;
+    pthread_mutex_unlock(&wb_lock);
+    return running;
+}
+
+/**
+ * Defers writing back dirty metadata and data to the writeback
+ * thread, and wakes it if the dirty ratio threshold is exceeded.
+ *
+ * @return 1 if deferred, or 0 if the writeback thread is not running
+ */
+int defer_writeback(void)
+{
+    if (!is_writeback_running()) {
+        return 0;
+    }
+    int over = count_dirty_metadata() * 100 >= wb_ratio * fs.n_meta
+            || (wb_cache != NULL && blkcache_dirty_ratio(wb_cache) >= wb_ratio);
+
+    pthread_mutex_lock(&wb_lock);
+    if (!wb_dirty) {  // start the age of the oldest dirty block
+        wb_dirty = 1;
+        clock_gettime(CLOCK_REALTIME, &wb_since);
+        pthread_cond_signal(&wb_cond);
+    }
+    if (over && !wb_kick) {
+        wb_kick = 1;
+        pthread_cond_signal(&wb_cond);
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return 1;
+}
+
+/**
+ * Writes back dirty cached data blocks and metadata, and makes
+ * them durable: the data is flushed before the metadata that
+ * refers to it is committed, and the device is flushed again.
+ *
+ * Errors
+ *   -EIO     - error writing back, now or in an earlier writeback
+ *              by the thread that has not been reported
+ *
+ * @return 0 if successful, or -error
+ */
+int sync_writeback(void)
+{
+    int status = write_back();
+    pthread_mutex_lock(&wb_lock);
+    if (status == 0) {
+        status = wb_error;
+    }
+    wb_error = 0;
+    pthread_mutex_unlock(&wb_lock);
+    return status;
+}
@@ -0,0 +1,76 @@
+/*
+ * fs_util_writeback.h
+ *
+ * description: background writeback functions for CS 5600 / 7600 file system
+ *
+ * CS 5600, Computer Systems, Northeastern CCIS
+ */
+
+#ifndef FS_UTIL_WRITEBACK_H_
+#define FS_UTIL_WRITEBACK_H_
+
+#include "blkdev.h"
+
+enum {
+    /** default age in ms of the oldest dirty data before it is written back */
+    WRITEBACK_AGE_MS = 5000,
+    /** default percentage of metadata or cache dirty before it is written back */
+    WRITEBACK_RATIO = 10
+};
+
+/**
+ * Configures background writeback, before the volume is mounted.
+ * Dirty metadata and cached data blocks are written back when the
+ * oldest has been dirty for age_ms ms, or when ratio percent of the
+ * metadata blocks or of the block cache is dirty.
+ *
+ * @param age_ms the dirty age threshold in ms
+ * @param ratio the dirty ratio threshold in percent
+ * @param cache the block cache device, or NULL if none
+ */
+void configure_writeback(int age_ms, int ratio, struct blkdev *cache);
+
+/**
+ * Starts the writeback thread, if writeback was configured.
+ * Called when the volume is mounted.
+ *
+ * @return 0 if successful or not configured, or -1 if error
+ */
+int start_writeback(void);
+
+/**
+ * Stops the writeback thread, if it is running. Called when the
+ * volume is unmounted; dirty blocks are then written synchronously.
+ */
+void stop_writeback(void);
+
+/**
+ * Returns 1 if the writeback thread is running, so that flushes of
+ * metadata can be deferred to it.
+ *
+ * @return 1 if the writeback thread is running, 0 if not
+ */
+int is_writeback_running(void);
+
+/**
+ * Defers writing back dirty metadata and data to the writeback
+ * thread, and wakes it if the dirty ratio threshold is exceeded.
+ *
+ * @return 1 if deferred, or 0 if the writeback thread is not running
+ */
+int defer_writeback(void);
+
+/**
+ * Writes back dirty cached data blocks and metadata, and makes
+ * them durable: the data is flushed before the metadata that
+ * refers to it is committed, and the device is flushed again.
+ *
+ * Errors
+ *   -EIO     - error writing back, now or in an earlier writeback
+ *              by the thread that has not been reported
+ *
+ * @return 0 if successful, or -error
+ */
+int sync_writeback(void);
+
+#endif /* FS_UTIL_WRITEBACK_H_ */
@@ -18,6 +18,7 @@
 #include <time.h>
 #include <assert.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/stat.h>
 
 #include "fsx600.h"
@@ -25,16 +26,18 @@
 char *disk;
 
 /**
- * Parse integer and return parsed value.
- * Can include 'k' and 'm' suffix
+ * Parse 64-bit integer and return parsed value.
+ * Can include 'k', 'm', and 'g' suffix
  */
-int parseint(char *s)
+off_t parseint(char *s)
 {
-    int n = strtol(s, &s, 0);
+    off_t n = strtoll(s, &s, 0);
     if (tolower(*s) == 'k')
         return n * 1024;
     if (tolower(*s) == 'm')
         return n * 1024 * 1024;
+    if (tolower(*s) == 'g')
+        return n * 1024 * 1024 * 1024;
     return n;
 }
 
@@ -43,17 +46,39 @@ int parseint(char *s)
 
 /**
  * Generates image file.
- * Usage: mkfs-x6 [-size #] file.img
- * If file doesn't exist, create with size '#' (K and M suffixes allowed)
+ * Usage: mkfs-x6 [-size #] [-inodes #] [-blksize #] [-journal #] file.img
+ * If file doesn't exist, create with size '#' (K, M, and G suffixes
+ * allowed). The number of inodes defaults to one per 4 blocks.
+ * The block size is a power of 2 from 1K to 64K, and defaults to 1K;
+ * large blocks suit volumes of large files that are streamed, and
+ * small blocks suit volumes of many small files.
+ * The metadata journal follows the inodes, and its number of blocks
+ * defaults to 1/64 of the volume, up to 4M bytes; 0 makes a volume
+ * without a journal, whose metadata is written in place.
+ * Only the metadata blocks are written; the data blocks of a new
+ * image file are left as a hole.
  *
  * @param argc number of args including program name
  * @param argv argv[1]: -size argv[2]: size, argv[3] image file name
  */
 int main(int argc, char **argv)
 {
-    int i, fd = -1, size = 0;
-    if (!strcmp(argv[1], "-size") && argc >= 3) {
-        size = parseint(argv[2]);
+    int i, fd = -1;
+    off_t size = 0, n_inos = 0;
+    int blk_size = FS_MIN_BLOCK_SIZE;
+    int n_jnl_blks = -1;
+    while (argc >= 3 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-size")) {
+            size = parseint(argv[2]);
+        } else if (!strcmp(argv[1], "-inodes")) {
+            n_inos = parseint(argv[2]);
+        } else if (!strcmp(argv[1], "-blksize")) {
+            blk_size = parseint(argv[2]);
+        } else if (!strcmp(argv[1], "-journal")) {
+            n_jnl_blks = parseint(argv[2]);
+        } else {
+            break;
+        }
         argv += 2;
         argc -= 2;
     }
@@ -67,43 +92,93 @@ int main(int argc, char **argv)
         }
     }
     if (fd < 0) {
-        printf("usage: mkfs-x6 [-size #] file.img\n");
+        printf("usage: mkfs-x6 [-size #] [-inodes #] [-blksize #] [-journal #] file.img\n");
+        exit(1);
+    }
+
+    if (blk_size < FS_MIN_BLOCK_SIZE || blk_size > FS_MAX_BLOCK_SIZE
+            || (blk_size & (blk_size - 1)) != 0) {
+        printf("bad block size: %d (power of 2 from %d to %d)\n",
+               blk_size, FS_MIN_BLOCK_SIZE, FS_MAX_BLOCK_SIZE);
         exit(1);
     }
 
-    if (size % FS_BLOCK_SIZE != 0) {
-        printf("WARNING: disk size not a multiple of block size: %d (0x%x)\n",
-               size, size);
+    if (size % blk_size != 0) {
+        printf("WARNING: disk size not a multiple of block size: %lld (0x%llx)\n",
+               (long long)size, (long long)size);
     }
-    int n_blks = size / FS_BLOCK_SIZE;
-    int n_map_blks = DIV_ROUND_UP(n_blks, 8*FS_BLOCK_SIZE);
-    int n_inos = n_blks / 4;
-    int n_ino_map_blks = DIV_ROUND_UP(n_inos, 8*FS_BLOCK_SIZE);
+
+    // block numbers are ints, and directory entries hold 30-bit inodes
+    if (size / blk_size > INT_MAX) {
+        printf("disk size too large: more than %d blocks\n", INT_MAX);
+        exit(1);
+    }
+    int n_blks = size / blk_size;
+    if (n_inos == 0) {
+        n_inos = n_blks / 4;
+    }
+    if (n_inos >= (1 << 30) || n_inos > n_blks) {
+        printf("too many inodes: %lld\n", (long long)n_inos);
+        exit(1);
+    }
+    int n_map_blks = DIV_ROUND_UP(n_blks, FS_BITS_PER_BLK(blk_size));
+    int n_ino_map_blks = DIV_ROUND_UP(n_inos, FS_BITS_PER_BLK(blk_size));
     int n_ino_blks = DIV_ROUND_UP(n_inos*sizeof(struct fs_inode),
-                                  FS_BLOCK_SIZE);
+                                  blk_size);
+
+    // journal of 1/64 of volume up to 4M, or none if very small
+    if (n_jnl_blks < 0) {
+        n_jnl_blks = n_blks / 64;
+        if (n_jnl_blks > (4 << 20) / blk_size) {
+            n_jnl_blks = (4 << 20) / blk_size;
+        }
+        if (n_jnl_blks < 8) {
+            n_jnl_blks = 0;
+        }
+    }
 
-    disk = malloc(n_blks * FS_BLOCK_SIZE);
-    memset(disk, 0, n_blks * FS_BLOCK_SIZE);
+    // metadata blocks and journal, through the root directory block
+    int n_meta_blks = 1 + n_ino_map_blks + n_map_blks + n_ino_blks + n_jnl_blks + 1;
+    if (n_meta_blks > n_blks) {
+        printf("disk too small: %d metadata and journal blocks\n", n_meta_blks);
+        exit(1);
+    }
+    size_t meta_size = (size_t)n_meta_blks * blk_size;
+    disk = calloc(n_meta_blks, blk_size);
+    if (disk == NULL) {
+        printf("cannot allocate %d metadata blocks\n", n_meta_blks);
+        exit(1);
+    }
 
     struct fs_super *sb = (void*)disk;
 
     int inode_map_base = 1;
-    fd_set *inode_map = (void*)(disk + inode_map_base*FS_BLOCK_SIZE);
+    fd_set *inode_map = (void*)(disk + (size_t)inode_map_base*blk_size);
 
     int block_map_base = inode_map_base + n_ino_map_blks;
-    fd_set *block_map = (void*)(disk + block_map_base*FS_BLOCK_SIZE);
+    fd_set *block_map = (void*)(disk + (size_t)block_map_base*blk_size);
 
     int inode_base = block_map_base + n_map_blks;
-    struct fs_inode *inodes = (void*)(disk + inode_base*FS_BLOCK_SIZE);
+    struct fs_inode *inodes = (void*)(disk + (size_t)inode_base*blk_size);
+
+    int journal_base = inode_base + n_ino_blks;
+    struct fs_journal_block *jsb = (void*)(disk + (size_t)journal_base*blk_size);
 
-    int rootdir_base = inode_base + n_ino_blks;
-    struct fs_dirent *root_de = (void*)(disk + rootdir_base*FS_BLOCK_SIZE);
+    int rootdir_base = journal_base + n_jnl_blks;
+    struct fs_dirent *root_de = (void*)(disk + (size_t)rootdir_base*blk_size);
 
     /* set superblock */
     *sb = (struct fs_super){.magic = FS_MAGIC, .inode_map_sz = n_ino_map_blks,
             .inode_region_sz = n_ino_blks,
             .block_map_sz = n_map_blks,
-            .num_blocks = n_blks, .root_inode = 1};
+            .num_blocks = n_blks, .root_inode = 1,
+            .block_size = blk_size, .journal_sz = n_jnl_blks};
+    if (n_jnl_blks > 0) {  // empty journal, replay starts at block 1
+        jsb->magic = FS_JOURNAL_MAGIC;
+        jsb->type = FS_JOURNAL_SUPER;
+        jsb->seq = 1;
+        jsb->count = 1;
+    }
     FD_SET(0, inode_map); // inode 0 unused
 
     // set blocks in block bitmap allocated
@@ -144,11 +219,17 @@ int main(int argc, char **argv)
      *       2 - block map
      *       3,4,5,6 - inodes
      *       7 - root directory (inode 1)
+     * with a journal, the journal blocks come before the root directory
      */
 
 
-    assert(size == n_blks* FS_BLOCK_SIZE);
-    write(fd, disk, size);
+    // write metadata, and extend image to full size
+    assert(size == (off_t)n_blks * blk_size);
+    if (write(fd, disk, meta_size) != (ssize_t)meta_size
+            || ftruncate(fd, size) < 0) {
+        perror("cannot write image");
+        exit(1);
+    }
     close(fd);
 
     return 0;
@@ -19,6 +19,11 @@
 
 #include "fsx600.h"
 
+enum {
+    /** block size of test image, which records no block size */
+    FS_BLOCK_SIZE = FS_MIN_BLOCK_SIZE
+};
+
 char *disk;
 fd_set *inode_map;
 fd_set *block_map;
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <time.h>
@@ -22,6 +23,16 @@ static void *disk;
 /** disk superblock */
 static struct fs_super *sb;
 
+/** block size of the volume, from the superblock */
+static int blk_size;
+
+/** block size and entries per block of the volume */
+#define FS_BLOCK_SIZE blk_size
+#define DIRENTS_PER_BLK FS_DIRENTS_PER_BLK(blk_size)
+#define INODES_PER_BLK FS_INODES_PER_BLK(blk_size)
+#define PTRS_PER_BLK FS_PTRS_PER_BLK(blk_size)
+#define BITS_PER_BLK FS_BITS_PER_BLK(blk_size)
+
 /** disk block map */
 static fd_set *block_map;
 
@@ -48,7 +59,7 @@ static int head = 0, tail = 0;
  * @return 1 if successful, 0 if error
  */
 int check_directory_block(int inum, int blkno) {
-    struct fs_dirent *de = disk + blkno * FS_BLOCK_SIZE;
+    struct fs_dirent *de = disk + (size_t)blkno * FS_BLOCK_SIZE;
     if (!FD_ISSET(blkno, block_map)) {
         printf("\n***ERROR*** block %d marked free\n", blkno);
     }
@@ -62,7 +73,7 @@ int check_directory_block(int inum, int blkno) {
             printf("  %s %d %s\n", de[i].isDir ? "D" : "F", de[i].inode,
                    de[i].name);
             int j = de[i].inode;
-            if (j < 0 || j >= sb->inode_region_sz * 16) {
+            if (j < 0 || j >= sb->inode_region_sz * INODES_PER_BLK) {
                 printf("***ERROR*** invalid inode %d\n", j);
                 continue;
             }
@@ -134,7 +145,7 @@ int check_directory(int inum, struct fs_inode* in) {
     // check indirect directory blocks
     if (in->indir_1 != 0) {
         // indirect-1 block
-        int *indblk_1 = disk + in->indir_1 * FS_BLOCK_SIZE;
+        int *indblk_1 = disk + (size_t)in->indir_1 * FS_BLOCK_SIZE;
         for (int idx1 = 0; idx1 < PTRS_PER_BLK; idx1++) {
             if (indblk_1[idx1] == 0) {  // no more entries in block
                 break;
@@ -149,14 +160,14 @@ int check_directory(int inum, struct fs_inode* in) {
 
     // check double indirect directory blocks
     if (in->indir_2 != 0) {
-        int *indblk_2 = disk + in->indir_2 * FS_BLOCK_SIZE;
+        int *indblk_2 = disk + (size_t)in->indir_2 * FS_BLOCK_SIZE;
         for (int idx2 = 0; idx2 < PTRS_PER_BLK; idx2++) {
             if (indblk_2[idx2] == 0) {
                 break;
             }
 
             // found indirect block
-            int *indblk_1 = disk + indblk_2[idx2] * FS_BLOCK_SIZE;
+            int *indblk_1 = disk + (size_t)indblk_2[idx2] * FS_BLOCK_SIZE;
             for (int idx1 = 0; idx1 < PTRS_PER_BLK; idx1++) {
                 if (indblk_1[idx1] == 0) {
                     break;
@@ -173,6 +184,63 @@ int check_directory(int inum, struct fs_inode* in) {
 }
 #endif  /* FS_VERSION */
 
+#if (FS_VERSION > 4)
+/**
+ * Report a data block of a file, and mark it reached
+ *
+ * @param blkno the block number
+ */
+static void report_block(int blkno) {
+    printf("%d ", blkno);
+    FD_SET(blkno, blkmap);
+    if (!FD_ISSET(blkno, block_map)) {
+        printf("\n***ERROR*** block %d marked free\n", blkno);
+    }
+}
+
+/**
+ * Report the data blocks mapped by an indirect block
+ *
+ * @param blkno the indirect block
+ * @param depth the levels of indirect blocks, from this one down
+ */
+static void report_indirect(int blkno, int depth) {
+    int *buf = disk + (size_t)blkno * FS_BLOCK_SIZE;
+    for (int i = 0; i < PTRS_PER_BLK; i++) {
+        if (buf[i] != 0) {
+            if (depth == 1) {
+                report_block(buf[i]);
+            } else {
+                report_indirect(buf[i], depth - 1);
+            }
+        }
+    }
+}
+
+/**
+ * Report the data blocks of the extents of an extent tree node
+ * and of the nodes below it
+ *
+ * @param h the node
+ */
+static void report_extents(struct fs_extent_header *h) {
+    if (h->magic != FS_EXTENT_MAGIC) {
+        printf("\n***ERROR*** bad extent tree node\n");
+        return;
+    }
+    struct fs_extent *ex = (void*)(h + 1);
+    for (int i = 0; i < h->count; i++) {
+        if (h->depth == 0) {
+            for (uint32_t k = 0; k < ex[i].len; k++) {
+                report_block(ex[i].start + k);
+            }
+        } else {
+            report_extents(disk + (size_t)ex[i].start * FS_BLOCK_SIZE);
+        }
+    }
+}
+#endif  /* FS_VERSION > 4 */
+
 /**
  * Read and print memory summary of cs/5600/7600 file system
  *
@@ -194,27 +262,36 @@ int main(int argc, char **argv)
         perror("fstat");
         exit(1);
     }
-    int size = _sb.st_size;
+    off_t size = _sb.st_size;
 
-    // read file into memory
-    disk = malloc(size);
-    if (read(fd, disk, size) != size) {
-        perror("read");
+    // map file into memory
+    disk = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (disk == MAP_FAILED) {
+        perror("mmap");
         exit(1);
     }
-    blkmap = calloc(size/BITS_PER_BLK, 1);
-    imap = calloc(size/BITS_PER_BLK, 1);
 
     // report on superblock
     sb = (void*)disk;
+    blk_size = (sb->block_size == 0) ? FS_MIN_BLOCK_SIZE : sb->block_size;
     printf("superblock: magic:  %08x\n"
            "            imap:   %d blocks\n"
            "            bmap:   %d blocks\n"
            "            inodes: %d blocks\n"
            "            blocks: %d\n"
+           "            block size: %d\n"
+           "            journal: %d blocks\n"
            "            root inode: %d\n\n",
            sb->magic, sb->inode_map_sz, sb->block_map_sz,
-           sb->inode_region_sz, sb->num_blocks, sb->root_inode);
+           sb->inode_region_sz, sb->num_blocks, blk_size, sb->journal_sz,
+           sb->root_inode);
+    if (blk_size < FS_MIN_BLOCK_SIZE || blk_size > FS_MAX_BLOCK_SIZE
+            || (blk_size & (blk_size - 1)) != 0) {
+        printf("bad block size\n");
+        exit(1);
+    }
+    blkmap = calloc(size/BITS_PER_BLK + 1, 1);
+    imap = calloc(size/BITS_PER_BLK + 1, 1);
 
     // report on inode map
     printf("allocated inodes: ");
@@ -230,7 +307,7 @@ int main(int argc, char **argv)
 
     // report on block map
     printf("allocated blocks: ");
-    block_map = (void*)inode_map + sb->inode_map_sz * FS_BLOCK_SIZE;
+    block_map = (void*)inode_map + (size_t)sb->inode_map_sz * FS_BLOCK_SIZE;
     for (comma = "", i = 0; i < sb->block_map_sz * BITS_PER_BLK; i++) {
         if (FD_ISSET(i, block_map)) {
             printf("%s %d", comma, i);
@@ -240,7 +317,7 @@ int main(int argc, char **argv)
     printf("\n\n");
 
     // point to inodes
-    struct fs_inode *inodes = (void*)block_map + sb->block_map_sz * FS_BLOCK_SIZE;
+    struct fs_inode *inodes = (void*)block_map + (size_t)sb->block_map_sz * FS_BLOCK_SIZE;
 
     int max_inodes = sb->inode_region_sz * INODES_PER_BLK;
     inode_list = calloc(sizeof(struct entry), max_inodes + 100);
@@ -255,10 +332,26 @@ int main(int argc, char **argv)
             printf("file: inode %d\n"
                    "      uid/gid %d/%d\n"
                    "      mode %08o\n"
-                   "      size  %d\n"
+                   "      size  %lld\n"
                    "      nlink %d\n",
-                   e.inum, in->uid, in->gid, in->mode, in->size, in->nlink);
+                   e.inum, in->uid, in->gid, in->mode,
+                   (long long)in->size | (long long)in->size_hi << 32, in->nlink);
+#if (FS_VERSION > 3)
+            // data stored inline in place of block pointers
+            if (in->flags & FS_INLINE_DATA) {
+                printf("inline data\n\n");
+                continue;
+            }
+#endif  /* FS_VERSION > 3 */
             printf("blocks: ");
+#if (FS_VERSION > 4)
+            // blocks mapped by extent tree rooted in place of block pointers
+            if (in->flags & FS_EXTENTS) {
+                report_extents((struct fs_extent_header *)in->direct);
+                printf("\n\n");
+                continue;
+            }
+#endif  /* FS_VERSION > 4 */
 
             // report on direct blocks
             for (i = 0; i < N_DIRECT; i++) {
@@ -272,7 +365,7 @@ int main(int argc, char **argv)
 
             // report on single indirect blocks
             if (in->indir_1 != 0) {
-                int *buf = disk + in->indir_1 * FS_BLOCK_SIZE;
+                int *buf = disk + (size_t)in->indir_1 * FS_BLOCK_SIZE;
                 for (i = 0; i < PTRS_PER_BLK; i++) {
                     if (buf[i] != 0) {
                         printf("%d ", buf[i]);
@@ -286,12 +379,12 @@ int main(int argc, char **argv)
 
             // report on double indirect blocks
             if (in->indir_2 != 0) {
-                int *buf2 = disk + in->indir_2 * FS_BLOCK_SIZE;
+                int *buf2 = disk + (size_t)in->indir_2 * FS_BLOCK_SIZE;
                 // scan indirect block
                 for (i = 0; i < PTRS_PER_BLK; i++) {
                     if (buf2[i] != 0) {
                         // scan double-indirect block
-                        int *buf = disk + buf2[i] * FS_BLOCK_SIZE;
+                        int *buf = disk + (size_t)buf2[i] * FS_BLOCK_SIZE;
                         for (j = 0; j < PTRS_PER_BLK; j++) {
                             if (buf[j] != 0) {
                                 printf("%d ", buf[j]);
@@ -304,6 +397,12 @@ int main(int argc, char **argv)
                     }
                 }
             }
+#if (FS_VERSION > 4)
+            // report on triple indirect blocks
+            if (in->indir_3 != 0) {
+                report_indirect(in->indir_3, 3);
+            }
+#endif  /* FS_VERSION > 4 */
             printf("\n\n");
         }
         else {
@@ -319,7 +418,7 @@ int main(int argc, char **argv)
 
     // report on unreachable inodes
     printf("unreachable inodes: ");
-    for (i = 1; i < sb->inode_region_sz * 16; i++) {
+    for (i = 1; i < sb->inode_region_sz * INODES_PER_BLK; i++) {
         if (!FD_ISSET(i, imap) && FD_ISSET(i, inode_map)) {
             printf("%d ", i);
         }
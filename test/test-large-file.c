@@ -0,0 +1,202 @@
+/*
+ * file:        test-large-file.c
+ * description: large file offset test for
+ *              CS 5600 / 7600 file system.
+ *
+ * Checks that do_write() and do_read() transfer data at byte
+ * offsets above 2 GiB, where the byte offset of a block index no
+ * longer fits in an int, on volumes with 4K and 64K blocks. Each
+ * file is sparse, so only the blocks that are written are allocated,
+ * and the volume is made in a small temporary image file accessed
+ * through the image block device, layered by blkscale_create() as
+ * it is when mounted. Each block size is tested in its own process,
+ * as the file system caches are sized for one block size.
+ *
+ * Usage: test-large-file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "fs_util_file.h"
+#include "fs_util_meta.h"
+#include "fs_util_vol.h"
+#include "blkdev.h"
+#include "blkscale.h"
+#include "image.h"
+
+/** Instance of ex2 fs structure */
+struct ext2_fs fs;
+
+/** Disk block device */
+struct blkdev *disk;
+
+/** 2 GiB, the first byte offset that does not fit in an int */
+#define GIB_2 ((off_t)2 << 30)
+
+/** 3 GiB, a byte offset well above the int range */
+#define GIB_3 ((off_t)3 << 30)
+
+/**
+ * Make an empty file system with a block size in an image file,
+ * laid out as: superblock, inode map, block map, inodes, and root
+ * directory block, and mount it.
+ *
+ * @param path the image file
+ * @param blk_size the block size
+ * @param vol_size the volume size in bytes
+ */
+static void make_volume(char *path, int blk_size, off_t vol_size)
+{
+    set_block_size(blk_size);
+
+    fs.n_blocks = vol_size / blk_size;
+    fs.n_inodes = INODES_PER_BLK;
+    fs.inode_map_base = 1;
+    fs.inode_map = calloc(1, FS_BLOCK_SIZE);
+    fs.block_map_base = 2;
+    int n_map_blks = (fs.n_blocks + BITS_PER_BLK - 1) / BITS_PER_BLK;
+    fs.block_map = calloc(n_map_blks, FS_BLOCK_SIZE);
+    fs.inode_base = fs.block_map_base + n_map_blks;
+    fs.inodes = calloc(1, FS_BLOCK_SIZE);
+    fs.n_meta = fs.inode_base + 1;
+    fs.dirty_map = calloc((fs.n_meta + 63) / 64, sizeof(uint64_t));
+    init_inode_locks();
+
+    // root directory in first block after metadata
+    fs.root_inode = 1;
+    fs.inodes[1].mode = S_IFDIR | 0777;
+    fs.inodes[1].direct[0] = fs.n_meta;
+    for (int i = 0; i <= fs.n_meta; i++) {
+        FD_SET(i, fs.block_map);
+    }
+    FD_SET(0, fs.inode_map);
+    FD_SET(1, fs.inode_map);
+    fs.n_blocks_free = fs.n_blocks - (fs.n_meta + 1);
+    fs.n_inodes_free = fs.n_inodes - 2;
+
+    // empty image file of volume size, accessed in volume blocks
+    if (truncate(path, 0) < 0 || truncate(path, vol_size) < 0) {
+        perror("cannot make image");
+        exit(1);
+    }
+    disk = image_create(path);
+    if (disk != NULL && blk_size != BLOCK_SIZE) {
+        disk = blkscale_create(disk, blk_size);
+    }
+    if (disk == NULL) {
+        printf("cannot open image %s\n", path);
+        exit(1);
+    }
+}
+
+/**
+ * Report a failed check and exit with a failure status.
+ *
+ * @param blk_size the block size of the volume
+ * @param what description of the failed check
+ */
+static void fail(int blk_size, const char *what)
+{
+    printf("%d: %s\n", blk_size, what);
+    exit(1);
+}
+
+/**
+ * Run the large file checks on a volume with a block size.
+ *
+ * @param blk_size the block size
+ */
+static void test_large_file(int blk_size)
+{
+    char buf[16], zeros[16] = {0};
+
+    // a few bytes at 3 GiB, read back, and the hole before them
+    int inum = init_new_inode(0777, S_IFREG);
+    if (do_write(inum, "abcd", 4, GIB_3) != 4) {
+        fail(blk_size, "write at 3 GiB failed");
+    }
+    if (get_inode_size(&fs.inodes[inum]) != GIB_3 + 4) {
+        fail(blk_size, "wrong size after write at 3 GiB");
+    }
+    memset(buf, 0xff, sizeof(buf));
+    if (do_read(inum, buf, 8, GIB_3 - 4) != 8 ||
+        memcmp(buf, zeros, 4) != 0 || memcmp(buf + 4, "abcd", 4) != 0) {
+        fail(blk_size, "read at 3 GiB returned wrong data");
+    }
+
+    // a write that crosses 2 GiB, read back in one call
+    char *data = malloc(2 * blk_size), *back = malloc(2 * blk_size);
+    for (int i = 0; i < 2 * blk_size; i++) {
+        data[i] = 'a' + i % 26;
+    }
+    off_t cross = GIB_2 - blk_size / 2;
+    if (do_write(inum, data, 2 * blk_size, cross) != 2 * blk_size) {
+        fail(blk_size, "write across 2 GiB failed");
+    }
+    if (do_read(inum, back, 2 * blk_size, cross) != 2 * blk_size ||
+        memcmp(data, back, 2 * blk_size) != 0) {
+        fail(blk_size, "read across 2 GiB returned wrong data");
+    }
+    free(data);
+    free(back);
+
+    // a file extended to above 3 GiB reads back as zeros
+    int inum2 = init_new_inode(0777, S_IFREG);
+    if (do_truncate(inum2, GIB_3 + 4096) != 0) {
+        fail(blk_size, "truncate to 3 GiB failed");
+    }
+    memset(buf, 0xff, sizeof(buf));
+    if (do_read(inum2, buf, 8, GIB_3) != 8 || memcmp(buf, zeros, 8) != 0) {
+        fail(blk_size, "read of hole at 3 GiB returned wrong data");
+    }
+}
+
+/**
+ * Run large file test.
+ *
+ * @param argc number of args including program name
+ * @param argv no arguments
+ * @return 0 if all checks pass, 1 otherwise
+ */
+int main(int argc, char **argv)
+{
+    if (argc != 1) {
+        printf("usage: test-large-file\n");
+        exit(1);
+    }
+
+    char path[] = "/tmp/test-large-file-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("cannot make image");
+        exit(1);
+    }
+    close(fd);
+
+    int status = 0;
+    int blk_sizes[] = {4096, FS_MAX_BLOCK_SIZE};
+    for (int i = 0; i < 2; i++) {
+        if (fork() == 0) {
+            // room for the metadata and the mapping blocks of the files
+            make_volume(path, blk_sizes[i], 256 * (off_t)blk_sizes[i]);
+            test_large_file(blk_sizes[i]);
+            disk->ops->close(disk);
+            exit(0);
+        }
+        int wstatus;
+        wait(&wstatus);
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+            status = 1;
+        }
+    }
+
+    unlink(path);
+    printf("%s\n", status == 0 ? "ok" : "FAILED");
+    return status;
+}